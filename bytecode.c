@@ -0,0 +1,569 @@
+//
+//  bytecode.c
+//  psim
+//
+//  Created by ThrudTheBarbarian on 16/10/2026.
+//
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "bytecode.h"
+#include "memory.h"
+#include "vm.h"
+
+/*****************************************************************************\
+|* Image layout. Everything is in host byte order, so an image from a machine
+|* of the other endianness fails the version check and is simply rebuilt
+|*
+|*  header      magic, version, build flags, source hash, source length
+|*  globals     count, then the name of each global slot
+|*  function    the top-level function, with nested functions inline
+|*  checksum    hash of every byte before it
+|*
+|* A function is its arity, upvalue count, frame size and name, then its code,
+|* line runs and inline cache count, then its constants. Each constant is
+|* tagged as a number, integer, string or function, and functions are written
+|* in full
+\*****************************************************************************/
+#define BYTECODE_MAGIC      "psimbc"
+#define BYTECODE_VERSION    6
+
+#define BUILD_NAN_BOXING    0x01
+#define BUILD_INTEGER_ONLY  0x02
+
+#ifdef NAN_BOXING
+#  define BUILD_NAN_FLAG    BUILD_NAN_BOXING
+#else
+#  define BUILD_NAN_FLAG    0
+#endif
+
+#ifdef INTEGER_ONLY
+#  define BUILD_INT_FLAG    BUILD_INTEGER_ONLY
+#else
+#  define BUILD_INT_FLAG    0
+#endif
+
+#define BUILD_FLAGS         (BUILD_NAN_FLAG | BUILD_INT_FLAG)
+
+typedef enum
+    {
+    CONST_NUMBER,
+    CONST_INTEGER,
+    CONST_STRING,
+    CONST_FUNCTION,
+    } ConstantTag;
+
+#define NO_NAME             UINT32_MAX      // Name length of the script
+
+#define FNV64_BASIS         14695981039346656037ull
+#define FNV64_PRIME         1099511628211ull
+
+/*****************************************************************************\
+|* Helper function: Extend a 64-bit FNV-1a hash over some bytes
+\*****************************************************************************/
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t size)
+    {
+    const uint8_t* bytes = (const uint8_t*)data;
+    for (size_t i = 0; i < size; i++)
+        {
+        hash ^= bytes[i];
+        hash *= FNV64_PRIME;
+        }
+    return hash;
+    }
+
+
+#pragma mark - Writing
+
+/*****************************************************************************\
+|* Writer state. Once a write has failed the rest are skipped, so the result
+|* only needs checking at the end
+\*****************************************************************************/
+typedef struct
+    {
+    FILE*       file;
+    uint64_t    hash;               // Checksum of everything written
+    bool        failed;
+    } Writer;
+
+/*****************************************************************************\
+|* Helper function: Write some bytes to the image
+\*****************************************************************************/
+static void writeBytes(Writer* writer, const void* data, size_t size)
+    {
+    if (writer->failed)
+        return;
+
+    if (fwrite(data, 1, size, writer->file) != size)
+        writer->failed = true;
+    writer->hash = hashBytes(writer->hash, data, size);
+    }
+
+static void writeByte(Writer* writer, uint8_t byte)
+    {
+    writeBytes(writer, &byte, sizeof(byte));
+    }
+
+static void writeU32(Writer* writer, uint32_t word)
+    {
+    writeBytes(writer, &word, sizeof(word));
+    }
+
+static void writeString(Writer* writer, ObjString* string)
+    {
+    writeU32(writer, (uint32_t)string->length);
+    writeBytes(writer, string->chars, string->length);
+    }
+
+/*****************************************************************************\
+|* Helper function: Write a function, and any functions in its constants
+\*****************************************************************************/
+static void writeFunction(Writer* writer, ObjFunction* function)
+    {
+    Chunk* chunk = &function->chunk;
+
+    writeU32(writer, (uint32_t)function->arity);
+    writeU32(writer, (uint32_t)function->upvalueCount);
+    writeU32(writer, (uint32_t)function->maxSlots);
+    if (function->name == NULL)
+        writeU32(writer, NO_NAME);
+    else
+        writeString(writer, function->name);
+
+    writeU32(writer, (uint32_t)chunk->count);
+    writeBytes(writer, chunk->code, chunk->count);
+    writeU32(writer, (uint32_t)chunk->lineCount);
+    writeBytes(writer, chunk->lines, sizeof(LineStart) * chunk->lineCount);
+    writeU32(writer, (uint32_t)chunk->cacheCount);
+
+    writeU32(writer, (uint32_t)chunk->constants.count);
+    for (int i = 0; i < chunk->constants.count; i++)
+        {
+        Value value = chunk->constants.values[i];
+        if (IS_NUMBER(value))
+            {
+            VALUE_TYPE number = AS_NUMBER(value);
+            writeByte(writer, CONST_NUMBER);
+            writeBytes(writer, &number, sizeof(number));
+            }
+        else if (IS_INT(value))
+            {
+            int64_t integer = AS_INT(value);
+            writeByte(writer, CONST_INTEGER);
+            writeBytes(writer, &integer, sizeof(integer));
+            }
+        else if (IS_STRING(value))
+            {
+            writeByte(writer, CONST_STRING);
+            writeString(writer, AS_STRING(value));
+            }
+        else if (IS_FUNCTION(value))
+            {
+            writeByte(writer, CONST_FUNCTION);
+            writeFunction(writer, AS_FUNCTION(value));
+            }
+        else
+            writer->failed = true;
+        }
+    }
+
+/*****************************************************************************\
+|* Write the compiled form of 'source' to an image at 'path'. The image is
+|* written under a temporary name and renamed into place, so a reader never
+|* sees half of one
+\*****************************************************************************/
+bool saveBytecode(const char* path,
+                  ObjFunction* function,
+                  const char* source,
+                  size_t length)
+    {
+    size_t pathLength   = strlen(path);
+    char* tempPath      = (char*)malloc(pathLength + 5);
+    if (tempPath == NULL)
+        return false;
+    memcpy(tempPath, path, pathLength);
+    memcpy(tempPath + pathLength, ".tmp", 5);
+
+    Writer writer;
+    writer.file         = fopen(tempPath, "wb");
+    writer.hash         = FNV64_BASIS;
+    writer.failed       = (writer.file == NULL);
+    if (writer.failed)
+        {
+        free(tempPath);
+        return false;
+        }
+
+    writeBytes(&writer, BYTECODE_MAGIC, sizeof(BYTECODE_MAGIC));
+    writeU32(&writer, BYTECODE_VERSION);
+    writeU32(&writer, BUILD_FLAGS);
+    uint64_t sourceHash = hashBytes(FNV64_BASIS, source, length);
+    uint64_t sourceSize = length;
+    writeBytes(&writer, &sourceHash, sizeof(sourceHash));
+    writeBytes(&writer, &sourceSize, sizeof(sourceSize));
+
+    writeU32(&writer, (uint32_t)vm.globalSlotNames.count);
+    for (int i = 0; i < vm.globalSlotNames.count; i++)
+        writeString(&writer, AS_STRING(vm.globalSlotNames.values[i]));
+
+    writeFunction(&writer, function);
+
+    uint64_t checksum   = writer.hash;
+    writeBytes(&writer, &checksum, sizeof(checksum));
+
+    bool ok             = !writer.failed;
+    if (fclose(writer.file) != 0)
+        ok = false;
+    if (ok && (rename(tempPath, path) != 0))
+        ok = false;
+    if (!ok)
+        remove(tempPath);
+
+    free(tempPath);
+    return ok;
+    }
+
+
+#pragma mark - Reading
+
+/*****************************************************************************\
+|* Reader state. Every read is bounds-checked, and once one has failed the
+|* rest return zeroes, so the result only needs checking at the end
+\*****************************************************************************/
+typedef struct
+    {
+    const uint8_t*  next;           // Next unread byte of the image
+    const uint8_t*  end;            // One past the last byte
+    int*            slots;          // Image global slot -> VM global slot
+    int             slotCount;      // Number of global slots in the image
+    bool            failed;
+    } Reader;
+
+/*****************************************************************************\
+|* Helper function: Take the next 'size' bytes of the image, or NULL if
+|* there aren't that many left
+\*****************************************************************************/
+static const uint8_t* readBytes(Reader* reader, size_t size)
+    {
+    if (reader->failed || ((size_t)(reader->end - reader->next) < size))
+        {
+        reader->failed = true;
+        return NULL;
+        }
+
+    const uint8_t* bytes = reader->next;
+    reader->next += size;
+    return bytes;
+    }
+
+static uint8_t readByte(Reader* reader)
+    {
+    const uint8_t* bytes = readBytes(reader, sizeof(uint8_t));
+    return (bytes == NULL) ? 0 : *bytes;
+    }
+
+static uint32_t readU32(Reader* reader)
+    {
+    uint32_t word        = 0;
+    const uint8_t* bytes = readBytes(reader, sizeof(word));
+    if (bytes != NULL)
+        memcpy(&word, bytes, sizeof(word));
+    return word;
+    }
+
+static uint64_t readU64(Reader* reader)
+    {
+    uint64_t word        = 0;
+    const uint8_t* bytes = readBytes(reader, sizeof(word));
+    if (bytes != NULL)
+        memcpy(&word, bytes, sizeof(word));
+    return word;
+    }
+
+/*****************************************************************************\
+|* Helper function: Read a count of things that must fit in an int
+\*****************************************************************************/
+static int readCount(Reader* reader)
+    {
+    uint32_t count = readU32(reader);
+    if (count > INT32_MAX)
+        {
+        reader->failed = true;
+        return 0;
+        }
+    return (int)count;
+    }
+
+/*****************************************************************************\
+|* Helper function: Read a string of 'length' characters and intern it
+\*****************************************************************************/
+static ObjString* readString(Reader* reader, uint32_t length)
+    {
+    if (length > INT32_MAX)
+        {
+        reader->failed = true;
+        return NULL;
+        }
+
+    const uint8_t* chars = readBytes(reader, length);
+    if (chars == NULL)
+        return NULL;
+    return copyString((const char*)chars, (int)length);
+    }
+
+/*****************************************************************************\
+|* Helper function: Check the code is made of whole instructions, that the
+|* constants a closure uses are functions, and move each global operand over
+|* to the VM's slot for that name. A fused superinstruction covers the
+|* original instructions, so its own operands are the only ones to fix up
+\*****************************************************************************/
+static bool relinkCode(Reader* reader, Chunk* chunk)
+    {
+    uint8_t* code = chunk->code;
+    int offset    = 0;
+    while (offset < chunk->count)
+        {
+        int globals[2]  = {-1, -1};
+        switch (code[offset])
+            {
+            case OP_CLOSURE:
+                {
+                if (offset + 3 > chunk->count)
+                    return false;
+                int constant = (code[offset + 1] << 8) | code[offset + 2];
+                if ((constant >= chunk->constants.count)
+                ||  !IS_FUNCTION(chunk->constants.values[constant]))
+                    return false;
+                break;
+                }
+
+            case OP_GET_GLOBAL:
+            case OP_SET_GLOBAL:
+            case OP_DEFINE_GLOBAL:
+                globals[0] = offset + 1;
+                break;
+
+            case OP_INC_GLOBAL:
+                globals[0] = offset + 1;
+                globals[1] = offset + 7;
+                break;
+
+            default:
+                break;
+            }
+
+        int length = instructionLength(chunk, offset);
+        if (offset + length > chunk->count)
+            return false;
+
+        for (int i = 0; i < 2; i++)
+            {
+            if (globals[i] < 0)
+                continue;
+
+            int slot = (code[globals[i]] << 8) | code[globals[i] + 1];
+            if (slot >= reader->slotCount)
+                return false;
+            slot                    = reader->slots[slot];
+            code[globals[i]]        = (slot >> 8) & 0xff;
+            code[globals[i] + 1]    = slot & 0xff;
+            }
+
+        offset += length;
+        }
+    return true;
+    }
+
+/*****************************************************************************\
+|* Helper function: Read a function, and any functions in its constants.
+|* Returns NULL if the image is damaged
+\*****************************************************************************/
+static ObjFunction* readFunction(Reader* reader)
+    {
+    // Protect against GC
+    ObjFunction* function   = newFunction();
+    push(OBJ_VAL(function));
+    Chunk* chunk            = &function->chunk;
+
+    function->arity         = readCount(reader);
+    function->upvalueCount  = readCount(reader);
+    function->maxSlots      = readCount(reader);
+    uint32_t nameLength     = readU32(reader);
+    if (nameLength != NO_NAME)
+        {
+        function->name      = readString(reader, nameLength);
+        if (function->name != NULL)
+            writeBarrier((Obj*)function, OBJ_VAL(function->name));
+        }
+
+    int count               = readCount(reader);
+    const uint8_t* code     = readBytes(reader, count);
+    if (code != NULL)
+        {
+        chunk->code         = GROW_ARRAY(uint8_t, NULL, 0, count);
+        memcpy(chunk->code, code, count);
+        chunk->capacity     = count;
+        chunk->count        = count;
+        }
+
+    int lineCount           = readCount(reader);
+    const uint8_t* lines    = readBytes(reader, sizeof(LineStart) * lineCount);
+    if (lines != NULL)
+        {
+        chunk->lines        = GROW_ARRAY(LineStart, NULL, 0, lineCount);
+        memcpy(chunk->lines, lines, sizeof(LineStart) * lineCount);
+        chunk->lineCapacity = lineCount;
+        chunk->lineCount    = lineCount;
+        }
+
+    // Caches only hold what was seen at runtime, so start them out empty
+    int cacheCount          = readCount(reader);
+    for (int i = 0; (i < cacheCount) && !reader->failed; i++)
+        addInlineCache(chunk);
+
+    int constantCount       = readCount(reader);
+    for (int i = 0; (i < constantCount) && !reader->failed; i++)
+        {
+        Value value = NIL_VAL;
+        switch (readByte(reader))
+            {
+            case CONST_NUMBER:
+                {
+                VALUE_TYPE number;
+                const uint8_t* bytes = readBytes(reader, sizeof(number));
+                if (bytes == NULL)
+                    break;
+                memcpy(&number, bytes, sizeof(number));
+                value = NUMBER_VAL(number);
+                break;
+                }
+
+            case CONST_INTEGER:
+                {
+                int64_t integer = (int64_t)readU64(reader);
+                if (!reader->failed)
+                    value = INT_VAL(integer);
+                break;
+                }
+
+            case CONST_STRING:
+                {
+                ObjString* string = readString(reader, readU32(reader));
+                if (string != NULL)
+                    value = OBJ_VAL(string);
+                break;
+                }
+
+            case CONST_FUNCTION:
+                {
+                ObjFunction* nested = readFunction(reader);
+                if (nested != NULL)
+                    value = OBJ_VAL(nested);
+                break;
+                }
+
+            default:
+                reader->failed = true;
+                break;
+            }
+
+        addConstant(chunk, value);
+        writeBarrier((Obj*)function, value);
+        }
+
+    if (!reader->failed && !relinkCode(reader, chunk))
+        reader->failed = true;
+
+    // relinquish the protection
+    pop();
+    return reader->failed ? NULL : function;
+    }
+
+/*****************************************************************************\
+|* Helper function: Check the image header matches this build and 'source',
+|* and that the image is all there
+\*****************************************************************************/
+static bool checkHeader(Reader* reader, const char* source, size_t length)
+    {
+    // The checksum is the last thing in the image, and covers all the rest
+    uint64_t checksum;
+    if ((size_t)(reader->end - reader->next) < sizeof(checksum))
+        return false;
+    reader->end -= sizeof(checksum);
+    memcpy(&checksum, reader->end, sizeof(checksum));
+    if (hashBytes(FNV64_BASIS, reader->next, reader->end - reader->next)
+        != checksum)
+        return false;
+
+    const uint8_t* magic = readBytes(reader, sizeof(BYTECODE_MAGIC));
+    return (magic != NULL)
+        && (memcmp(magic, BYTECODE_MAGIC, sizeof(BYTECODE_MAGIC)) == 0)
+        && (readU32(reader) == BYTECODE_VERSION)
+        && (readU32(reader) == BUILD_FLAGS)
+        && (readU64(reader) == hashBytes(FNV64_BASIS, source, length))
+        && (readU64(reader) == length);
+    }
+
+/*****************************************************************************\
+|* Map the image at 'path' and rebuild the function tree in it. The global
+|* names come first, and each is given a slot in the VM before any code is
+|* read, so global operands can be renumbered as each function is rebuilt
+\*****************************************************************************/
+ObjFunction* loadBytecode(const char* path, const char* source, size_t length)
+    {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+
+    struct stat info;
+    if ((fstat(fd, &info) != 0) || (info.st_size == 0))
+        {
+        close(fd);
+        return NULL;
+        }
+
+    size_t size     = (size_t)info.st_size;
+    void* image     = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (image == MAP_FAILED)
+        return NULL;
+
+    Reader reader;
+    reader.next         = (const uint8_t*)image;
+    reader.end          = reader.next + size;
+    reader.slots        = NULL;
+    reader.slotCount    = 0;
+    reader.failed       = false;
+
+    ObjFunction* function = NULL;
+    if (checkHeader(&reader, source, length))
+        {
+        int slotCount   = readCount(&reader);
+        if (!reader.failed && (slotCount <= UINT16_COUNT))
+            {
+            reader.slots        = ALLOCATE(int, slotCount);
+            for (int i = 0; (i < slotCount) && !reader.failed; i++)
+                {
+                ObjString* name = readString(&reader, readU32(&reader));
+                if (name == NULL)
+                    break;
+
+                int slot = globalSlot(name);
+                if (slot > UINT16_MAX)
+                    reader.failed = true;
+                reader.slots[reader.slotCount++] = slot;
+                }
+
+            if (!reader.failed)
+                function = readFunction(&reader);
+            FREE_ARRAY(int, reader.slots, slotCount);
+            }
+        }
+
+    munmap(image, size);
+    return function;
+    }
@@ -6,9 +6,11 @@
 //
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "chunk.h"
 #include "memory.h"
+#include "object.h"
 #include "vm.h"
 
 /*****************************************************************************\
@@ -19,8 +21,15 @@ void initChunk(Chunk* chunk)
     chunk->count    = 0;
     chunk->capacity = 0;
     chunk->code     = NULL;
-    chunk->lines    = NULL;
+    
+    chunk->lineCount    = 0;
+    chunk->lineCapacity = 0;
+    chunk->lines        = NULL;
     initValueArray(&(chunk->constants));
+    
+    chunk->cacheCount       = 0;
+    chunk->cacheCapacity    = 0;
+    chunk->caches           = NULL;
     }
 
 /*****************************************************************************\
@@ -36,15 +45,61 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line)
                                      chunk->code,
                                      oldCapacity,
                                      chunk->capacity);
-        chunk->lines    = GROW_ARRAY(int,
-                                     chunk->lines,
-                                     oldCapacity,
-                                     chunk->capacity);
         }
 
-    chunk->code[chunk->count]   = byte;
-    chunk->lines[chunk->count]  = line;
+    chunk->code[chunk->count] = byte;
     chunk->count++;
+
+    // Only start a new run if the line has changed
+    if ((chunk->lineCount > 0)
+    &&  (chunk->lines[chunk->lineCount - 1].line == line))
+        return;
+
+    if (chunk->lineCapacity < chunk->lineCount + 1)
+        {
+        int oldCapacity     = chunk->lineCapacity;
+        chunk->lineCapacity = GROW_CAPACITY(oldCapacity);
+        chunk->lines        = GROW_ARRAY(LineStart,
+                                         chunk->lines,
+                                         oldCapacity,
+                                         chunk->lineCapacity);
+        }
+
+    LineStart* lineStart    = &chunk->lines[chunk->lineCount++];
+    lineStart->offset       = chunk->count - 1;
+    lineStart->line         = line;
+    }
+
+/*****************************************************************************\
+|* Throw away the code from 'count' onwards, along with its line runs
+\*****************************************************************************/
+void truncateChunk(Chunk* chunk, int count)
+    {
+    chunk->count = count;
+    while ((chunk->lineCount > 0)
+    &&     (chunk->lines[chunk->lineCount - 1].offset >= count))
+        chunk->lineCount--;
+    }
+
+/*****************************************************************************\
+|* Return the source line of the byte at 'offset', by a binary search for the
+|* last run that starts at or before it
+\*****************************************************************************/
+int getLine(Chunk* chunk, int offset)
+    {
+    int start   = 0;
+    int end     = chunk->lineCount - 1;
+
+    while (start < end)
+        {
+        int mid = (start + end + 1) / 2;
+        if (chunk->lines[mid].offset <= offset)
+            start = mid;
+        else
+            end = mid - 1;
+        }
+
+    return (chunk->lineCount > 0) ? chunk->lines[start].line : 0;
     }
 
 /*****************************************************************************\
@@ -53,8 +108,9 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line)
 void freeChunk(Chunk* chunk)
     {
     FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
-    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    FREE_ARRAY(LineStart, chunk->lines, chunk->lineCapacity);
     freeValueArray(&chunk->constants);
+    FREE_ARRAY(InlineCache, chunk->caches, chunk->cacheCapacity);
 
     initChunk(chunk);
     }
@@ -73,3 +129,92 @@ int addConstant(Chunk* chunk, Value value)
     return chunk->constants.count - 1;
     }
     
+
+/*****************************************************************************\
+|* Append an empty inline cache to the chunk
+|*
+|* returns the index of the cache, which is written out as the 16-bit operand
+|* of the instruction that uses it
+\*****************************************************************************/
+int addInlineCache(Chunk* chunk)
+    {
+    if (chunk->cacheCapacity < chunk->cacheCount + 1)
+        {
+        int oldCapacity         = chunk->cacheCapacity;
+        chunk->cacheCapacity    = GROW_CAPACITY(oldCapacity);
+        chunk->caches           = GROW_ARRAY(InlineCache,
+                                             chunk->caches,
+                                             oldCapacity,
+                                             chunk->cacheCapacity);
+        }
+    
+    memset(&chunk->caches[chunk->cacheCount], 0, sizeof(InlineCache));
+    return chunk->cacheCount++;
+    }
+
+/*****************************************************************************\
+|* Return the length in bytes of the instruction at 'offset', including its
+|* operands. A superinstruction's length covers the whole fused sequence
+\*****************************************************************************/
+int instructionLength(Chunk* chunk, int offset)
+    {
+    switch (chunk->code[offset])
+        {
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_CALL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+            return 2;
+            
+        case OP_CONSTANT_LONG:
+        case OP_GET_LOCAL_LONG:
+        case OP_SET_LOCAL_LONG:
+        case OP_GET_UPVALUE_LONG:
+        case OP_SET_UPVALUE_LONG:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_DEFINE_GLOBAL:
+        case OP_JUMP:
+        case OP_JUMP_IF_FALSE:
+        case OP_LOOP:
+        case OP_CLASS:
+        case OP_GET_SUPER:
+        case OP_METHOD:
+            return 3;
+            
+        case OP_SUPER_INVOKE:
+            return 4;
+            
+        case OP_GET_PROPERTY:
+        case OP_SET_PROPERTY:
+            return 5;
+            
+        case OP_INVOKE:
+            return 6;
+            
+        case OP_CLOSURE:
+            {
+            // Each upvalue is an 'is local' byte and a 16-bit index
+            int constant        = (chunk->code[offset + 1] << 8)
+                                | chunk->code[offset + 2];
+            ObjFunction* fn     = AS_FUNCTION(chunk->constants.values[constant]);
+            return 3 + 3 * fn->upvalueCount;
+            }
+            
+        case OP_INC_LOCAL:
+            return 8;
+            
+        case OP_INC_GLOBAL:
+            return 10;
+            
+        case OP_ADD_LOCAL_CONST:
+        case OP_LESS_JUMP:
+        case OP_GREATER_JUMP:
+            return 5;
+            
+        default:
+            return 1;
+        }
+    }
@@ -5,6 +5,7 @@
 //  Created by ThrudTheBarbarian on 09/12/2025.
 //
 
+#include <errno.h>
 #include <stdio.h>
 
 #include "common.h"
@@ -12,6 +13,8 @@
 #include "scanner.h"
 #include "object.h"
 #include "memory.h"
+#include "peephole.h"
+#include "vm.h"
 
 #ifdef DEBUG_PRINT_CODE
 #  include "debug.h"
@@ -34,7 +37,7 @@ typedef struct
 
 typedef struct
     {
-    uint8_t index;              // Local slot in parent that we are capturing
+    uint16_t index;             // Local slot in parent that we are capturing
     bool isLocal;               // Is this local to current context
     } Upvalue;
 
@@ -46,16 +49,28 @@ typedef enum
     TYPE_INITIALIZER
     } FunctionType;
 
+typedef struct
+    {
+    int code;                   // Bytes of code emitted
+    int constants;              // Constants in the chunk
+    int caches;                 // Inline caches in the chunk
+    } CodeMark;
+
 typedef struct Compiler
     {
     struct Compiler* enclosing;     // Parent compiler, or NULL
     ObjFunction* function;          // Current function being compiled
     FunctionType type;              // Type of current function
     
-    Local locals[UINT8_COUNT];      // List of local variable indices
+    Local* locals;                  // List of local variable indices
     int localCount;                 // Number of local variables at this scope
-    Upvalue upvalues[UINT8_COUNT];  // Captured-scope values
+    int localCapacity;              // Number of locals allocated
+    Upvalue* upvalues;              // Captured-scope values
+    int upvalueCapacity;            // Number of upvalues allocated
     int scopeDepth;                 // Scope identifier
+
+    CodeMark operandStart;          // Where an infix's left operand starts
+    int lastJumpTarget;             // Latest offset a forward jump lands on
     } Compiler;
     
     
@@ -73,9 +88,13 @@ typedef enum
     PREC_AND,                   // and
     PREC_EQUALITY,              // == !=
     PREC_COMPARISON,            // < > <= >=
+    PREC_BIT_OR,                // |
+    PREC_BIT_XOR,               // ^
+    PREC_BIT_AND,               // &
+    PREC_SHIFT,                 // << >>
     PREC_TERM,                  // + -
     PREC_FACTOR,                // * /
-    PREC_UNARY,                 // ! -
+    PREC_UNARY,                 // ! - ~
     PREC_CALL,                  // . ()
     PREC_PRIMARY
     } Precedence;
@@ -109,7 +128,8 @@ static void variable(bool canAssign);
 static void namedVariable(Token name, bool canAssign);
 static ParseRule* getRule(TokenType type);
 static void parsePrecedence(Precedence precedence);
-static uint8_t identifierConstant(Token* name);
+static int identifierConstant(Token* name);
+static int identifierGlobal(Token* name);
 static bool match(TokenType type);
 static bool identifiersEqual(Token* a, Token* b);
 static void and_(bool canAssign);
@@ -121,6 +141,7 @@ static void endScope(void);
 static void block(void);
 static bool check(TokenType type);
 static void dot(bool canAssign);
+static void subscript(bool canAssign);
 static void this_(bool canAssign);
 static void super_(bool canAssign);
 
@@ -131,6 +152,8 @@ ParseRule rules[] = {
   [TOKEN_RIGHT_PAREN]   = {NULL,     NULL,   PREC_NONE},
   [TOKEN_LEFT_BRACE]    = {NULL,     NULL,   PREC_NONE}, 
   [TOKEN_RIGHT_BRACE]   = {NULL,     NULL,   PREC_NONE},
+  [TOKEN_LEFT_BRACKET]  = {NULL,     subscript, PREC_CALL},
+  [TOKEN_RIGHT_BRACKET] = {NULL,     NULL,   PREC_NONE},
   [TOKEN_COMMA]         = {NULL,     NULL,   PREC_NONE},
   [TOKEN_DOT]           = {NULL,     dot,    PREC_CALL},
   [TOKEN_MINUS]         = {unary,    binary, PREC_TERM},
@@ -138,14 +161,20 @@ ParseRule rules[] = {
   [TOKEN_SEMICOLON]     = {NULL,     NULL,   PREC_NONE},
   [TOKEN_SLASH]         = {NULL,     binary, PREC_FACTOR},
   [TOKEN_STAR]          = {NULL,     binary, PREC_FACTOR},
+  [TOKEN_AMPERSAND]     = {NULL,     binary, PREC_BIT_AND},
+  [TOKEN_PIPE]          = {NULL,     binary, PREC_BIT_OR},
+  [TOKEN_CARET]         = {NULL,     binary, PREC_BIT_XOR},
+  [TOKEN_TILDE]         = {unary,    NULL,   PREC_NONE},
   [TOKEN_BANG]          = {unary,    NULL,   PREC_NONE},
   [TOKEN_BANG_EQUAL]    = {NULL,     binary, PREC_EQUALITY},
   [TOKEN_EQUAL]         = {NULL,     NULL,   PREC_NONE},
   [TOKEN_EQUAL_EQUAL]   = {NULL,     binary, PREC_EQUALITY},
   [TOKEN_GREATER]       = {NULL,     binary, PREC_COMPARISON},
   [TOKEN_GREATER_EQUAL] = {NULL,     binary, PREC_COMPARISON},
+  [TOKEN_GREATER_GREATER] = {NULL,   binary, PREC_SHIFT},
   [TOKEN_LESS]          = {NULL,     binary, PREC_COMPARISON},
   [TOKEN_LESS_EQUAL]    = {NULL,     binary, PREC_COMPARISON},
+  [TOKEN_LESS_LESS]     = {NULL,     binary, PREC_SHIFT},
   [TOKEN_IDENTIFIER]    = {variable, NULL,   PREC_NONE},
   [TOKEN_STRING]        = {string,   NULL,   PREC_NONE},
   [TOKEN_NUMBER]        = {number,   NULL,   PREC_NONE},
@@ -264,6 +293,14 @@ static void emitBytes(uint8_t byte1, uint8_t byte2)
     emitByte(byte2);
     }
 
+/*****************************************************************************\
+|* Helper function - emit a 16-bit operand, high byte first
+\*****************************************************************************/
+static void emitShort(int operand)
+    {
+    emitBytes((operand >> 8) & 0xff, operand & 0xff);
+    }
+
 /*****************************************************************************\
 |* Helper function - emit a 'return' operation
 \*****************************************************************************/
@@ -279,16 +316,30 @@ static void emitReturn(void)
 /*****************************************************************************\
 |* Helper function - add a constant to the list, and return the index
 \*****************************************************************************/
-static uint8_t makeConstant(Value value)
+static int makeConstant(Value value)
     {
     int constant = addConstant(currentChunk(), value);
-    if (constant > UINT8_MAX)
+    writeBarrier((Obj*)current->function, value);
+    if (constant > UINT16_MAX)
         {
         error("Too many constants in one chunk.");
         return 0;
         }
 
-    return (uint8_t)constant;
+    return constant;
+    }
+
+/*****************************************************************************\
+|* Helper function - give the instruction just emitted its own inline cache,
+|* by appending the cache index as a 16-bit operand
+\*****************************************************************************/
+static void emitInlineCache(void)
+    {
+    int cache = addInlineCache(currentChunk());
+    if (cache > UINT16_MAX)
+        error("Too many property accesses in one chunk.");
+
+    emitShort(cache);
     }
 
 /*****************************************************************************\
@@ -296,7 +347,134 @@ static uint8_t makeConstant(Value value)
 \*****************************************************************************/
 static void emitConstant(Value value)
     {
-    emitBytes(OP_CONSTANT, makeConstant(value));
+    int constant = makeConstant(value);
+    if (constant > UINT8_MAX)
+        {
+        emitByte(OP_CONSTANT_LONG);
+        emitShort(constant);
+        }
+    else
+        emitBytes(OP_CONSTANT, (uint8_t)constant);
+    }
+
+/*****************************************************************************\
+|* Helper function - note how much code and data has been emitted so far, so
+|* that anything emitted after it can be thrown away again
+\*****************************************************************************/
+static CodeMark markCode(void)
+    {
+    CodeMark mark;
+    mark.code       = currentChunk()->count;
+    mark.constants  = currentChunk()->constants.count;
+    mark.caches     = currentChunk()->cacheCount;
+    return mark;
+    }
+
+/*****************************************************************************\
+|* Helper function - throw away everything emitted since the mark. Nothing
+|* before the mark refers to it, so the constants and caches can go too
+\*****************************************************************************/
+static void discardCode(CodeMark mark)
+    {
+    Chunk* chunk            = currentChunk();
+    truncateChunk(chunk, mark.code);
+    chunk->constants.count  = mark.constants;
+    chunk->cacheCount       = mark.caches;
+
+    if (current->lastJumpTarget > mark.code)
+        current->lastJumpTarget = mark.code;
+    }
+
+/*****************************************************************************\
+|* Helper function - if the code from 'start' up to 'end' is a single
+|* instruction that pushes a constant, return the constant in 'value'. A jump
+|* landing inside the range means it isn't one value after all
+\*****************************************************************************/
+static bool constantBetween(int start, int end, Value* value)
+    {
+    Chunk* chunk = currentChunk();
+    if ((start >= end) || (current->lastJumpTarget > start))
+        return false;
+
+    switch (chunk->code[start])
+        {
+        case OP_CONSTANT:
+            if (end - start != 2)
+                return false;
+            *value = chunk->constants.values[chunk->code[start + 1]];
+            return true;
+
+        case OP_CONSTANT_LONG:
+            if (end - start != 3)
+                return false;
+            *value = chunk->constants.values[(chunk->code[start + 1] << 8)
+                                             | chunk->code[start + 2]];
+            return true;
+
+        case OP_NIL:
+            *value = NIL_VAL;
+            break;
+
+        case OP_TRUE:
+            *value = BOOL_VAL(true);
+            break;
+
+        case OP_FALSE:
+            *value = BOOL_VAL(false);
+            break;
+
+        default:
+            return false;
+        }
+    return end - start == 1;
+    }
+
+/*****************************************************************************\
+|* Helper function - is the code emitted since the mark a constant
+\*****************************************************************************/
+static bool constantSince(CodeMark mark, Value* value)
+    {
+    return constantBetween(mark.code, currentChunk()->count, value);
+    }
+
+/*****************************************************************************\
+|* Helper function - replace everything emitted since the mark with a folded
+|* constant. A string result must be protected from the GC by the caller, as
+|* it may no longer be in the constant table
+\*****************************************************************************/
+static void emitFolded(CodeMark mark, Value value)
+    {
+    discardCode(mark);
+
+    if (IS_NIL(value))
+        emitByte(OP_NIL);
+    else if (IS_BOOL(value))
+        emitByte(AS_BOOL(value) ? OP_TRUE : OP_FALSE);
+    else
+        emitConstant(value);
+    }
+
+/*****************************************************************************\
+|* Helper function - claim the next local slot, growing the list if need be
+\*****************************************************************************/
+static Local* newLocal(void)
+    {
+    if (current->localCapacity < current->localCount + 1)
+        {
+        int oldCapacity         = current->localCapacity;
+        current->localCapacity  = GROW_CAPACITY(oldCapacity);
+        current->locals         = GROW_ARRAY(Local,
+                                             current->locals,
+                                             oldCapacity,
+                                             current->localCapacity);
+        }
+
+    // The VM checks there's room on the stack for this many when called
+    ObjFunction* function = current->function;
+    if (function->maxSlots < current->localCount + 1)
+        function->maxSlots = current->localCount + 1;
+
+    return &current->locals[current->localCount++];
     }
 
 /*****************************************************************************\
@@ -308,8 +486,13 @@ static void initCompiler(Compiler* compiler, FunctionType type)
     compiler->type          = type;
     compiler->enclosing     = current;
     
+    compiler->locals        = NULL;
     compiler->localCount    = 0;
+    compiler->localCapacity = 0;
+    compiler->upvalues      = NULL;
+    compiler->upvalueCapacity = 0;
     compiler->scopeDepth    = 0;
+    compiler->lastJumpTarget = 0;
     
     // Bootstrap the compiler's current function
     compiler->function      = newFunction();
@@ -317,11 +500,15 @@ static void initCompiler(Compiler* compiler, FunctionType type)
     current                 = compiler;
  
     if (type != TYPE_SCRIPT)
+        {
         current->function->name = copyString(parser.previous.start,
                                              parser.previous.length);
+        writeBarrier((Obj*)current->function,
+                     OBJ_VAL(current->function->name));
+        }
 
     // Claim first slot in locals for compiler's own use
-    Local* local            = &current->locals[current->localCount++];
+    Local* local            = newLocal();
     local->depth            = 0;
     local->isCaptured       = false;
     
@@ -346,14 +533,26 @@ static ObjFunction * endCompiler(void)
     emitReturn();
     
     ObjFunction* function = current->function;
+    if (!parser.hadError)
+        {
+        // Translate before fusing, so the translator sees plain stack code
+        if (vm.registerMode)
+            function->registers = translateToRegisters(currentChunk(),
+                                                       function->arity);
+        fuseSuperinstructions(currentChunk());
+        }
     
     #ifdef DEBUG_PRINT_CODE
         if (!parser.hadError)
-            disassembleChunk(currentChunk(),
-                             function->name != NULL ? function->name->chars
-                                                    : "<script>");
+            {
+            const char* name = function->name != NULL ? function->name->chars
+                                                      : "<script>";
+            disassembleChunk(currentChunk(), name);
+            disassembleRegisters(function, name);
+            }
     #endif
     
+    FREE_ARRAY(Local, current->locals, current->localCapacity);
     current = current->enclosing;
     return function;
     }
@@ -368,13 +567,44 @@ static void string(bool canAssign)
     }
 
 /*****************************************************************************\
-|* Helper function - emit numbers
+|* Helper function - emit numbers. A literal without a decimal point is an
+|* integer, unless it's too big for one
 \*****************************************************************************/
 static void number(bool canAssign)
     {
-    VALUE_TYPE val;
-    sscanf(parser.previous.start, VALUE_FORMAT_STRING, &val);
-    emitConstant(NUMBER_VAL(val));
+    // The source may not be NUL-terminated, so the digits are copied out to
+    // give sscanf() something that is
+    char digits[64];
+    int length  = parser.previous.length;
+    char* text  = (length < (int)sizeof(digits)) ? digits
+                                                 : (char*)malloc(length + 1);
+    if (text == NULL)
+        {
+        error("Not enough memory for number.");
+        return;
+        }
+    memcpy(text, parser.previous.start, length);
+    text[length] = '\0';
+    
+    Value value;
+    errno = 0;
+    long long integer = strtoll(text, NULL, 10);
+    if ((memchr(text, '.', length) == NULL) && (errno != ERANGE))
+        value = INT_VAL((int64_t)integer);
+    else
+        {
+        VALUE_TYPE val;
+        sscanf(text, VALUE_FORMAT_STRING, &val);
+        value = NUMBER_VAL(val);
+        }
+    
+    if (text != digits)
+        free(text);
+    
+    // Protect against GC, a wide integer is boxed
+    push(value);
+    emitConstant(value);
+    pop();
     }
 
 /*****************************************************************************\
@@ -431,7 +661,7 @@ static int resolveLocal(Compiler* compiler, Token* name)
 /*****************************************************************************\
 |* Helper function - register captured variable in our scope
 \*****************************************************************************/
-static int addUpvalue(Compiler* compiler, uint8_t index, bool isLocal)
+static int addUpvalue(Compiler* compiler, uint16_t index, bool isLocal)
     {
     int upvalueCount = compiler->function->upvalueCount;
     
@@ -442,12 +672,22 @@ static int addUpvalue(Compiler* compiler, uint8_t index, bool isLocal)
             return i;
         }
         
-    if (upvalueCount == UINT8_COUNT)
+    if (upvalueCount == UINT16_COUNT)
         {
         error("Too many closure variables in function.");
         return 0;
         }
 
+    if (compiler->upvalueCapacity < upvalueCount + 1)
+        {
+        int oldCapacity             = compiler->upvalueCapacity;
+        compiler->upvalueCapacity   = GROW_CAPACITY(oldCapacity);
+        compiler->upvalues          = GROW_ARRAY(Upvalue,
+                                                 compiler->upvalues,
+                                                 oldCapacity,
+                                                 compiler->upvalueCapacity);
+        }
+
     compiler->upvalues[upvalueCount].isLocal = isLocal;
     compiler->upvalues[upvalueCount].index = index;
     return compiler->function->upvalueCount++;
@@ -466,17 +706,51 @@ static int resolveUpvalue(Compiler* compiler, Token* name)
     if (local != -1)
         {
         compiler->enclosing->locals[local].isCaptured = true;
-        return addUpvalue(compiler, (uint8_t)local, true);
+        return addUpvalue(compiler, (uint16_t)local, true);
         }
         
     // Look for a match beyond the enclosing function
     int upvalue = resolveUpvalue(compiler->enclosing, name);
     if (upvalue != -1)
-        return addUpvalue(compiler, (uint8_t)upvalue, false);
+        return addUpvalue(compiler, (uint16_t)upvalue, false);
 
     return -1;
     }
 
+/*****************************************************************************\
+|* Helper function - emit a variable access. Globals take a 16-bit slot, and
+|* locals and upvalues past the first 256 the wide form
+\*****************************************************************************/
+static void emitVariableOp(uint8_t op, int arg)
+    {
+    if (arg > UINT8_MAX)
+        switch (op)
+            {
+            case OP_GET_LOCAL:      op = OP_GET_LOCAL_LONG;     break;
+            case OP_SET_LOCAL:      op = OP_SET_LOCAL_LONG;     break;
+            case OP_GET_UPVALUE:    op = OP_GET_UPVALUE_LONG;   break;
+            case OP_SET_UPVALUE:    op = OP_SET_UPVALUE_LONG;   break;
+            default:                                            break;
+            }
+
+    switch (op)
+        {
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_LOCAL_LONG:
+        case OP_SET_LOCAL_LONG:
+        case OP_GET_UPVALUE_LONG:
+        case OP_SET_UPVALUE_LONG:
+            emitByte(op);
+            emitShort(arg);
+            break;
+
+        default:
+            emitBytes(op, (uint8_t)arg);
+            break;
+        }
+    }
+
 /*****************************************************************************\
 |* Helper function - allow named variable access
 \*****************************************************************************/
@@ -498,7 +772,7 @@ static void namedVariable(Token name, bool canAssign)
         }
     else
         {
-        arg = identifierConstant(&name);
+        arg = identifierGlobal(&name);
         getOp = OP_GET_GLOBAL;
         setOp = OP_SET_GLOBAL;
         }
@@ -507,10 +781,10 @@ static void namedVariable(Token name, bool canAssign)
     if (canAssign && match(TOKEN_EQUAL))
         {
         expression();
-        emitBytes(setOp, arg);
+        emitVariableOp(setOp, arg);
         }
     else
-        emitBytes(getOp, arg);
+        emitVariableOp(getOp, arg);
     }
 
 /*****************************************************************************\
@@ -550,6 +824,25 @@ static void call(bool canAssign)
 \*****************************************************************************/
 static void and_(bool canAssign)
     {
+    // With a constant on the left, only one side can ever be the result
+    CodeMark left = current->operandStart;
+    Value value;
+    if (constantSince(left, &value))
+        {
+        if (isFalsey(value))
+            {
+            CodeMark right = markCode();
+            parsePrecedence(PREC_AND);
+            discardCode(right);
+            }
+        else
+            {
+            discardCode(left);
+            parsePrecedence(PREC_AND);
+            }
+        return;
+        }
+
     int endJump = emitJump(OP_JUMP_IF_FALSE);
 
     emitByte(OP_POP);
@@ -563,6 +856,25 @@ static void and_(bool canAssign)
 \*****************************************************************************/
 static void or_(bool canAssign)
     {
+    // With a constant on the left, only one side can ever be the result
+    CodeMark left = current->operandStart;
+    Value value;
+    if (constantSince(left, &value))
+        {
+        if (isFalsey(value))
+            {
+            discardCode(left);
+            parsePrecedence(PREC_OR);
+            }
+        else
+            {
+            CodeMark right = markCode();
+            parsePrecedence(PREC_OR);
+            discardCode(right);
+            }
+        return;
+        }
+
     int elseJump    = emitJump(OP_JUMP_IF_FALSE);
     int endJump     = emitJump(OP_JUMP);
 
@@ -590,13 +902,17 @@ static void parsePrecedence(Precedence precedence)
         return;
         }
 
-    bool canAssign = precedence <= PREC_ASSIGNMENT;
+    bool canAssign  = precedence <= PREC_ASSIGNMENT;
+    CodeMark start  = markCode();
     prefixRule(canAssign);
 
     while (precedence <= getRule(parser.current.type)->precedence)
         {
         advance();
         ParseFn infixRule = getRule(parser.previous.type)->infix;
+        
+        // Let the infix see where its left operand starts, for folding
+        current->operandStart = start;
         infixRule(canAssign);
         }
         
@@ -608,11 +924,27 @@ static void parsePrecedence(Precedence precedence)
 /*****************************************************************************\
 |* Helper function - insert the token's lexeme to constant table as string
 \*****************************************************************************/
-static uint8_t identifierConstant(Token* name)
+static int identifierConstant(Token* name)
     {
     return makeConstant(OBJ_VAL(copyString(name->start, name->length)));
     }
 
+/*****************************************************************************\
+|* Helper function - resolve a global variable name to its slot in the VM.
+|* The slot is allocated the first time the name is seen, even if that is
+|* before the variable is defined, so forward references bind late
+\*****************************************************************************/
+static int identifierGlobal(Token* name)
+    {
+    int slot = globalSlot(copyString(name->start, name->length));
+    if (slot > UINT16_MAX)
+        {
+        error("Too many global variables.");
+        return 0;
+        }
+    return slot;
+    }
+
 /*****************************************************************************\
 |* Helper function - expression parsing. Join the parser and the emitter...
 \*****************************************************************************/
@@ -636,13 +968,43 @@ static void grouping(bool canAssign)
 \*****************************************************************************/
 static void unary(bool canAssign)
     {
-    TokenType operatorType = parser.previous.type;
+    TokenType operatorType  = parser.previous.type;
+    CodeMark operand        = markCode();
 
     // Compile the operand. Because we use PREC_UNARY we stop parsing the
     // expression as soon as something of lower precedence appears. This
     // means -a.b + c will stop at -a.b because PREC_UNARY (-) > PREC_TERM (+)
     parsePrecedence(PREC_UNARY);
 
+    // Fold a constant operand, leaving type errors for the VM to report
+    Value value;
+    if (constantSince(operand, &value))
+        {
+        if (operatorType == TOKEN_BANG)
+            {
+            emitFolded(operand, BOOL_VAL(isFalsey(value)));
+            return;
+            }
+        Value negated;
+        if ((operatorType == TOKEN_MINUS) && negateNumeric(value, &negated))
+            {
+            // Protect against GC, a wide integer is boxed
+            push(negated);
+            emitFolded(operand, negated);
+            pop();
+            return;
+            }
+        Value complement;
+        if ((operatorType == TOKEN_TILDE) && complementInt(value, &complement))
+            {
+            // Protect against GC, a wide integer is boxed
+            push(complement);
+            emitFolded(operand, complement);
+            pop();
+            return;
+            }
+        }
+
     // Emit the operator instruction.
     switch (operatorType)
         {
@@ -654,6 +1016,10 @@ static void unary(bool canAssign)
             emitByte(OP_NEGATE);
             break;
             
+        case TOKEN_TILDE:
+            emitByte(OP_BIT_NOT);
+            break;
+            
         default:
             return; // Unreachable.
         }
@@ -665,22 +1031,65 @@ static void unary(bool canAssign)
 static void dot(bool canAssign)
     {
     consume(TOKEN_IDENTIFIER, "Expect property name after '.'.");
-    uint8_t name = identifierConstant(&parser.previous);
+    int name = identifierConstant(&parser.previous);
 
     if (canAssign && match(TOKEN_EQUAL))
         {
         expression();
-        emitBytes(OP_SET_PROPERTY, name);
+        emitByte(OP_SET_PROPERTY);
+        emitShort(name);
+        emitInlineCache();
         }
     else if (match(TOKEN_LEFT_PAREN))
         {
         uint8_t argCount = argumentList();
-        emitBytes(OP_INVOKE, name);
+        emitByte(OP_INVOKE);
+        emitShort(name);
         emitByte(argCount);
+        emitInlineCache();
         }
     else
-        emitBytes(OP_GET_PROPERTY, name);
-      }
+        {
+        emitByte(OP_GET_PROPERTY);
+        emitShort(name);
+        emitInlineCache();
+        }
+    }
+
+/*****************************************************************************\
+|* Helper function - subscripts. 'mem[address]' is a cell of a memory. For a
+|* signal, 'bus[]' is the whole bus, 'bus[n]' is bit n, and 'bus[high:low]'
+|* is the bits from 'low' up to 'high' inclusive. Which of a memory or a
+|* signal 'x[n]' is can only be known at runtime, so both use one opcode
+\*****************************************************************************/
+static void subscript(bool canAssign)
+    {
+    OpCode get  = OP_GET_BUS;
+    OpCode set  = OP_SET_BUS;
+
+    if (!check(TOKEN_RIGHT_BRACKET))
+        {
+        expression();
+        get     = OP_MEM_LOAD;
+        set     = OP_MEM_STORE;
+
+        if (match(TOKEN_COLON))
+            {
+            expression();
+            get = OP_GET_SLICE;
+            set = OP_SET_SLICE;
+            }
+        }
+    consume(TOKEN_RIGHT_BRACKET, "Expect ']' after subscript.");
+
+    if (canAssign && match(TOKEN_EQUAL))
+        {
+        expression();
+        emitByte(set);
+        }
+    else
+        emitByte(get);
+    }
 
 /*****************************************************************************\
 |* Helper function - Return the rule for a given operator type
@@ -727,32 +1136,159 @@ static void super_(bool canAssign)
 
     consume(TOKEN_DOT, "Expect '.' after 'super'.");
     consume(TOKEN_IDENTIFIER, "Expect superclass method name.");
-    uint8_t name = identifierConstant(&parser.previous);
+    int name = identifierConstant(&parser.previous);
 
     namedVariable(syntheticToken("this"), false);
     if (match(TOKEN_LEFT_PAREN))
         {
         uint8_t argCount = argumentList();
         namedVariable(syntheticToken("super"), false);
-        emitBytes(OP_SUPER_INVOKE, name);
+        emitByte(OP_SUPER_INVOKE);
+        emitShort(name);
         emitByte(argCount);
         }
     else
         {
         namedVariable(syntheticToken("super"), false);
-        emitBytes(OP_GET_SUPER, name);
+        emitByte(OP_GET_SUPER);
+        emitShort(name);
         }
     }
 
+/*****************************************************************************\
+|* Helper function - evaluate a binary operator on two constant operands at
+|* compile time, the same way the VM would. Returns false if either operand
+|* isn't constant, or if the VM would raise an error instead
+\*****************************************************************************/
+static bool foldBinary(TokenType operatorType, CodeMark left, int rightStart)
+    {
+    Value a, b;
+    if (!constantBetween(left.code, rightStart, &a)
+    ||  !constantBetween(rightStart, currentChunk()->count, &b))
+        return false;
+
+    if (operatorType == TOKEN_EQUAL_EQUAL)
+        {
+        emitFolded(left, BOOL_VAL(valuesEqual(a, b)));
+        return true;
+        }
+    if (operatorType == TOKEN_BANG_EQUAL)
+        {
+        emitFolded(left, BOOL_VAL(!valuesEqual(a, b)));
+        return true;
+        }
+
+    if ((operatorType == TOKEN_PLUS) && IS_STRING(a) && IS_STRING(b))
+        {
+        ObjString* x        = AS_STRING(a);
+        ObjString* y        = AS_STRING(b);
+        ObjString* result   = newString(x->length + y->length);
+        memcpy(result->chars, x->chars, x->length);
+        memcpy(result->chars + x->length, y->chars, y->length);
+        result              = internString(result);
+
+        // Protect against GC
+        push(OBJ_VAL(result));
+        emitFolded(left, OBJ_VAL(result));
+        pop();
+        return true;
+        }
+
+    // >= and <= are compiled as the opposite comparison, then OP_NOT
+    ArithOp op;
+    bool negate = false;
+    switch (operatorType)
+        {
+        case TOKEN_GREATER:
+            op = ARITH_GREATER;
+            break;
+
+        case TOKEN_GREATER_EQUAL:
+            op      = ARITH_LESS;
+            negate  = true;
+            break;
+
+        case TOKEN_LESS:
+            op = ARITH_LESS;
+            break;
+
+        case TOKEN_LESS_EQUAL:
+            op      = ARITH_GREATER;
+            negate  = true;
+            break;
+
+        case TOKEN_PLUS:
+            op = ARITH_ADD;
+            break;
+
+        case TOKEN_MINUS:
+            op = ARITH_SUBTRACT;
+            break;
+
+        case TOKEN_STAR:
+            op = ARITH_MULTIPLY;
+            break;
+
+        case TOKEN_SLASH:
+            #ifdef INTEGER_ONLY
+                // Leave the trap for run-time
+                if (IS_NUMERIC(b) && (AS_NUMERIC(b) == 0))
+                    return false;
+            #endif
+            op = ARITH_DIVIDE;
+            break;
+
+        case TOKEN_AMPERSAND:
+            op = ARITH_BIT_AND;
+            break;
+
+        case TOKEN_PIPE:
+            op = ARITH_BIT_OR;
+            break;
+
+        case TOKEN_CARET:
+            op = ARITH_BIT_XOR;
+            break;
+
+        case TOKEN_LESS_LESS:
+            op = ARITH_SHIFT_LEFT;
+            break;
+
+        case TOKEN_GREATER_GREATER:
+            op = ARITH_SHIFT_RIGHT;
+            break;
+
+        default:
+            return false;
+        }
+
+    Value result;
+    if (!arithmetic(op, a, b, &result))
+        return false;
+    if (negate)
+        result = BOOL_VAL(!AS_BOOL(result));
+
+    // Protect against GC, a wide integer is boxed
+    push(result);
+    emitFolded(left, result);
+    pop();
+    return true;
+    }
+
 /*****************************************************************************\
 |* Helper function - handle infix arithmetic (eg: 2 + 3)
 \*****************************************************************************/
 static void binary(bool canAssign)
     {
+    CodeMark left           = current->operandStart;
     TokenType operatorType  = parser.previous.type;
     ParseRule* rule         = getRule(operatorType);
+    int rightStart          = currentChunk()->count;
     parsePrecedence((Precedence)(rule->precedence + 1));
 
+    if (foldBinary(operatorType, left, rightStart))
+        return;
+
     switch (operatorType)
         {
         case TOKEN_BANG_EQUAL:
@@ -795,6 +1331,26 @@ static void binary(bool canAssign)
             emitByte(OP_DIVIDE);
             break;
     
+        case TOKEN_AMPERSAND:
+            emitByte(OP_BIT_AND);
+            break;
+    
+        case TOKEN_PIPE:
+            emitByte(OP_BIT_OR);
+            break;
+    
+        case TOKEN_CARET:
+            emitByte(OP_BIT_XOR);
+            break;
+    
+        case TOKEN_LESS_LESS:
+            emitByte(OP_SHIFT_LEFT);
+            break;
+    
+        case TOKEN_GREATER_GREATER:
+            emitByte(OP_SHIFT_RIGHT);
+            break;
+    
         default:
             return; // Unreachable.
         }
@@ -823,9 +1379,9 @@ static bool match(TokenType type)
 /*****************************************************************************\
 |* Called to compile the code, public interface
 \*****************************************************************************/
-ObjFunction * compile(const char* source)
+ObjFunction * compile(const char* source, size_t length)
     {
-    initScanner(source);
+    initScanner(source, length);
  
     // Manage scope-depthed local variables
     Compiler compiler;
@@ -883,13 +1439,13 @@ static void synchronize(void)
 \*****************************************************************************/
 static void addLocal(Token name)
     {
-    if (current->localCount == UINT8_COUNT)
+    if (current->localCount == UINT16_COUNT)
         {
         error("Too many local variables in function.");
         return;
         }
 
-    Local* local        = &current->locals[current->localCount++];
+    Local* local        = newLocal();
     local->name         = name;
     local->isCaptured   = false;
     
@@ -935,7 +1491,7 @@ static void declareVariable(void)
 /*****************************************************************************\
 |* Helper function - parse a variable out. Requires next token to be identifier
 \*****************************************************************************/
-static uint8_t parseVariable(const char* errorMessage)
+static int parseVariable(const char* errorMessage)
     {
     consume(TOKEN_IDENTIFIER, errorMessage);
 
@@ -943,7 +1499,7 @@ static uint8_t parseVariable(const char* errorMessage)
     if (current->scopeDepth > 0)
         return 0;
 
-    return identifierConstant(&parser.previous);
+    return identifierGlobal(&parser.previous);
     }
 
 /*****************************************************************************\
@@ -961,7 +1517,7 @@ static void markInitialized(void)
 /*****************************************************************************\
 |* Helper function - define a global variable
 \*****************************************************************************/
-static void defineVariable(uint8_t global)
+static void defineVariable(int global)
     {
     if (current->scopeDepth > 0)
         {
@@ -969,7 +1525,8 @@ static void defineVariable(uint8_t global)
         return;
         }
         
-    emitBytes(OP_DEFINE_GLOBAL, global);
+    emitByte(OP_DEFINE_GLOBAL);
+    emitShort(global);
     }
 
 /*****************************************************************************\
@@ -977,7 +1534,7 @@ static void defineVariable(uint8_t global)
 \*****************************************************************************/
 static void varDeclaration(void)
     {
-    uint8_t global = parseVariable("Expect variable name.");
+    int global = parseVariable("Expect variable name.");
 
     if (match(TOKEN_EQUAL))
         expression();
@@ -1008,7 +1565,7 @@ static void function(FunctionType type)
             if (current->function->arity > 255)
                 errorAtCurrent("Can't have more than 255 parameters.");
                 
-            uint8_t constant = parseVariable("Expect parameter name.");
+            int constant = parseVariable("Expect parameter name.");
             defineVariable(constant);
             }
         while (match(TOKEN_COMMA));
@@ -1019,14 +1576,18 @@ static void function(FunctionType type)
     block();
 
     ObjFunction* function = endCompiler();
-    emitBytes(OP_CLOSURE, makeConstant(OBJ_VAL(function)));
+    // Make the function a constant first, as it's only reachable from there
+    int constant = makeConstant(OBJ_VAL(function));
+    emitByte(OP_CLOSURE);
+    emitShort(constant);
 
     // Make sure the closure variables are captured
     for (int i = 0; i < function->upvalueCount; i++)
         {
         emitByte(compiler.upvalues[i].isLocal ? 1 : 0);
-        emitByte(compiler.upvalues[i].index);
+        emitShort(compiler.upvalues[i].index);
         }
+    FREE_ARRAY(Upvalue, compiler.upvalues, compiler.upvalueCapacity);
 
     // no need for an endScope() call because we ended the compiler
     }
@@ -1036,7 +1597,7 @@ static void function(FunctionType type)
 \*****************************************************************************/
 static void funDeclaration(void)
     {
-    uint8_t global = parseVariable("Expect function name.");
+    int global = parseVariable("Expect function name.");
     markInitialized();
     function(TYPE_FUNCTION);
     defineVariable(global);
@@ -1048,7 +1609,7 @@ static void funDeclaration(void)
 static void method(void)
     {
     consume(TOKEN_IDENTIFIER, "Expect method name.");
-    uint8_t constant = identifierConstant(&parser.previous);
+    int constant = identifierConstant(&parser.previous);
 
     FunctionType type   = TYPE_METHOD;
     bool lengthMatch    = (parser.previous.length == 4);
@@ -1057,7 +1618,8 @@ static void method(void)
   
     function(type);
     
-    emitBytes(OP_METHOD, constant);
+    emitByte(OP_METHOD);
+    emitShort(constant);
     }
 
 /*****************************************************************************\
@@ -1067,11 +1629,13 @@ static void classDeclaration(void)
     {
     consume(TOKEN_IDENTIFIER, "Expect class name.");
     Token className = parser.previous;
-    uint8_t nameConstant = identifierConstant(&parser.previous);
+    int nameConstant = identifierConstant(&parser.previous);
     declareVariable();
+    int global = (current->scopeDepth > 0) ? 0 : identifierGlobal(&className);
 
-    emitBytes(OP_CLASS, nameConstant);
-    defineVariable(nameConstant);
+    emitByte(OP_CLASS);
+    emitShort(nameConstant);
+    defineVariable(global);
 
     ClassCompiler classCompiler;
     classCompiler.hasSuperclass     = false;
@@ -1221,6 +1785,9 @@ static void patchJump(int offset)
 
     currentChunk()->code[offset]        = (jump >> 8) & 0xff;
     currentChunk()->code[offset + 1]    = (jump     ) & 0xff;
+
+    // Don't fold code from before here with code after it
+    current->lastJumpTarget             = currentChunk()->count;
     }
 
 /*****************************************************************************\
@@ -1229,9 +1796,33 @@ static void patchJump(int offset)
 static void ifStatement(void)
     {
     consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
+    CodeMark condition = markCode();
     expression();
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
+    // If the condition is constant, only compile the branch that's taken.
+    // The other is still parsed, to report any errors in it
+    Value value;
+    if (constantSince(condition, &value))
+        {
+        bool taken = !isFalsey(value);
+        discardCode(condition);
+
+        CodeMark branch = markCode();
+        statement();
+        if (!taken)
+            discardCode(branch);
+
+        if (match(TOKEN_ELSE))
+            {
+            branch = markCode();
+            statement();
+            if (taken)
+                discardCode(branch);
+            }
+        return;
+        }
+
     int thenJump = emitJump(OP_JUMP_IF_FALSE);
     emitByte(OP_POP);   // Tidy up the stack
     statement();
@@ -1268,9 +1859,23 @@ static void whileStatement(void)
     int loopStart = currentChunk()->count;
 
     consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
+    CodeMark condition = markCode();
     expression();
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
 
+    // A constant condition either never runs the body, or never leaves it
+    Value value;
+    if (constantSince(condition, &value))
+        {
+        discardCode(condition);
+        statement();
+        if (isFalsey(value))
+            discardCode(condition);
+        else
+            emitLoop(loopStart);
+        return;
+        }
+
     int exitJump = emitJump(OP_JUMP_IF_FALSE);
     emitByte(OP_POP);
     statement();
@@ -1319,14 +1924,26 @@ static void forStatement(void)
 
     int loopStart   = currentChunk()->count;
     int exitJump    = -1;
+    bool neverRuns  = false;
+    CodeMark condition = markCode();
     if (!match(TOKEN_SEMICOLON))
         {
         expression();
         consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
 
-        // Jump out of the loop if the condition is false.
-        exitJump = emitJump(OP_JUMP_IF_FALSE);
-        emitByte(OP_POP); // Condition.
+        // A constant condition either never runs the loop, or is left out
+        Value value;
+        if (constantSince(condition, &value))
+            {
+            neverRuns = isFalsey(value);
+            discardCode(condition);
+            }
+        else
+            {
+            // Jump out of the loop if the condition is false.
+            exitJump = emitJump(OP_JUMP_IF_FALSE);
+            emitByte(OP_POP); // Condition.
+            }
         }
         
     // increment clause
@@ -1347,6 +1964,9 @@ static void forStatement(void)
     statement();
     emitLoop(loopStart);
 
+    if (neverRuns)
+        discardCode(condition);
+
     if (exitJump != -1)
         {
         patchJump(exitJump);
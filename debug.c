@@ -9,6 +9,7 @@
 #include "debug.h"
 #include "value.h"
 #include "object.h"
+#include "vm.h"
 
 /*****************************************************************************\
 |* Top level dissassembly call, process a chunk
@@ -42,6 +43,43 @@ static int constantInstruction(const char* name, Chunk* chunk, int offset)
     return offset+2;
     }
 
+/*****************************************************************************\
+|* Helper function for instructions with a 16-bit constant index
+\*****************************************************************************/
+static int longConstantInstruction(const char* name, Chunk* chunk, int offset)
+    {
+    uint16_t constant = (uint16_t)(chunk->code[offset + 1] << 8);
+    constant         |= chunk->code[offset + 2];
+    printf("%-16s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + 3;
+    }
+
+/*****************************************************************************\
+|* Helper function for 16-bit operand instruction display
+\*****************************************************************************/
+static int shortInstruction(const char* name, Chunk* chunk, int offset)
+    {
+    uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8);
+    slot         |= chunk->code[offset + 2];
+    printf("%-16s %4d\n", name, slot);
+    return offset + 3;
+    }
+
+/*****************************************************************************\
+|* Helper function for global variable instruction display
+\*****************************************************************************/
+static int globalInstruction(const char* name, Chunk* chunk, int offset)
+    {
+    uint16_t slot = (uint16_t)(chunk->code[offset + 1] << 8);
+    slot         |= chunk->code[offset + 2];
+    printf("%-16s %4d '", name, slot);
+    printValue(vm.globalSlotNames.values[slot]);
+    printf("'\n");
+    return offset + 3;
+    }
+
 /*****************************************************************************\
 |* Helper function for byte instruction display
 \*****************************************************************************/
@@ -71,12 +109,88 @@ static int jumpInstruction(const char* name,
 \*****************************************************************************/
 static int invokeInstruction(const char* name, Chunk* chunk, int offset)
     {
-    uint8_t constant = chunk->code[offset + 1];
-    uint8_t argCount = chunk->code[offset + 2];
+    uint16_t constant = (uint16_t)(chunk->code[offset + 1] << 8);
+    constant         |= chunk->code[offset + 2];
+    uint8_t argCount  = chunk->code[offset + 3];
     printf("%-16s (%d args) %4d '", name, argCount, constant);
     printValue(chunk->constants.values[constant]);
     printf("'\n");
-    return offset + 3;
+    return offset + 4;
+    }
+
+/*****************************************************************************\
+|* Helper function for property instruction display, with its inline cache
+\*****************************************************************************/
+static int propertyInstruction(const char* name, Chunk* chunk, int offset)
+    {
+    uint16_t constant = (uint16_t)(chunk->code[offset + 1] << 8);
+    constant         |= chunk->code[offset + 2];
+    uint16_t cache    = (uint16_t)(chunk->code[offset + 3] << 8);
+    cache            |= chunk->code[offset + 4];
+    printf("%-16s %4d '", name, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' ic %d\n", cache);
+    return offset + 5;
+    }
+
+/*****************************************************************************\
+|* Helper function for cached invoke instruction display
+\*****************************************************************************/
+static int invokeCachedInstruction(const char* name, Chunk* chunk, int offset)
+    {
+    uint16_t constant = (uint16_t)(chunk->code[offset + 1] << 8);
+    constant         |= chunk->code[offset + 2];
+    uint8_t argCount  = chunk->code[offset + 3];
+    uint16_t cache    = (uint16_t)(chunk->code[offset + 4] << 8);
+    cache            |= chunk->code[offset + 5];
+    printf("%-16s (%d args) %4d '", name, argCount, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("' ic %d\n", cache);
+    return offset + 6;
+    }
+
+/*****************************************************************************\
+|* Helper function for superinstruction display, 'local op constant' where
+|* the local is at +1 and the constant index at +3
+\*****************************************************************************/
+static int localConstantInstruction(const char* name,
+                                    Chunk* chunk,
+                                    int offset)
+    {
+    uint8_t slot     = chunk->code[offset + 1];
+    uint8_t constant = chunk->code[offset + 3];
+    printf("%-16s %4d %4d '", name, slot, constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + instructionLength(chunk, offset);
+    }
+
+/*****************************************************************************\
+|* Helper function for global increment display
+\*****************************************************************************/
+static int incGlobalInstruction(const char* name, Chunk* chunk, int offset)
+    {
+    uint16_t slot    = (uint16_t)(chunk->code[offset + 1] << 8);
+    slot            |= chunk->code[offset + 2];
+    uint8_t constant = chunk->code[offset + 4];
+    printf("%-16s %4d '", name, slot);
+    printValue(vm.globalSlotNames.values[slot]);
+    printf("' %4d '", constant);
+    printValue(chunk->constants.values[constant]);
+    printf("'\n");
+    return offset + instructionLength(chunk, offset);
+    }
+
+/*****************************************************************************\
+|* Helper function for compare-and-jump display. The jump is the fused
+|* OP_JUMP_IF_FALSE at +1, and lands one past the pop at its target
+\*****************************************************************************/
+static int compareJumpInstruction(const char* name, Chunk* chunk, int offset)
+    {
+    uint16_t jump = (uint16_t)(chunk->code[offset + 2] << 8);
+    jump |= chunk->code[offset + 3];
+    printf("%-16s %4d -> %d\n", name, offset, offset + 5 + jump);
+    return offset + instructionLength(chunk, offset);
     }
 
 /*****************************************************************************\
@@ -85,10 +199,11 @@ static int invokeInstruction(const char* name, Chunk* chunk, int offset)
 int disassembleInstruction(Chunk* chunk, int offset)
     {
     printf(": 0x%04x ", offset);
-    if ((offset > 0) && (chunk->lines[offset] == chunk->lines[offset - 1]))
+    int line = getLine(chunk, offset);
+    if ((offset > 0) && (line == getLine(chunk, offset - 1)))
         printf("   | ");
     else
-        printf("%4d ", chunk->lines[offset]);
+        printf("%4d ", line);
         
     uint8_t instruction = chunk->code[offset];
     switch (instruction)
@@ -96,6 +211,9 @@ int disassembleInstruction(Chunk* chunk, int offset)
         case OP_CONSTANT:
             return constantInstruction("OP_CONSTANT", chunk, offset);
 
+        case OP_CONSTANT_LONG:
+            return longConstantInstruction("OP_CONSTANT_LONG", chunk, offset);
+
         case OP_NIL:
             return simpleInstruction("OP_NIL", offset);
     
@@ -106,13 +224,13 @@ int disassembleInstruction(Chunk* chunk, int offset)
             return simpleInstruction("OP_FALSE", offset);
 
         case OP_GET_GLOBAL:
-            return constantInstruction("OP_GET_GLOBAL", chunk, offset);
+            return globalInstruction("OP_GET_GLOBAL", chunk, offset);
 
         case OP_SET_GLOBAL:
-            return constantInstruction("OP_SET_GLOBAL", chunk, offset);
+            return globalInstruction("OP_SET_GLOBAL", chunk, offset);
 
         case OP_DEFINE_GLOBAL:
-            return constantInstruction("OP_DEFINE_GLOBAL", chunk, offset);
+            return globalInstruction("OP_DEFINE_GLOBAL", chunk, offset);
 
         case OP_EQUAL:
             return simpleInstruction("OP_EQUAL", offset);
@@ -141,6 +259,42 @@ int disassembleInstruction(Chunk* chunk, int offset)
         case OP_NEGATE:
             return simpleInstruction("OP_NEGATE", offset);
 
+        case OP_BIT_AND:
+            return simpleInstruction("OP_BIT_AND", offset);
+
+        case OP_BIT_OR:
+            return simpleInstruction("OP_BIT_OR", offset);
+
+        case OP_BIT_XOR:
+            return simpleInstruction("OP_BIT_XOR", offset);
+
+        case OP_SHIFT_LEFT:
+            return simpleInstruction("OP_SHIFT_LEFT", offset);
+
+        case OP_SHIFT_RIGHT:
+            return simpleInstruction("OP_SHIFT_RIGHT", offset);
+
+        case OP_BIT_NOT:
+            return simpleInstruction("OP_BIT_NOT", offset);
+
+        case OP_GET_BUS:
+            return simpleInstruction("OP_GET_BUS", offset);
+
+        case OP_SET_BUS:
+            return simpleInstruction("OP_SET_BUS", offset);
+
+        case OP_MEM_LOAD:
+            return simpleInstruction("OP_MEM_LOAD", offset);
+
+        case OP_MEM_STORE:
+            return simpleInstruction("OP_MEM_STORE", offset);
+
+        case OP_GET_SLICE:
+            return simpleInstruction("OP_GET_SLICE", offset);
+
+        case OP_SET_SLICE:
+            return simpleInstruction("OP_SET_SLICE", offset);
+
         case OP_JUMP:
             return jumpInstruction("OP_JUMP", 1, chunk, offset);
     
@@ -165,6 +319,12 @@ int disassembleInstruction(Chunk* chunk, int offset)
         case OP_SET_LOCAL:
             return byteInstruction("OP_SET_LOCAL", chunk, offset);
 
+        case OP_GET_LOCAL_LONG:
+            return shortInstruction("OP_GET_LOCAL_LONG", chunk, offset);
+
+        case OP_SET_LOCAL_LONG:
+            return shortInstruction("OP_SET_LOCAL_LONG", chunk, offset);
+
         case OP_CALL:
             return byteInstruction("OP_CALL", chunk, offset);
 
@@ -174,28 +334,35 @@ int disassembleInstruction(Chunk* chunk, int offset)
         case OP_SET_UPVALUE:
             return byteInstruction("OP_SET_UPVALUE", chunk, offset);
 
+        case OP_GET_UPVALUE_LONG:
+            return shortInstruction("OP_GET_UPVALUE_LONG", chunk, offset);
+
+        case OP_SET_UPVALUE_LONG:
+            return shortInstruction("OP_SET_UPVALUE_LONG", chunk, offset);
+
         case OP_CLOSE_UPVALUE:
             return simpleInstruction("OP_CLOSE_UPVALUE", offset);
 
         case OP_CLASS:
-            return constantInstruction("OP_CLASS", chunk, offset);
+            return longConstantInstruction("OP_CLASS", chunk, offset);
    
         case OP_GET_PROPERTY:
-            return constantInstruction("OP_GET_PROPERTY", chunk, offset);
+            return propertyInstruction("OP_GET_PROPERTY", chunk, offset);
     
         case OP_SET_PROPERTY:
-            return constantInstruction("OP_SET_PROPERTY", chunk, offset);
+            return propertyInstruction("OP_SET_PROPERTY", chunk, offset);
 
         case OP_INVOKE:
-            return invokeInstruction("OP_INVOKE", chunk, offset);
+            return invokeCachedInstruction("OP_INVOKE", chunk, offset);
 
         case OP_SUPER_INVOKE:
             return invokeInstruction("OP_SUPER_INVOKE", chunk, offset);
 
         case OP_CLOSURE:
             {
-            offset++;
-            uint8_t constant = chunk->code[offset++];
+            int constant = (chunk->code[offset + 1] << 8)
+                         | chunk->code[offset + 2];
+            offset      += 3;
             printf("%-16s %4d ", "OP_CLOSURE", constant);
             printValue(chunk->constants.values[constant]);
             printf("\n");
@@ -203,25 +370,198 @@ int disassembleInstruction(Chunk* chunk, int offset)
             ObjFunction* fn = AS_FUNCTION(chunk->constants.values[constant]);
             for (int j = 0; j < fn->upvalueCount; j++)
                 {
-                int isLocal = chunk->code[offset++];
-                int index   = chunk->code[offset++];
+                int isLocal = chunk->code[offset];
+                int index   = (chunk->code[offset + 1] << 8)
+                            | chunk->code[offset + 2];
                 printf(": 0x%04x    |                     %s %d\n",
-                        offset - 2, isLocal ? "local" : "upvalue", index);
+                        offset, isLocal ? "local" : "upvalue", index);
+                offset     += 3;
                 }
             return offset;
             }
             
         case OP_METHOD:
-            return constantInstruction("OP_METHOD", chunk, offset);
+            return longConstantInstruction("OP_METHOD", chunk, offset);
  
         case OP_INHERIT:
             return simpleInstruction("OP_INHERIT", offset);
 
         case OP_GET_SUPER:
-            return constantInstruction("OP_GET_SUPER", chunk, offset);
+            return longConstantInstruction("OP_GET_SUPER", chunk, offset);
+
+        case OP_INC_LOCAL:
+            return localConstantInstruction("OP_INC_LOCAL", chunk, offset);
+
+        case OP_INC_GLOBAL:
+            return incGlobalInstruction("OP_INC_GLOBAL", chunk, offset);
+
+        case OP_ADD_LOCAL_CONST:
+            return localConstantInstruction("OP_ADD_LOCAL_CONST",
+                                            chunk,
+                                            offset);
+
+        case OP_LESS_JUMP:
+            return compareJumpInstruction("OP_LESS_JUMP", chunk, offset);
+
+        case OP_GREATER_JUMP:
+            return compareJumpInstruction("OP_GREATER_JUMP", chunk, offset);
 
         default:
             printf("Unknown opcode %d\n", instruction);
             return offset + 1;
         }
     }
+
+/*****************************************************************************\
+|* Dissassemble a function's register code, if it has any
+\*****************************************************************************/
+void disassembleRegisters(ObjFunction* function, const char* name)
+    {
+    if (function->registers == NULL)
+        return;
+
+    printf("== %s (%d registers) ==\n",
+           name,
+           function->registers->registerCount);
+
+    for (int index = 0; index < function->registers->count;)
+        index = disassembleRegisterInstruction(function, index);
+    }
+
+/*****************************************************************************\
+|* Helper function for register operand display, either 'rN' or a constant
+\*****************************************************************************/
+static void printOperand(ObjFunction* function, uint16_t operand)
+    {
+    if (operand & RK_CONSTANT)
+        {
+        printf(" '");
+        printValue(function->chunk.constants.values[operand & ~RK_CONSTANT]);
+        printf("'");
+        }
+    else
+        printf(" r%d", operand);
+    }
+
+/*****************************************************************************\
+|* Dissassemble an instruction within a function's register code
+\*****************************************************************************/
+int disassembleRegisterInstruction(ObjFunction* function, int index)
+    {
+    RegisterCode* code      = function->registers;
+    RegInstruction* insn    = &code->code[index];
+
+    printf(": %6d ", index);
+    if ((index > 0) && (code->lines[index] == code->lines[index - 1]))
+        printf("   | ");
+    else
+        printf("%4d ", code->lines[index]);
+
+    switch (insn->op)
+        {
+        case R_MOVE:
+            printf("%-16s r%d", "R_MOVE", insn->a);
+            printOperand(function, insn->b);
+            break;
+
+        case R_NIL:
+            printf("%-16s r%d", "R_NIL", insn->a);
+            break;
+
+        case R_TRUE:
+            printf("%-16s r%d", "R_TRUE", insn->a);
+            break;
+
+        case R_FALSE:
+            printf("%-16s r%d", "R_FALSE", insn->a);
+            break;
+
+        case R_GET_GLOBAL:
+            printf("%-16s r%d '", "R_GET_GLOBAL", insn->a);
+            printValue(vm.globalSlotNames.values[insn->b]);
+            printf("'");
+            break;
+
+        case R_SET_GLOBAL:
+        case R_DEFINE_GLOBAL:
+            printf("%-16s '", (insn->op == R_SET_GLOBAL) ? "R_SET_GLOBAL"
+                                                          : "R_DEFINE_GLOBAL");
+            printValue(vm.globalSlotNames.values[insn->a]);
+            printf("'");
+            printOperand(function, insn->b);
+            break;
+
+        case R_EQUAL:
+        case R_GREATER:
+        case R_LESS:
+        case R_ADD:
+        case R_SUBTRACT:
+        case R_MULTIPLY:
+        case R_DIVIDE:
+            {
+            static const char* names[] =
+                {
+                "R_EQUAL", "R_GREATER", "R_LESS", "R_ADD",
+                "R_SUBTRACT", "R_MULTIPLY", "R_DIVIDE"
+                };
+            printf("%-16s r%d", names[insn->op - R_EQUAL], insn->a);
+            printOperand(function, insn->b);
+            printOperand(function, insn->c);
+            break;
+            }
+
+        case R_BIT_AND:
+        case R_BIT_OR:
+        case R_BIT_XOR:
+        case R_SHIFT_LEFT:
+        case R_SHIFT_RIGHT:
+            {
+            static const char* names[] =
+                {
+                "R_BIT_AND", "R_BIT_OR", "R_BIT_XOR", "R_SHIFT_LEFT",
+                "R_SHIFT_RIGHT"
+                };
+            printf("%-16s r%d", names[insn->op - R_BIT_AND], insn->a);
+            printOperand(function, insn->b);
+            printOperand(function, insn->c);
+            break;
+            }
+
+        case R_NOT:
+        case R_NEGATE:
+        case R_BIT_NOT:
+            printf("%-16s r%d", (insn->op == R_NOT)    ? "R_NOT"
+                              : (insn->op == R_NEGATE) ? "R_NEGATE"
+                                                       : "R_BIT_NOT",
+                   insn->a);
+            printOperand(function, insn->b);
+            break;
+
+        case R_PRINT:
+        case R_RETURN:
+            printf("%-16s", (insn->op == R_PRINT) ? "R_PRINT" : "R_RETURN");
+            printOperand(function, insn->a);
+            break;
+
+        case R_JUMP:
+            printf("%-16s -> %d", "R_JUMP", insn->b);
+            break;
+
+        case R_JUMP_IF_FALSE:
+            printf("%-16s", "R_JUMP_IF_FALSE");
+            printOperand(function, insn->a);
+            printf(" -> %d", insn->b);
+            break;
+
+        case R_CALL:
+            printf("%-16s r%d (%d args)", "R_CALL", insn->a, insn->b);
+            break;
+
+        default:
+            printf("Unknown register opcode %d", insn->op);
+            break;
+        }
+
+    printf("\n");
+    return index + 1;
+    }
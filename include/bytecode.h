@@ -0,0 +1,40 @@
+//
+//  bytecode.h
+//  psim
+//
+//  Created by ThrudTheBarbarian on 16/10/2026.
+//
+
+#ifndef bytecode_h
+#define bytecode_h
+
+#include "common.h"
+#include "object.h"
+
+/*****************************************************************************\
+|* Bytecode images let a script skip compilation if its source hasn't changed.
+|* An image holds the compiled function tree (code, line runs, constants and
+|* nested functions) along with a hash of the source it was compiled from.
+|*
+|* Global variables are compiled to slot numbers, which depend on the order
+|* names were first seen, so the image also lists the name of every slot and
+|* the slots are renumbered for the running VM when the image is loaded
+\*****************************************************************************/
+
+/*****************************************************************************\
+|* Write the compiled form of 'source' to an image at 'path'. Returns false
+|* if the image couldn't be written, which is never fatal
+\*****************************************************************************/
+bool saveBytecode(const char* path,
+                  ObjFunction* function,
+                  const char* source,
+                  size_t length);
+
+/*****************************************************************************\
+|* Map the image at 'path' and rebuild the function tree in it. Returns NULL
+|* if there is no image, or it was built from a different source, by a
+|* different build of psim, or is damaged
+\*****************************************************************************/
+ObjFunction* loadBytecode(const char* path, const char* source, size_t length);
+
+#endif /* bytecode_h */
@@ -14,14 +14,17 @@
 typedef enum
     {
     OP_CONSTANT,
+    OP_CONSTANT_LONG,
     OP_NIL,
     OP_TRUE,
     OP_FALSE,
     OP_POP,
     OP_GET_GLOBAL,
     OP_GET_LOCAL,
+    OP_GET_LOCAL_LONG,
     OP_SET_GLOBAL,
     OP_SET_LOCAL,
+    OP_SET_LOCAL_LONG,
     OP_DEFINE_GLOBAL,
     OP_EQUAL,
     OP_GREATER,
@@ -32,6 +35,12 @@ typedef enum
     OP_DIVIDE,
     OP_NOT,
     OP_NEGATE,
+    OP_BIT_AND,
+    OP_BIT_OR,
+    OP_BIT_XOR,
+    OP_SHIFT_LEFT,
+    OP_SHIFT_RIGHT,
+    OP_BIT_NOT,
     OP_PRINT,
     OP_JUMP,
     OP_JUMP_IF_FALSE,
@@ -42,24 +51,77 @@ typedef enum
     OP_CLOSURE,
     OP_GET_UPVALUE,
     OP_SET_UPVALUE,
+    OP_GET_UPVALUE_LONG,
+    OP_SET_UPVALUE_LONG,
     OP_CLOSE_UPVALUE,
     OP_CLASS,
     OP_GET_PROPERTY,
     OP_SET_PROPERTY,
+    OP_GET_BUS,
+    OP_SET_BUS,
+    OP_MEM_LOAD,
+    OP_MEM_STORE,
+    OP_GET_SLICE,
+    OP_SET_SLICE,
     OP_GET_SUPER,
     OP_METHOD,
     OP_INHERIT,
     OP_RETURN,
+
+    // Superinstructions, made by fuseSuperinstructions()
+    OP_INC_LOCAL,
+    OP_INC_GLOBAL,
+    OP_ADD_LOCAL_CONST,
+    OP_LESS_JUMP,
+    OP_GREATER_JUMP,
     } OpCode;
 
+/*****************************************************************************\
+|* Inline caches: every OP_GET_PROPERTY, OP_SET_PROPERTY and OP_INVOKE has its
+|* own cache of the last IC_WAYS instance shapes it saw. A shape fixes both
+|* the class and the fields of an instance, so an entry can say for certain
+|* where the property lives: in a field slot, or in a method of the class.
+|* For a store that adds a field, the entry also names the shape it leads to
+\*****************************************************************************/
+#define IC_WAYS         4
+#define IC_METHOD       -1      // Entry slot for a method, not a field
+
+typedef struct
+    {
+    Obj*        shape;          // The ObjShape this entry is for, or NULL
+    int         slot;           // Field slot, or IC_METHOD
+    Obj*        target;         // Method closure, or shape after an add
+    } InlineCacheEntry;
+
+typedef struct
+    {
+    InlineCacheEntry entries[IC_WAYS];
+    } InlineCache;
+
+/*****************************************************************************\
+|* Line numbers are run-length encoded: each run is the offset of the first
+|* byte compiled from a new source line, and that line. Runs are in offset
+|* order, so a line can be found with a binary search
+\*****************************************************************************/
+typedef struct
+    {
+    int         offset;         // First byte of code in this run
+    int         line;           // Source line for the run
+    } LineStart;
+
 // A chunk is a dynamic array, so implement count and capacity
 typedef struct
     {
     int         count;
     int         capacity;
     uint8_t*    code;
-    int *       lines;
+    int         lineCount;      // Number of line runs in use
+    int         lineCapacity;   // Number of line runs allocated
+    LineStart*  lines;          // Line runs, in offset order
     ValueArray  constants;
+    int         cacheCount;     // Number of inline caches in use
+    int         cacheCapacity;  // Number of inline caches allocated
+    InlineCache* caches;        // Per-instruction property caches
     } Chunk;
 
 
@@ -73,6 +135,16 @@ void initChunk(Chunk* chunk);
 \*****************************************************************************/
 void writeChunk(Chunk* chunk, uint8_t byte, int line);
 
+/*****************************************************************************\
+|* Throw away the code from 'count' onwards, along with its line runs
+\*****************************************************************************/
+void truncateChunk(Chunk* chunk, int count);
+
+/*****************************************************************************\
+|* Return the source line of the byte at 'offset'
+\*****************************************************************************/
+int getLine(Chunk* chunk, int offset);
+
 /*****************************************************************************\
 |* Append a value to the constants in the chunk.
 |*
@@ -81,6 +153,20 @@ void writeChunk(Chunk* chunk, uint8_t byte, int line);
 \*****************************************************************************/
 int addConstant(Chunk* chunk, Value value);
 
+/*****************************************************************************\
+|* Append an empty inline cache to the chunk.
+|*
+|* returns the index of the cache, which is written out as the 16-bit operand
+|* of the instruction that uses it
+\*****************************************************************************/
+int addInlineCache(Chunk* chunk);
+
+/*****************************************************************************\
+|* Return the length in bytes of the instruction at 'offset', including its
+|* operands. A superinstruction's length covers the whole fused sequence
+\*****************************************************************************/
+int instructionLength(Chunk* chunk, int offset);
+
 /*****************************************************************************\
 |* Free a chunk and re-initialise. 
 \*****************************************************************************/
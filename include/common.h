@@ -16,12 +16,15 @@
 #include <string.h>
 
 #define NAN_BOXING
+#define THREADED_DISPATCH
 //#define DEBUG_TRACE_EXECUTION
 //#define DEBUG_PRINT_CODE
 //#define DEBUG_STRESS_GC
 //#define DEBUG_LOG_GC
+//#define DEBUG_NO_OBJECT_POOLS
 
 
 #define UINT8_COUNT (UINT8_MAX + 1)
+#define UINT16_COUNT (UINT16_MAX + 1)
 
 #endif /* common_h */
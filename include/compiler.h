@@ -12,9 +12,9 @@
 #include "object.h"
 
 /*****************************************************************************\
-|* Compile the source
+|* Compile 'length' characters of source, which needn't be NUL-terminated
 \*****************************************************************************/
-ObjFunction *  compile(const char* source);
+ObjFunction *  compile(const char* source, size_t length);
 
 /*****************************************************************************\
 |* GC: Do a mark of all the compiler roots we want to keep
@@ -9,6 +9,7 @@
 #define debug_h
 
 #include "chunk.h"
+#include "object.h"
 
 /*****************************************************************************\
 |* Top level dissassembly call, process a chunk
@@ -20,4 +21,14 @@ void disassembleChunk(Chunk* chunk, const char* name);
 \*****************************************************************************/
 int disassembleInstruction(Chunk* chunk, int offset);
 
+/*****************************************************************************\
+|* Dissassemble a function's register code, if it has any
+\*****************************************************************************/
+void disassembleRegisters(ObjFunction* function, const char* name);
+
+/*****************************************************************************\
+|* Dissassemble an instruction within a function's register code
+\*****************************************************************************/
+int disassembleRegisterInstruction(ObjFunction* function, int index);
+
 #endif /* debug_h */
@@ -0,0 +1,59 @@
+//
+//  logic.h
+//  psim
+//
+//  Created by ThrudTheBarbarian on 16/10/2026.
+//
+
+#ifndef logic_h
+#define logic_h
+
+#include "common.h"
+#include "object.h"
+#include "value.h"
+
+/*****************************************************************************\
+|* Four-state logic on signals. Each operation works a word of each bit-plane
+|* at a time, in loops simple enough for the compiler to vectorise, so an X
+|* costs nothing extra and a wide bus costs one pass over its words.
+|*
+|* Either operand can be an integer instead of a signal, which is taken as
+|* known bits, zero-extended. Operands of different widths are zero-extended
+|* to the wider one, which is the width of the result. Two integers give a
+|* 64-bit result
+\*****************************************************************************/
+
+/*****************************************************************************\
+|* Set every bit of a signal to the same state
+\*****************************************************************************/
+void signalFill(ObjSignal* signal, bool value, bool unknown);
+
+/*****************************************************************************\
+|* Apply ARITH_BIT_AND, ARITH_BIT_OR or ARITH_BIT_XOR to two values, at least
+|* one of them a signal. Returns false, with no result, if an operand isn't a
+|* signal or an integer, or it's any other operation. A known 0 decides an
+|* AND and a known 1 an OR whatever the other bit, otherwise an X or Z in
+|* gives an X out
+\*****************************************************************************/
+bool signalLogic(ArithOp op, Value a, Value b, Value* result);
+
+/*****************************************************************************\
+|* Invert a signal. X and Z both invert to X. Returns false if 'a' isn't a
+|* signal
+\*****************************************************************************/
+bool signalComplement(Value a, Value* result);
+
+/*****************************************************************************\
+|* Resolve two drivers of the same bus: a Z gives way to the other driver,
+|* drivers that agree give their value, and any other combination is an X.
+|* Returns false if an operand isn't a signal or an integer
+\*****************************************************************************/
+bool signalResolve(Value a, Value b, Value* result);
+
+/*****************************************************************************\
+|* Are two values, at least one of them a signal, the same bit for bit? X
+|* and Z are compared like any other state, so an X only equals an X
+\*****************************************************************************/
+bool signalEquals(Value a, Value b);
+
+#endif /* logic_h */
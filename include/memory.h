@@ -11,6 +11,36 @@
 #include "common.h"
 #include "object.h"
 
+/*****************************************************************************\
+|* GC tuning: the heap size at which the first collection happens, and how
+|* much the heap may grow (as a multiple of the live bytes left after a
+|* collection) before the next one is triggered
+\*****************************************************************************/
+#define GC_INITIAL_THRESHOLD        (1024 * 1024)
+#define GC_HEAP_GROW_FACTOR         2
+
+/*****************************************************************************\
+|* GC tuning: how many bytes can be allocated before the young generation is
+|* collected with a minor GC
+\*****************************************************************************/
+#define GC_NURSERY_SIZE             (256 * 1024)
+
+/*****************************************************************************\
+|* GC tuning: how many objects a major GC traces or sweeps each time the
+|* nursery fills up. Counting objects rather than time keeps the pauses
+|* bounded and a simulation run reproducible
+\*****************************************************************************/
+#define GC_SLICE_BUDGET             2048
+
+/*****************************************************************************\
+|* Object pools: objects of up to POOL_MAX_SIZE bytes are carved out of
+|* POOL_SLAB_SIZE slabs in POOL_GRANULE-sized size classes, and recycled
+|* through a free list per class instead of going back to malloc()
+\*****************************************************************************/
+#define POOL_GRANULE                16
+#define POOL_MAX_SIZE               128
+#define POOL_SLAB_SIZE              (16 * 1024)
+
 /*****************************************************************************\
 |* Allocate space in the heap
 \*****************************************************************************/
@@ -41,21 +71,70 @@
 \*****************************************************************************/
 #define FREE(type, pointer) reallocate(pointer, sizeof(type), 0)
 
+/*****************************************************************************\
+|* Release an object's memory, allocated with allocateObjectMemory()
+\*****************************************************************************/
+#define FREE_OBJ(type, pointer) freeObjectMemory(pointer, sizeof(type))
+
 /*****************************************************************************\
 |* The actual code that reallocates memory
 \*****************************************************************************/
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
 
+/*****************************************************************************\
+|* Allocate and free the memory for an object, using the pools if possible
+\*****************************************************************************/
+void* allocateObjectMemory(size_t size);
+void freeObjectMemory(void* pointer, size_t size);
+
+/*****************************************************************************\
+|* Release the memory held by the object pools, once all objects are freed
+\*****************************************************************************/
+void freePools(void);
+
 /*****************************************************************************\
 |* Free all the objects that the VM knows about
 \*****************************************************************************/
 void freeObjects(void);
 
 /*****************************************************************************\
-|* Perform garbage collection
+|* Perform garbage collection of both generations, to completion
 \*****************************************************************************/
 void collectGarbage(void);
 
+/*****************************************************************************\
+|* Perform a minor garbage collection, of the young generation only
+\*****************************************************************************/
+void collectNursery(void);
+
+/*****************************************************************************\
+|* GC: Add an old object to the remembered set, so the next minor GC traces
+|* it. Call this directly after bulk-updating an object
+\*****************************************************************************/
+void rememberObject(Obj* object);
+
+/*****************************************************************************\
+|* GC: Write barrier slow path, see writeBarrier()
+\*****************************************************************************/
+void barrierObject(Obj* owner, Obj* object);
+
+/*****************************************************************************\
+|* GC: Write barrier. Must be called after storing 'value' anywhere inside
+|* 'owner', unless 'owner' is a root (the stack, globals, ...). A minor GC
+|* only finds young objects through roots and remembered old objects, and an
+|* incremental major GC must not miss a store into an object it has traced
+\*****************************************************************************/
+static inline void writeBarrier(Obj* owner, Value value)
+    {
+    if (owner->isOld && IS_OBJ(value))
+        barrierObject(owner, AS_OBJ(value));
+    }
+
+/*****************************************************************************\
+|* GC: Return true if an object was not reached during the current collection
+\*****************************************************************************/
+bool isWhite(Obj* object);
+
 /*****************************************************************************\
 |* GC: Mark a value/object as a root
 \*****************************************************************************/
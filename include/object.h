@@ -11,6 +11,7 @@
 #include "common.h"
 #include "value.h"
 #include "chunk.h"
+#include "regcode.h"
 #include "table.h"
 
 /*****************************************************************************\
@@ -26,6 +27,10 @@ typedef enum
     OBJ_CLASS,
     OBJ_INSTANCE,
     OBJ_BOUND_METHOD,
+    OBJ_SHAPE,
+    OBJ_INTEGER,
+    OBJ_SIGNAL,
+    OBJ_MEMORY,
     } ObjType;
 
 /*****************************************************************************\
@@ -35,6 +40,8 @@ struct Obj
     {
     ObjType type;           // Type of the object
     bool isMarked;          // Marked to prevent GC reaping it
+    bool isOld;             // Survived a collection, so in the old generation
+    bool isRemembered;      // Old object in the remembered set
     struct Obj* next;       // Pointer to next object so we can garbage collect
     };
 
@@ -48,14 +55,15 @@ void printObject(Value value);
 #pragma mark - Strings
 
 /*****************************************************************************\
-|* Use struct inheritance to also define a string object type
+|* Use struct inheritance to also define a string object type. The characters
+|* are stored inline, straight after the header, and are NUL-terminated
 \*****************************************************************************/
 struct ObjString
     {
     Obj obj;                // Parent properties
     int length;             // Length of the string
-    char* chars;            // Actual string data
     uint32_t hash;          // Value used for hashtables
+    char chars[];           // Actual string data
     };
 
 /*****************************************************************************\
@@ -81,6 +89,9 @@ static inline bool isObjType(Value value, ObjType type)
 #define IS_CLASS(value)        isObjType(value, OBJ_CLASS)
 #define IS_INSTANCE(value)     isObjType(value, OBJ_INSTANCE)
 #define IS_BOUND_METHOD(value) isObjType(value, OBJ_BOUND_METHOD)
+#define IS_SHAPE(value)        isObjType(value, OBJ_SHAPE)
+#define IS_SIGNAL(value)       isObjType(value, OBJ_SIGNAL)
+#define IS_MEMORY(value)       isObjType(value, OBJ_MEMORY)
 
 /*****************************************************************************\
 |* Get either an ObjString or C-style string from a value (make sure to use
@@ -94,6 +105,9 @@ static inline bool isObjType(Value value, ObjType type)
 #define AS_CLASS(value)        ((ObjClass*)AS_OBJ(value))
 #define AS_INSTANCE(value)     ((ObjInstance*)AS_OBJ(value))
 #define AS_BOUND_METHOD(value) ((ObjBoundMethod*)AS_OBJ(value))
+#define AS_SHAPE(value)        ((ObjShape*)AS_OBJ(value))
+#define AS_SIGNAL(value)       ((ObjSignal*)AS_OBJ(value))
+#define AS_MEMORY(value)       ((ObjMemory*)AS_OBJ(value))
 
 /*****************************************************************************\
 |* Take a copy of a C string and put it into an ObjString. Allocate on heap
@@ -101,10 +115,16 @@ static inline bool isObjType(Value value, ObjType type)
 ObjString* copyString(const char* chars, int length);
 
 /*****************************************************************************\
-|* Take a copy of a C string and put it into an ObjString. Takes ownership of
-|* the passed-in pointer
+|* Create a string with room for 'length' characters, for the caller to fill
+|* in place. It must then be passed to internString() before use
 \*****************************************************************************/
-ObjString* takeString(char* chars, int length);
+ObjString* newString(int length);
+
+/*****************************************************************************\
+|* Intern a string made by newString(). Returns the existing copy if there is
+|* one, in which case the new string is simply left for the GC
+\*****************************************************************************/
+ObjString* internString(ObjString* string);
 
 
 #pragma mark - Functions
@@ -114,7 +134,9 @@ typedef struct
     Obj obj;                // Parent object data
     int arity;              // number of parameters the function expects
     int upvalueCount;       // Number of captured-from-enclosure vars
+    int maxSlots;           // Most local slots the function has in use
     Chunk chunk;            // Bytecode for the function
+    RegisterCode* registers;// Register-machine code, or NULL if none
     ObjString* name;        // Name of the function
     } ObjFunction;
 
@@ -179,18 +201,37 @@ ObjClosure* newClosure(ObjFunction* function);
 
 #pragma mark - Classes, instances and methods
 
+/*****************************************************************************\
+|* A shape (or hidden class) maps field names to slots in an instance. All
+|* instances that gained the same fields in the same order share one shape.
+|* Each class owns an empty root shape, and adding a field moves an instance
+|* along a transition to the child shape that has that field too
+\*****************************************************************************/
+typedef struct ObjShape
+    {
+    Obj obj;                // Parent object data
+    struct ObjShape* parent;// Shape this one was reached from, or NULL
+    ObjString* name;        // Name of the field this shape added
+    int slotCount;          // Number of fields in this shape
+    Table slots;            // Field name -> slot index, for every field
+    Table transitions;      // Field name -> child shape with that field
+    } ObjShape;
+
 typedef struct
     {
     Obj obj;                // Parent object data
     ObjString* name;        // Name of the class
     Table methods;          // List of methods
+    ObjShape* rootShape;    // Shape of a new instance, with no fields
     } ObjClass;
 
 typedef struct
     {
     Obj obj;                // Parent object data
     ObjClass* klass;        // The class object
-    Table fields;           // A list of fields
+    ObjShape* shape;        // Which field is in which slot
+    int fieldCapacity;      // Number of slots allocated in 'fields'
+    Value* fields;          // Field values, shape->slotCount in use
     } ObjInstance;
     
 typedef struct
@@ -208,5 +249,200 @@ ObjClass* newClass(ObjString* name);
 ObjInstance* newInstance(ObjClass* klass);
 ObjBoundMethod* newBoundMethod(Value receiver, ObjClosure* method);
 
+/*****************************************************************************\
+|* Return the slot holding a field in a shape, or -1 if it has no such field
+\*****************************************************************************/
+int shapeSlot(ObjShape* shape, ObjString* name);
+
+/*****************************************************************************\
+|* Return the shape reached by adding a field to a shape, creating it the
+|* first time that transition is taken
+\*****************************************************************************/
+ObjShape* shapeTransition(ObjShape* shape, ObjString* name);
+
+/*****************************************************************************\
+|* Add a new field to an instance, moving it on to 'shape', which must be the
+|* transition from its current shape for that field
+\*****************************************************************************/
+void instanceAddField(ObjInstance* instance, ObjShape* shape, Value value);
+
+
+#pragma mark - Integers
+
+/*****************************************************************************\
+|* An integer too wide to hold inline in a NaN-boxed Value. Boxed integers
+|* aren't unique, so they're compared by value, never by identity
+\*****************************************************************************/
+typedef struct
+    {
+    Obj obj;                // Parent data object
+    int64_t value;          // The integer
+    } ObjInteger;
+
+
+#pragma mark - Signals
+
+/*****************************************************************************\
+|* A signal or bus, as a packed vector of 'width' four-state bits. Each bit
+|* is split over two bit-planes, a value plane and an unknown plane:
+|*
+|*      state   value   unknown
+|*        0       0       0
+|*        1       1       0
+|*        Z       0       1         (high impedance, undriven)
+|*        X       1       1         (unknown)
+|*
+|* so logic on a whole bus is a handful of word operations per plane. The
+|* planes are stored inline after the header, the value plane first, each
+|* least significant word first. Bits above the width are always zero
+\*****************************************************************************/
+#define SIGNAL_MAX_WIDTH        65536
+#define SIGNAL_WORDS(width)     (((width) + 63) / 64)
+#define SIGNAL_UNKNOWN(signal)  ((signal)->bits + SIGNAL_WORDS((signal)->width))
+
+typedef struct
+    {
+    Obj obj;                // Parent data object
+    int width;              // Number of bits in the signal
+    uint64_t bits[];        // The value plane, then the unknown plane
+    } ObjSignal;
+
+/*****************************************************************************\
+|* Create a new signal 'width' bits wide, with every bit clear
+\*****************************************************************************/
+ObjSignal* newSignal(int width);
+
+/*****************************************************************************\
+|* Read or write the 'count' bits from bit 'low' up, as a word from each
+|* plane. The caller checks the range is inside the signal, and 'count' is
+|* from 1 to 64. Writes use the low 'count' bits of 'value' and 'unknown'
+\*****************************************************************************/
+uint64_t signalRead(ObjSignal* signal, int low, int count, uint64_t* unknown);
+void signalWrite(ObjSignal* signal,
+                 int low,
+                 int count,
+                 uint64_t value,
+                 uint64_t unknown);
+
+/*****************************************************************************\
+|* Copy one signal onto another, truncating or zero-extending to fit
+\*****************************************************************************/
+void signalCopy(ObjSignal* to, ObjSignal* from);
+
+
+
+#pragma mark - Memories
+
+/*****************************************************************************\
+|* A simulated memory: 'size' cells of 1, 2, 4 or 8 bytes each, packed into
+|* 4 KiB pages. Pages are only allocated when something is first stored in
+|* them, and until then every cell in them reads as 0, so a large address
+|* space costs a pointer per page until it's used.
+|*
+|* Pages can also point straight into a private mapping of an image file,
+|* so loading a ROM maps it rather than copying it, and only the pages that
+|* are later stored to get copied, by the OS
+\*****************************************************************************/
+#define MEMORY_PAGE_SHIFT   12
+#define MEMORY_PAGE_SIZE    (1 << MEMORY_PAGE_SHIFT)
+#define MEMORY_MAX_BYTES    ((int64_t)1 << 32)
+
+typedef struct
+    {
+    uint8_t* base;          // Start of the mapping
+    size_t length;          // Length mapped
+    } MemoryMapping;
+
+typedef struct
+    {
+    Obj obj;                // Parent data object
+    int64_t size;           // Number of cells
+    int cellShift;          // log2 of the bytes in a cell
+    int pageCount;          // Number of entries in 'pages'
+    uint8_t** pages;        // The pages, NULL until first stored to
+    int mappingCount;       // Number of image files mapped
+    MemoryMapping* mappings;// The mappings pages can point into
+    } ObjMemory;
+
+/*****************************************************************************\
+|* Create a new memory of 'size' cells, 'cellBytes' wide, all 0
+\*****************************************************************************/
+ObjMemory* newMemory(int64_t size, int cellBytes);
+
+/*****************************************************************************\
+|* Store the low bits of 'value' in a cell, allocating its page if need be.
+|* The caller checks 'address' is inside the memory
+\*****************************************************************************/
+void memoryStore(ObjMemory* memory, int64_t address, uint64_t value);
+
+/*****************************************************************************\
+|* Copy bytes in or out of a memory, at 'offset' bytes in. Memories are
+|* stored little-endian, whatever the width of a cell. The caller checks the
+|* range is inside the memory
+\*****************************************************************************/
+void memoryWrite(ObjMemory* memory,
+                 size_t offset,
+                 const uint8_t* bytes,
+                 size_t length);
+void memoryRead(ObjMemory* memory,
+                size_t offset,
+                uint8_t* bytes,
+                size_t length);
+
+/*****************************************************************************\
+|* Load the 'length' bytes of the open file 'fd' at 'offset' bytes in. The
+|* file is mapped copy-on-write, and if 'offset' is on a page boundary the
+|* pages of the mapping become pages of the memory, otherwise it's copied.
+|* Returns false if the file couldn't be mapped. The caller checks the range
+|* is inside the memory
+\*****************************************************************************/
+bool memoryMapFile(ObjMemory* memory, size_t offset, int fd, size_t length);
+
+/*****************************************************************************\
+|* Free a memory's pages and unmap any image files, before it's freed
+\*****************************************************************************/
+void freeMemoryPages(ObjMemory* memory);
+
+/*****************************************************************************\
+|* Load a cell, zero-extended to 64 bits. The VM hands cells of 8, 16 and 32
+|* bits to scripts as they are, but reinterprets a 64-bit cell as a signed
+|* int64, so storing -1 reads back as -1 rather than 2^64-1. The caller
+|* checks 'address' is inside the memory
+\*****************************************************************************/
+static inline uint64_t memoryLoad(ObjMemory* memory, int64_t address)
+    {
+    size_t offset   = (size_t)address << memory->cellShift;
+    uint8_t* page   = memory->pages[offset >> MEMORY_PAGE_SHIFT];
+    if (page == NULL)
+        return 0;
+
+    uint8_t* cell   = page + (offset & (MEMORY_PAGE_SIZE - 1));
+    switch (memory->cellShift)
+        {
+        case 0:
+            return *cell;
+
+        case 1:
+            {
+            uint16_t value;
+            memcpy(&value, cell, sizeof(value));
+            return value;
+            }
+
+        case 2:
+            {
+            uint32_t value;
+            memcpy(&value, cell, sizeof(value));
+            return value;
+            }
+
+        default:
+            {
+            uint64_t value;
+            memcpy(&value, cell, sizeof(value));
+            return value;
+            }
+        }
+    }
 
 #endif /* object_h */
@@ -0,0 +1,26 @@
+//
+//  peephole.h
+//  psim
+//
+//  Created by ThrudTheBarbarian on 16/10/2026.
+//
+
+#ifndef peephole_h
+#define peephole_h
+
+#include "chunk.h"
+
+/*****************************************************************************\
+|* Fuse common instruction sequences in a compiled chunk into single
+|* superinstructions.
+|*
+|* Fusion happens in place: only the opcode of the first instruction in the
+|* sequence is rewritten, and the rest are left where they are for the
+|* superinstruction to read its operands from. Jump offsets and line numbers
+|* are therefore unchanged, a jump into the middle of a fused sequence still
+|* runs the original instructions, and a superinstruction that finds operands
+|* it can't handle can fall back to running the first of them
+\*****************************************************************************/
+void fuseSuperinstructions(Chunk* chunk);
+
+#endif /* peephole_h */
@@ -0,0 +1,88 @@
+//
+//  regcode.h
+//  psim
+//
+//  Created by ThrudTheBarbarian on 16/10/2026.
+//
+
+#ifndef regcode_h
+#define regcode_h
+
+#include "common.h"
+#include "chunk.h"
+
+/*****************************************************************************\
+|* Register-machine opcodes. Registers are the function's frame slots, so
+|* register 0 is the closure (or 'this') and the parameters and locals follow
+|* exactly as they do on the stack. An 'RK' operand names a register, or a
+|* constant in the function's chunk if RK_CONSTANT is set
+\*****************************************************************************/
+typedef enum
+    {
+    R_MOVE,             // R[a] = RK(b)
+    R_NIL,              // R[a] = nil
+    R_TRUE,             // R[a] = true
+    R_FALSE,            // R[a] = false
+    R_GET_GLOBAL,       // R[a] = globals[b]
+    R_SET_GLOBAL,       // globals[a] = RK(b), which must be defined
+    R_DEFINE_GLOBAL,    // globals[a] = RK(b)
+    R_EQUAL,            // R[a] = RK(b) == RK(c)
+    R_GREATER,          // R[a] = RK(b) > RK(c)
+    R_LESS,             // R[a] = RK(b) < RK(c)
+    R_ADD,              // R[a] = RK(b) + RK(c)
+    R_SUBTRACT,         // R[a] = RK(b) - RK(c)
+    R_MULTIPLY,         // R[a] = RK(b) * RK(c)
+    R_DIVIDE,           // R[a] = RK(b) / RK(c)
+    R_NOT,              // R[a] = !RK(b)
+    R_NEGATE,           // R[a] = -RK(b)
+    R_BIT_AND,          // R[a] = RK(b) & RK(c)
+    R_BIT_OR,           // R[a] = RK(b) | RK(c)
+    R_BIT_XOR,          // R[a] = RK(b) ^ RK(c)
+    R_SHIFT_LEFT,       // R[a] = RK(b) << RK(c)
+    R_SHIFT_RIGHT,      // R[a] = RK(b) >> RK(c)
+    R_BIT_NOT,          // R[a] = ~RK(b)
+    R_PRINT,            // print RK(a)
+    R_JUMP,             // pc = b
+    R_JUMP_IF_FALSE,    // if RK(a) is falsey, pc = b
+    R_CALL,             // R[a] = R[a](R[a+1] ... R[a+b])
+    R_RETURN,           // return RK(a)
+    } RegOpCode;
+
+#define RK_CONSTANT     0x8000
+
+/*****************************************************************************\
+|* A register instruction is a fixed-size three-address word
+\*****************************************************************************/
+typedef struct
+    {
+    uint16_t op;        // The RegOpCode
+    uint16_t a;         // Usually the destination register
+    uint16_t b;         // First source, or a jump target
+    uint16_t c;         // Second source
+    } RegInstruction;
+
+/*****************************************************************************\
+|* The register-machine translation of a function
+\*****************************************************************************/
+typedef struct
+    {
+    int count;                  // Number of instructions
+    int capacity;               // Number of instructions allocated
+    RegInstruction* code;       // The instructions themselves
+    int* lines;                 // Source line of each instruction
+    int registerCount;          // Frame size, in registers
+    } RegisterCode;
+
+/*****************************************************************************\
+|* Translate a function's stack bytecode into register code. Returns NULL if
+|* the function uses anything the register machine doesn't support (classes,
+|* closures, upvalues, properties...), in which case it stays as stack code
+\*****************************************************************************/
+RegisterCode* translateToRegisters(Chunk* chunk, int arity);
+
+/*****************************************************************************\
+|* Free a function's register code
+\*****************************************************************************/
+void freeRegisterCode(RegisterCode* code);
+
+#endif /* regcode_h */
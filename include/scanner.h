@@ -8,20 +8,24 @@
 #ifndef scanner_h
 #define scanner_h
 
+#include "common.h"
+
 typedef enum
     {
     // Single-character tokens.
     TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
     TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
+    TOKEN_LEFT_BRACKET, TOKEN_RIGHT_BRACKET,
     TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
     TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR,
-    TOKEN_COLON,
+    TOKEN_COLON, TOKEN_AMPERSAND, TOKEN_PIPE,
+    TOKEN_CARET, TOKEN_TILDE,
     
     // One or two character tokens.
     TOKEN_BANG, TOKEN_BANG_EQUAL,
     TOKEN_EQUAL, TOKEN_EQUAL_EQUAL,
-    TOKEN_GREATER, TOKEN_GREATER_EQUAL,
-    TOKEN_LESS, TOKEN_LESS_EQUAL,
+    TOKEN_GREATER, TOKEN_GREATER_EQUAL, TOKEN_GREATER_GREATER,
+    TOKEN_LESS, TOKEN_LESS_EQUAL, TOKEN_LESS_LESS,
     
     // Literals.
     TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER,
@@ -45,9 +49,10 @@ typedef struct
     } Token;
 
 /*****************************************************************************\
-|* Initialise the sourcecode scanner
+|* Initialise the sourcecode scanner to read 'length' characters of 'source',
+|* which needn't be NUL-terminated
 \*****************************************************************************/
-void initScanner(const char* source);
+void initScanner(const char* source, size_t length);
 
 /*****************************************************************************\
 |* Return the next token
@@ -0,0 +1,88 @@
+//
+//  scheduler.h
+//  psim
+//
+//  Created by ThrudTheBarbarian on 16/10/2026.
+//
+
+#ifndef scheduler_h
+#define scheduler_h
+
+#include "common.h"
+#include "value.h"
+
+/*****************************************************************************\
+|* Simulated time is counted in ticks of the model's resolution. Pending
+|* events are kept in a hierarchical timing wheel: level 0 has one slot per
+|* tick of the current 64-tick block, level 1 one slot per 64-tick block of
+|* the current 4096-tick block, and so on up to the full 64 bits of time.
+|*
+|* An event sits in the lowest level where its time differs from the current
+|* time only in that level's 6 bits or below. Scheduling is a list append,
+|* and finding the next event is a bit scan of each level's occupancy mask.
+|* When time moves into a new block, the events in that block's slot are
+|* cascaded down a level. Events due on the same tick come out in the order
+|* they were scheduled
+\*****************************************************************************/
+#define WHEEL_BITS          6
+#define WHEEL_SIZE          (1 << WHEEL_BITS)
+#define WHEEL_LEVELS        ((64 + WHEEL_BITS - 1) / WHEEL_BITS)
+
+typedef uint64_t SimTime;
+
+typedef struct Event
+    {
+    SimTime time;                   // Tick the event is due on
+    Value action;                   // What to call when it's due
+    struct Event* next;             // Next event in the same slot
+    } Event;
+
+typedef struct
+    {
+    Event* head;                    // First event in the slot
+    Event* tail;                    // Last, so appending is O(1)
+    } EventList;
+
+typedef struct
+    {
+    SimTime now;                    // Current simulated time
+    int count;                      // Number of pending events
+    uint64_t occupied[WHEEL_LEVELS];            // Bit set per non-empty slot
+    EventList slots[WHEEL_LEVELS][WHEEL_SIZE];  // The wheels themselves
+    Event* freeEvents;              // Recycled events
+    } Scheduler;
+
+
+/*****************************************************************************\
+|* Initialise the scheduler, with time at 0
+\*****************************************************************************/
+void initScheduler(Scheduler* scheduler);
+
+/*****************************************************************************\
+|* Free the scheduler and anything still pending
+\*****************************************************************************/
+void freeScheduler(Scheduler* scheduler);
+
+/*****************************************************************************\
+|* Schedule 'action' to be run 'delay' ticks from now. Returns false if that
+|* would be past the end of time
+\*****************************************************************************/
+bool scheduleEvent(Scheduler* scheduler, SimTime delay, Value action);
+
+/*****************************************************************************\
+|* Take the next event off the queue, moving time on to when it's due.
+|* Returns false if nothing is pending
+\*****************************************************************************/
+bool nextEvent(Scheduler* scheduler, Value* action);
+
+/*****************************************************************************\
+|* Drop every pending event. Time stays where it is
+\*****************************************************************************/
+void clearEvents(Scheduler* scheduler);
+
+/*****************************************************************************\
+|* GC: Mark the actions of pending events
+\*****************************************************************************/
+void markScheduler(Scheduler* scheduler);
+
+#endif /* scheduler_h */
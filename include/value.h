@@ -8,22 +8,13 @@
 #ifndef value_h
 #define value_h
 
+#include <inttypes.h>
+
 #include "common.h"
 
 typedef struct Obj Obj;
 typedef struct ObjString ObjString;
 
-/*****************************************************************************\
-|* Types that can be represented in a Value
-\*****************************************************************************/
-typedef enum
-    {
-    VAL_BOOL,       // Bool
-    VAL_NIL,        // Null
-    VAL_NUMBER,     // Number
-    VAL_OBJ,        // String or object
-    } ValueType;
-
 /*****************************************************************************\
 |* Basic type will be a 64-bit int. That ought to cover most of the needs of a
 |* simulation-type environment
@@ -39,19 +30,158 @@ typedef enum
 #  define VALUE_FORMAT_STRING "%lg"
 #endif
 
+/*****************************************************************************\
+|* Alongside numbers there are exact 64-bit integers, for bus and address
+|* arithmetic. Literals without a decimal point are integers, integer maths
+|* wraps around like the hardware it models, and an integer mixed with a
+|* number is converted to a number first
+\*****************************************************************************/
+#define INT_FORMAT_STRING   "%" PRId64
+
+/*****************************************************************************\
+|* NaN-boxing hides every non-number inside the unused payload bits of a quiet
+|* NaN, so it can only be used when numbers are doubles
+\*****************************************************************************/
+#if defined(NAN_BOXING) && defined(INTEGER_ONLY)
+#  error "NAN_BOXING requires double numbers, undefine INTEGER_ONLY"
+#endif
+
+#ifdef NAN_BOXING
+
+/*****************************************************************************\
+|* A Value is a single 64-bit word. Any bit pattern that isn't a quiet NaN is
+|* a double. Quiet NaNs with the sign bit set carry an Obj pointer in the low
+|* 48 bits, and quiet NaNs with the sign bit clear use the low 2 bits as a tag
+|* for nil, true and false. A zero tag marks a global that isn't defined yet
+\*****************************************************************************/
+#define SIGN_BIT    ((uint64_t)0x8000000000000000)
+#define QNAN        ((uint64_t)0x7ffc000000000000)
+
+#define TAG_UNDEFINED 0     // 00.
+#define TAG_NIL     1       // 01.
+#define TAG_FALSE   2       // 10.
+#define TAG_TRUE    3       // 11.
+
+typedef uint64_t Value;
+
+/*****************************************************************************\
+|* Integers that fit in 48 bits are held inline, in quiet NaNs with the sign
+|* bit clear and bit 48 set. Anything wider is boxed in an ObjInteger, so
+|* every 64-bit integer stays exact. Arithmetic fast paths only need to look
+|* for the inline form, and leave boxed integers to the general case
+\*****************************************************************************/
+#define INT_TAG         ((uint64_t)0x0001000000000000)
+#define INT_MASK        (SIGN_BIT | QNAN | (uint64_t)0x0003000000000000)
+#define INT_PAYLOAD     ((uint64_t)0x0000ffffffffffff)
+#define SMALL_INT_MIN   (-((int64_t)1 << 47))
+#define SMALL_INT_MAX   (((int64_t)1 << 47) - 1)
+
+#define IS_SMALL_INT(value) (((value) & INT_MASK) == (QNAN | INT_TAG))
+#define AS_SMALL_INT(value) ((int64_t)((value) << 16) >> 16)
+#define SMALL_INT_VAL(i)    ((Value)(QNAN | INT_TAG                           \
+                                     | ((uint64_t)(i) & INT_PAYLOAD)))
+
+#define IS_INT(value)       (IS_SMALL_INT(value) || isBoxedInt(value))
+#define AS_INT(value)       (IS_SMALL_INT(value) ? AS_SMALL_INT(value)        \
+                                                 : boxedInt(value))
+#define INT_VAL(i)          intToValue(i)
+
+/*****************************************************************************\
+|* Boxed integers, implemented in object.c. boxInt() allocates, so the GC
+|* may run
+\*****************************************************************************/
+bool isBoxedInt(Value value);
+int64_t boxedInt(Value value);
+Value boxInt(int64_t i);
+
+static inline Value intToValue(int64_t i)
+    {
+    if ((i >= SMALL_INT_MIN) && (i <= SMALL_INT_MAX))
+        return SMALL_INT_VAL(i);
+    return boxInt(i);
+    }
+
+/*****************************************************************************\
+|* How we check a psim type is of a given type
+\*****************************************************************************/
+#define IS_BOOL(value)    (((value) | 1) == TRUE_VAL)
+#define IS_NIL(value)     ((value) == NIL_VAL)
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
+#define IS_NUMBER(value)  (((value) & QNAN) != QNAN)
+#define IS_OBJ(value)     (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+
+/*****************************************************************************\
+|* How we obtain a 'C' type from a psim type
+\*****************************************************************************/
+#define AS_BOOL(value)    ((value) == TRUE_VAL)
+#define AS_NUMBER(value)  valueToNum(value)
+#define AS_OBJ(value)     ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+/*****************************************************************************\
+|* How we promote a 'C' type to a psim type
+\*****************************************************************************/
+#define BOOL_VAL(b)       ((b) ? TRUE_VAL : FALSE_VAL)
+#define FALSE_VAL         ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL          ((Value)(uint64_t)(QNAN | TAG_TRUE))
+#define NIL_VAL           ((Value)(uint64_t)(QNAN | TAG_NIL))
+#define UNDEFINED_VAL     ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
+#define NUMBER_VAL(num)   numToValue(num)
+#define OBJ_VAL(obj)      (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(obj))
+
+/*****************************************************************************\
+|* Type-pun between a double and its bit pattern. memcpy() is the portable way
+|* to do this and compiles down to a register move
+\*****************************************************************************/
+static inline VALUE_TYPE valueToNum(Value value)
+    {
+    VALUE_TYPE num;
+    memcpy(&num, &value, sizeof(Value));
+    return num;
+    }
+
+static inline Value numToValue(VALUE_TYPE num)
+    {
+    Value value;
+    memcpy(&value, &num, sizeof(VALUE_TYPE));
+    return value;
+    }
+
+#else
+
+/*****************************************************************************\
+|* Types that can be represented in a Value
+\*****************************************************************************/
+typedef enum
+    {
+    VAL_BOOL,       // Bool
+    VAL_NIL,        // Null
+    VAL_NUMBER,     // Number
+    VAL_INT,        // 64-bit integer
+    VAL_OBJ,        // String or object
+    VAL_UNDEFINED,  // Global slot not yet defined, never seen by scripts
+    } ValueType;
+
 /*****************************************************************************\
 |* How we check a psim type is of a given type
 \*****************************************************************************/
 #define IS_BOOL(value)    ((value).type == VAL_BOOL)
 #define IS_NIL(value)     ((value).type == VAL_NIL)
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
 #define IS_NUMBER(value)  ((value).type == VAL_NUMBER)
+#define IS_INT(value)     ((value).type == VAL_INT)
 #define IS_OBJ(value)     ((value).type == VAL_OBJ)
 
+// Every integer is held inline, so the fast paths see them all
+#define IS_SMALL_INT(value) IS_INT(value)
+#define AS_SMALL_INT(value) AS_INT(value)
+#define SMALL_INT_VAL(i)    INT_VAL(i)
+
 /*****************************************************************************\
 |* How we obtain a 'C' type from a psim type
 \*****************************************************************************/
 #define AS_BOOL(value)    ((value).as.boolean)
 #define AS_NUMBER(value)  ((value).as.number)
+#define AS_INT(value)     ((value).as.integer)
 #define AS_OBJ(value)     ((value).as.obj)
 
 /*****************************************************************************\
@@ -59,7 +189,9 @@ typedef enum
 \*****************************************************************************/
 #define BOOL_VAL(value)   ((Value){VAL_BOOL, {.boolean = value}})
 #define NIL_VAL           ((Value){VAL_NIL, {.number = 0}})
+#define UNDEFINED_VAL     ((Value){VAL_UNDEFINED, {.number = 0}})
 #define NUMBER_VAL(value) ((Value){VAL_NUMBER, {.number = value}})
+#define INT_VAL(value)    ((Value){VAL_INT, {.integer = value}})
 #define OBJ_VAL(object)   ((Value){VAL_OBJ, {.obj = (Obj*)object}})
 
 typedef struct
@@ -69,10 +201,43 @@ typedef struct
         {
         bool boolean;
         VALUE_TYPE number;
+        int64_t integer;
         Obj* obj;
         } as;
     } Value;
 
+#endif /* NAN_BOXING */
+
+/*****************************************************************************\
+|* Integers and numbers together, for the places either will do. AS_NUMERIC
+|* converts an integer to a number
+\*****************************************************************************/
+#define IS_NUMERIC(value) (IS_NUMBER(value) || IS_INT(value))
+#define AS_NUMERIC(value) (IS_INT(value) ? (VALUE_TYPE)AS_INT(value)          \
+                                         : AS_NUMBER(value))
+
+/*****************************************************************************\
+|* Binary operators that work on integers and numbers
+\*****************************************************************************/
+typedef enum
+    {
+    ARITH_ADD,
+    ARITH_SUBTRACT,
+    ARITH_MULTIPLY,
+    ARITH_DIVIDE,
+    ARITH_LESS,
+    ARITH_GREATER,
+    
+    // Integers only
+    ARITH_BIT_AND,
+    ARITH_BIT_OR,
+    ARITH_BIT_XOR,
+    ARITH_SHIFT_LEFT,
+    ARITH_SHIFT_RIGHT,
+    } ArithOp;
+
+#define IS_BITWISE(op)  ((op) >= ARITH_BIT_AND)
+
 
 /*****************************************************************************\
 |* Also handle arrays of types
@@ -84,6 +249,20 @@ typedef struct
     Value* values;
     } ValueArray;
 
+/*****************************************************************************\
+|* "False" is a fairly permissive definition. This is shared by the VM and
+|* the compiler's constant folding, so the two can't disagree. It's an inline
+|* function since the VM tests it on every branch
+\*****************************************************************************/
+static inline bool isFalsey(Value value)
+    {
+    // Zero always fits inline, so boxed integers are never false
+    return IS_NIL(value)
+        || (IS_BOOL(value) && !AS_BOOL(value))
+        || (IS_NUMBER(value) && !AS_NUMBER(value))
+        || (IS_SMALL_INT(value) && !AS_SMALL_INT(value));
+    }
+
 /*****************************************************************************\
 |* Determine if two values are equal
 \*****************************************************************************/
@@ -109,4 +288,23 @@ void freeValueArray(ValueArray* array);
 \*****************************************************************************/
 void printValue(Value value);
 
+/*****************************************************************************\
+|* Apply an arithmetic or comparison operator to two integers or numbers,
+|* in any mix, or a bitwise operator to two integers. Returns false if the
+|* operands are of the wrong type. This is the general case, which the VM
+|* only falls back on once its fast paths for same-typed operands have
+|* missed. It may box a result, so the GC may run
+\*****************************************************************************/
+bool arithmetic(ArithOp op, Value a, Value b, Value* result);
+
+/*****************************************************************************\
+|* Negate an integer or number. Returns false if the operand is neither
+\*****************************************************************************/
+bool negateNumeric(Value a, Value* result);
+
+/*****************************************************************************\
+|* Take the bitwise complement of an integer. Returns false if it isn't one
+\*****************************************************************************/
+bool complementInt(Value a, Value* result);
+
 #endif /* value_h */
@@ -12,9 +12,13 @@
 #include "chunk.h"
 #include "table.h"
 #include "object.h"
+#include "scheduler.h"
 
 #define FRAMES_MAX 64
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+
+// Room for a full call stack of ordinary frames, plus one function using
+// every local slot the compiler allows
+#define STACK_MAX ((FRAMES_MAX * UINT8_COUNT) + UINT16_COUNT)
 
 /*****************************************************************************\
 |* Handles how to set local variables in called functions, even if they are
@@ -25,9 +29,30 @@ typedef struct
     {
     ObjClosure* closure;            // The function in question
     uint8_t* ip;                    // Where to return to after execution
+    RegInstruction* pc;             // Same, for register code, else NULL
     Value* slots;                   // Pointer to first variable slot
     } CallFrame;
 
+/*****************************************************************************\
+|* Which phase of a major garbage collection cycle we're in
+\*****************************************************************************/
+typedef enum
+    {
+    GC_IDLE,                        // No major GC in progress
+    GC_MARKING,                     // Tracing the old generation in slices
+    GC_SWEEPING                     // Freeing the old generation in slices
+    } GCState;
+
+/*****************************************************************************\
+|* Which generations markObject() will mark
+\*****************************************************************************/
+typedef enum
+    {
+    GC_MARK_ALL,                    // Full collection, or end of marking
+    GC_MARK_YOUNG,                  // Minor GC
+    GC_MARK_OLD                     // Incremental steps of a major GC
+    } GCMarkMode;
+
 /*****************************************************************************\
 |* Define the virtual machine state
 \*****************************************************************************/
@@ -39,15 +64,32 @@ typedef struct
     uint8_t* ip;                    // Thw instruction pointer to the current insn
     Value stack[STACK_MAX];         // Intermediate storage
     Value* stackTop;                // Pointer to next free value slot
-    Obj *objects;                   // Intrinsic list of objects in VM
+    Obj *objects;                   // Old-generation objects in VM
+    Obj *youngObjects;              // Objects allocated since the last GC
     Table strings;                  // List of unique strings
     ObjString* initString;          // Name of initialisation method for class
     ObjUpvalue* openUpvalues;       // List of up-values
-    Table globals;                  // List of global variables [21.2]
+    bool registerMode;              // Compile to register code if possible
+    Table globalNames;              // Global name -> index of its slot
+    ValueArray globalValues;        // Global slots, UNDEFINED_VAL until set
+    ValueArray globalSlotNames;     // Name of each global slot, for errors
+    Scheduler scheduler;            // Simulated time and pending events
 
     int grayCount;                  // GC: Number of items to process
     int grayCapacity;               // GC: Max items we can know of atm
     Obj** grayStack;                // GC: list of marked objects
+    size_t bytesAllocated;          // GC: Bytes currently allocated on heap
+    size_t nextGC;                  // GC: Threshold that triggers collection
+    int gcGrowFactor;               // GC: nextGC = live bytes * this factor
+    size_t nurseryBytes;            // GC: Bytes allocated since the last GC
+    size_t nurserySize;             // GC: nurseryBytes that trigger a minor GC
+    GCState gcState;                // GC: Phase of the major GC cycle
+    GCMarkMode gcMarkMode;          // GC: Generations we're marking
+    size_t gcSliceBudget;           // GC: Objects traced/swept per slice
+    Obj* sweepList;                 // GC: Old objects left to sweep
+    int rememberedCount;            // GC: Number of remembered old objects
+    int rememberedCapacity;         // GC: Max remembered objects atm
+    Obj** rememberedSet;            // GC: old objects pointing at young ones
     } VM;
 
 extern VM vm;
@@ -74,6 +116,12 @@ void freeVM(void);
 \*****************************************************************************/
 InterpretResult interpret(const char* source);
 
+/*****************************************************************************\
+|* Run the VM on a top-level function that has already been compiled, or
+|* loaded from a bytecode image
+\*****************************************************************************/
+InterpretResult interpretFunction(ObjFunction* function);
+
 /*****************************************************************************\
 |* Push a value onto the stack and update
 \*****************************************************************************/
@@ -84,6 +132,12 @@ void push(Value value);
 \*****************************************************************************/
 Value pop(void);
 
+/*****************************************************************************\
+|* Return the slot for a global variable, allocating an undefined one if this
+|* is the first time the name has been seen
+\*****************************************************************************/
+int globalSlot(ObjString* name);
+
 /*****************************************************************************\
 |* Define a native function
 \*****************************************************************************/
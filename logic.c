@@ -0,0 +1,281 @@
+//
+//  logic.c
+//  psim
+//
+//  Created by ThrudTheBarbarian on 16/10/2026.
+//
+
+#include <string.h>
+
+#include "logic.h"
+
+/*****************************************************************************\
+|* The two planes of an operand. An integer has a single word of each, and
+|* no width of its own, so it takes the width of the other operand
+\*****************************************************************************/
+typedef struct
+    {
+    const uint64_t* value;          // Value plane
+    const uint64_t* unknown;        // Unknown plane
+    int words;                      // Words in each plane
+    int width;                      // Width in bits, 0 for an integer
+    } Planes;
+
+/*****************************************************************************\
+|* Helper function: Get the planes of a signal or integer operand. An
+|* integer's planes are kept in 'scratch'
+\*****************************************************************************/
+static bool planesOf(Value value, uint64_t scratch[2], Planes* planes)
+    {
+    if (IS_SIGNAL(value))
+        {
+        ObjSignal* signal   = AS_SIGNAL(value);
+        planes->value       = signal->bits;
+        planes->unknown     = SIGNAL_UNKNOWN(signal);
+        planes->words       = SIGNAL_WORDS(signal->width);
+        planes->width       = signal->width;
+        return true;
+        }
+
+    if (IS_INT(value))
+        {
+        scratch[0]          = (uint64_t)AS_INT(value);
+        scratch[1]          = 0;
+        planes->value       = &scratch[0];
+        planes->unknown     = &scratch[1];
+        planes->words       = 1;
+        planes->width       = 0;
+        return true;
+        }
+
+    return false;
+    }
+
+/*****************************************************************************\
+|* Helper function: Clear the bits above the width in the top word of each
+|* plane, which operations like NOT can set
+\*****************************************************************************/
+static void trimSignal(ObjSignal* signal)
+    {
+    int words   = SIGNAL_WORDS(signal->width);
+    int spare   = words * 64 - signal->width;
+    if (spare == 0)
+        return;
+
+    uint64_t mask = UINT64_MAX >> spare;
+    signal->bits[words - 1]             &= mask;
+    SIGNAL_UNKNOWN(signal)[words - 1]   &= mask;
+    }
+
+/*****************************************************************************\
+|* Set every bit of a signal to the same state
+\*****************************************************************************/
+void signalFill(ObjSignal* signal, bool value, bool unknown)
+    {
+    size_t size = SIGNAL_WORDS(signal->width) * sizeof(uint64_t);
+    memset(signal->bits, value ? 0xFF : 0, size);
+    memset(SIGNAL_UNKNOWN(signal), unknown ? 0xFF : 0, size);
+    trimSignal(signal);
+    }
+
+
+#pragma mark - Word operations
+
+/*****************************************************************************\
+|* One word of each operation, for 64 bits at a time. A bit is a known 0 when
+|* neither plane is set, and a known 1 when only the value plane is
+\*****************************************************************************/
+static inline void andWord(uint64_t av, uint64_t au,
+                           uint64_t bv, uint64_t bu,
+                           uint64_t* rv, uint64_t* ru)
+    {
+    uint64_t one    = (av & ~au) & (bv & ~bu);
+    uint64_t zero   = ~(av | au) | ~(bv | bu);
+    *ru             = ~(one | zero);
+    *rv             = one | *ru;
+    }
+
+static inline void orWord(uint64_t av, uint64_t au,
+                          uint64_t bv, uint64_t bu,
+                          uint64_t* rv, uint64_t* ru)
+    {
+    uint64_t one    = (av & ~au) | (bv & ~bu);
+    uint64_t zero   = ~(av | au) & ~(bv | bu);
+    *ru             = ~(one | zero);
+    *rv             = one | *ru;
+    }
+
+static inline void xorWord(uint64_t av, uint64_t au,
+                           uint64_t bv, uint64_t bu,
+                           uint64_t* rv, uint64_t* ru)
+    {
+    *ru             = au | bu;
+    *rv             = (av ^ bv) | *ru;
+    }
+
+static inline void resolveWord(uint64_t av, uint64_t au,
+                               uint64_t bv, uint64_t bu,
+                               uint64_t* rv, uint64_t* ru)
+    {
+    uint64_t aFloats    = ~av & au;
+    uint64_t bFloats    = ~bv & bu & ~aFloats;
+    uint64_t driven     = ~(aFloats | bFloats);
+    uint64_t agree      = driven & ~(au | bu) & ~(av ^ bv);
+    uint64_t conflict   = driven & ~agree;
+
+    *rv = (aFloats & bv) | (bFloats & av) | (agree & av) | conflict;
+    *ru = (aFloats & bu) | (bFloats & au) | conflict;
+    }
+
+/*****************************************************************************\
+|* Apply a word operation across two operands into 'result'. The words both
+|* operands have run as a straight loop over the planes, then the wider one
+|* carries on against zeros
+\*****************************************************************************/
+#define COMBINE(wordOp, a, b, result)                                       \
+    do                                                                      \
+        {                                                                   \
+        uint64_t* restrict rv   = (result)->bits;                           \
+        uint64_t* restrict ru   = SIGNAL_UNKNOWN(result);                   \
+        int words               = SIGNAL_WORDS((result)->width);            \
+        int common              = ((a).words < (b).words) ? (a).words       \
+                                                          : (b).words;      \
+        if (common > words)                                                 \
+            common = words;                                                 \
+                                                                            \
+        int i = 0;                                                          \
+        for ( ; i < common; i++)                                            \
+            wordOp((a).value[i], (a).unknown[i],                            \
+                   (b).value[i], (b).unknown[i],                            \
+                   &rv[i], &ru[i]);                                         \
+        for ( ; i < words; i++)                                             \
+            wordOp((i < (a).words) ? (a).value[i] : 0,                      \
+                   (i < (a).words) ? (a).unknown[i] : 0,                    \
+                   (i < (b).words) ? (b).value[i] : 0,                      \
+                   (i < (b).words) ? (b).unknown[i] : 0,                    \
+                   &rv[i], &ru[i]);                                         \
+        trimSignal(result);                                                 \
+        }                                                                   \
+    while (false)
+
+
+#pragma mark - Operations
+
+/*****************************************************************************\
+|* Helper function: Get the planes of two operands, and make a signal for
+|* the result, as wide as the wider of them, or 64 bits if both are integers.
+|* The operands must be reachable by the GC, since this allocates
+\*****************************************************************************/
+static ObjSignal* prepare(Value a, Value b,
+                          uint64_t aScratch[2], uint64_t bScratch[2],
+                          Planes* aPlanes, Planes* bPlanes)
+    {
+    if (!planesOf(a, aScratch, aPlanes) || !planesOf(b, bScratch, bPlanes))
+        return NULL;
+
+    int width = (aPlanes->width > bPlanes->width) ? aPlanes->width
+                                                  : bPlanes->width;
+    if (width == 0)
+        width = 64;
+    return newSignal(width);
+    }
+
+/*****************************************************************************\
+|* AND, OR or XOR two values, at least one of them a signal
+\*****************************************************************************/
+bool signalLogic(ArithOp op, Value a, Value b, Value* result)
+    {
+    if ((op != ARITH_BIT_AND) && (op != ARITH_BIT_OR) && (op != ARITH_BIT_XOR))
+        return false;
+
+    uint64_t aScratch[2], bScratch[2];
+    Planes aPlanes, bPlanes;
+    ObjSignal* signal = prepare(a, b, aScratch, bScratch, &aPlanes, &bPlanes);
+    if (signal == NULL)
+        return false;
+
+    switch (op)
+        {
+        case ARITH_BIT_AND:
+            COMBINE(andWord, aPlanes, bPlanes, signal);
+            break;
+
+        case ARITH_BIT_OR:
+            COMBINE(orWord, aPlanes, bPlanes, signal);
+            break;
+
+        default:
+            COMBINE(xorWord, aPlanes, bPlanes, signal);
+            break;
+        }
+
+    *result = OBJ_VAL(signal);
+    return true;
+    }
+
+/*****************************************************************************\
+|* Invert a signal
+\*****************************************************************************/
+bool signalComplement(Value a, Value* result)
+    {
+    if (!IS_SIGNAL(a))
+        return false;
+
+    ObjSignal* from     = AS_SIGNAL(a);
+    ObjSignal* signal   = newSignal(from->width);
+    int words           = SIGNAL_WORDS(from->width);
+
+    const uint64_t* av  = from->bits;
+    const uint64_t* au  = SIGNAL_UNKNOWN(from);
+    uint64_t* restrict rv = signal->bits;
+    uint64_t* restrict ru = SIGNAL_UNKNOWN(signal);
+    for (int i = 0; i < words; i++)
+        {
+        ru[i] = au[i];
+        rv[i] = ~av[i] | au[i];
+        }
+    trimSignal(signal);
+
+    *result = OBJ_VAL(signal);
+    return true;
+    }
+
+/*****************************************************************************\
+|* Resolve two drivers of the same bus
+\*****************************************************************************/
+bool signalResolve(Value a, Value b, Value* result)
+    {
+    uint64_t aScratch[2], bScratch[2];
+    Planes aPlanes, bPlanes;
+    ObjSignal* signal = prepare(a, b, aScratch, bScratch, &aPlanes, &bPlanes);
+    if (signal == NULL)
+        return false;
+
+    COMBINE(resolveWord, aPlanes, bPlanes, signal);
+    *result = OBJ_VAL(signal);
+    return true;
+    }
+
+/*****************************************************************************\
+|* Are two values, at least one of them a signal, the same bit for bit
+\*****************************************************************************/
+bool signalEquals(Value a, Value b)
+    {
+    uint64_t aScratch[2], bScratch[2];
+    Planes aPlanes, bPlanes;
+    if (!planesOf(a, aScratch, &aPlanes) || !planesOf(b, bScratch, &bPlanes))
+        return false;
+
+    int words = (aPlanes.words > bPlanes.words) ? aPlanes.words
+                                                : bPlanes.words;
+    uint64_t differ = 0;
+    for (int i = 0; i < words; i++)
+        {
+        uint64_t av = (i < aPlanes.words) ? aPlanes.value[i] : 0;
+        uint64_t au = (i < aPlanes.words) ? aPlanes.unknown[i] : 0;
+        uint64_t bv = (i < bPlanes.words) ? bPlanes.value[i] : 0;
+        uint64_t bu = (i < bPlanes.words) ? bPlanes.unknown[i] : 0;
+        differ     |= (av ^ bv) | (au ^ bu);
+        }
+    return differ == 0;
+    }
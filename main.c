@@ -7,8 +7,15 @@
 
 #define MAX_LINE_LENGTH 1024
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "common.h"
+#include "bytecode.h"
 #include "chunk.h"
+#include "compiler.h"
 #include "debug.h"
 #include "vm.h"
 
@@ -33,39 +40,51 @@ static void repl(void)
     }
 
 /*****************************************************************************\
-|* Read a file into a buffer
+|* Map a file into memory, read-only. The mapping is used as the source as-is,
+|* so it isn't NUL-terminated and has to be passed around with its length
 \*****************************************************************************/
-static char* readFile(const char* path)
+static const char* mapFile(const char* path, size_t* length)
     {
-    FILE* file = fopen(path, "rb");
-    if (file == NULL)
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
         {
         fprintf(stderr, "Could not open file \"%s\".\n", path);
         exit(74);
         }
-        
-    fseek(file, 0L, SEEK_END);
-    size_t fileSize = ftell(file);
-    rewind(file);
 
-    char* buffer = (char*)malloc(fileSize + 1);
-    if (buffer == NULL)
+    struct stat info;
+    if (fstat(fd, &info) != 0)
         {
-        fprintf(stderr, "Not enough memory to read \"%s\".\n", path);
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
         exit(74);
         }
 
-    size_t bytesRead = fread(buffer, sizeof(char), fileSize, file);
-    if (bytesRead < fileSize)
+    // mmap() won't map an empty file, but an empty script is still valid
+    *length = (size_t)info.st_size;
+    if (*length == 0)
+        {
+        close(fd);
+        return "";
+        }
+
+    void* source = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (source == MAP_FAILED)
         {
         fprintf(stderr, "Could not read file \"%s\".\n", path);
         exit(74);
         }
 
-    buffer[bytesRead] = '\0';
+    return (const char*)source;
+    }
 
-    fclose(file);
-    return buffer;
+/*****************************************************************************\
+|* Release a file mapped by mapFile()
+\*****************************************************************************/
+static void unmapFile(const char* source, size_t length)
+    {
+    if (length > 0)
+        munmap((void*)source, length);
     }
 
 /*****************************************************************************\
@@ -73,9 +92,40 @@ static char* readFile(const char* path)
 \*****************************************************************************/
 static void runFile(const char* path)
     {
-    char* source = readFile(path);
-    InterpretResult result = interpret(source);
-    free(source);
+    size_t length;
+    const char* source = mapFile(path, &length);
+
+    // The compiled script is cached alongside it, as 'script.psimc'. Register
+    // code is translated from the stack code before it is fused, which the
+    // image doesn't keep, so -r always compiles from source
+    size_t pathLength   = strlen(path);
+    char* imagePath     = (char*)malloc(pathLength + 2);
+    if (imagePath == NULL)
+        {
+        fprintf(stderr, "Not enough memory to run \"%s\".\n", path);
+        exit(74);
+        }
+    memcpy(imagePath, path, pathLength);
+    memcpy(imagePath + pathLength, "c", 2);
+
+    ObjFunction* function = NULL;
+    if (!vm.registerMode)
+        function = loadBytecode(imagePath, source, length);
+
+    if (function == NULL)
+        {
+        function = compile(source, length);
+        if (function == NULL)
+            exit(65);
+        if (!vm.registerMode)
+            saveBytecode(imagePath, function, source, length);
+        }
+
+    // Compiled code has its own copy of everything it needs from the source
+    unmapFile(source, length);
+    free(imagePath);
+
+    InterpretResult result = interpretFunction(function);
 
     if (result == INTERPRET_COMPILE_ERROR)
         exit(65);
@@ -88,12 +138,20 @@ int main(int argc, const char * argv[])
     {
     initVM();
     
+    // -r compiles what it can to register code instead of stack code
+    if ((argc > 1) && (strcmp(argv[1], "-r") == 0))
+        {
+        vm.registerMode = true;
+        argc--;
+        argv++;
+        }
+
     if (argc == 1)
         repl();
     else if (argc == 2)
         runFile(argv[1]);
     else
-        fprintf(stderr, "Usage: psim [path]");
+        fprintf(stderr, "Usage: psim [-r] [path]");
     freeVM();
     return 0;
     }
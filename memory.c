@@ -13,6 +13,56 @@
 #include "vm.h"
 #include "compiler.h"
 
+static void gcSafePoint(void);
+
+/*****************************************************************************\
+|* Object pools. Each size class owns a free list of recycled slots, and the
+|* unused tail of its current slab to bump-allocate from. Slabs are chained
+|* together so they can be released when the VM shuts down
+\*****************************************************************************/
+typedef struct PoolSlot
+    {
+    struct PoolSlot* next;          // Next free slot in this size class
+    } PoolSlot;
+
+typedef struct PoolSlab
+    {
+    struct PoolSlab* next;          // Next slab allocated, of any class
+    } PoolSlab;
+
+typedef struct
+    {
+    PoolSlot* freeList;             // Slots returned by freed objects
+    char* bump;                     // Next never-used slot in current slab
+    char* end;                      // End of the current slab
+    } Pool;
+
+#define POOL_CLASSES        (POOL_MAX_SIZE / POOL_GRANULE)
+
+static Pool pools[POOL_CLASSES];    // One pool per size class
+static PoolSlab* slabs = NULL;      // Every slab, so we can free them
+
+/*****************************************************************************\
+|* Helper function: Keep the heap accounting up to date, and give the GC a
+|* chance to run before the heap grows
+\*****************************************************************************/
+static void accountFor(size_t oldSize, size_t newSize)
+    {
+    vm.bytesAllocated += newSize - oldSize;
+    
+    if (newSize > oldSize)
+        {
+        vm.nurseryBytes += newSize - oldSize;
+        
+        #ifdef DEBUG_STRESS_GC
+            collectGarbage();
+        #endif
+
+        if (vm.nurseryBytes > vm.nurserySize)
+            gcSafePoint();
+        }
+    }
+
 /*****************************************************************************\
 |* Reallocate memory. 4 cases to consider:
 |*
@@ -24,10 +74,7 @@
 \*****************************************************************************/
 void* reallocate(void* pointer, size_t oldSize, size_t newSize)
     {
-    #ifdef DEBUG_STRESS_GC
-        if (newSize > oldSize)
-            collectGarbage();
-    #endif
+    accountFor(oldSize, newSize);
 
     if (newSize == 0)
         {
@@ -44,6 +91,94 @@ void* reallocate(void* pointer, size_t oldSize, size_t newSize)
     return result;
     }
 
+/*****************************************************************************\
+|* Allocate the memory for an object. Small objects come from the size-class
+|* pools: reusing a freed slot if there is one, else bumping a pointer
+\*****************************************************************************/
+void* allocateObjectMemory(size_t size)
+    {
+    #ifdef DEBUG_NO_OBJECT_POOLS
+        return reallocate(NULL, 0, size);
+    #else
+        if (size > POOL_MAX_SIZE)
+            return reallocate(NULL, 0, size);
+    
+        accountFor(0, size);
+        
+        Pool* pool = &pools[(size - 1) / POOL_GRANULE];
+        if (pool->freeList != NULL)
+            {
+            PoolSlot* slot  = pool->freeList;
+            pool->freeList  = slot->next;
+            return slot;
+            }
+        
+        size_t slotSize = ((size - 1) / POOL_GRANULE + 1) * POOL_GRANULE;
+        if (pool->bump + slotSize > pool->end)
+            {
+            // Start a new slab, keeping the objects granule-aligned
+            PoolSlab* slab = (PoolSlab*)malloc(POOL_SLAB_SIZE);
+            if (slab == NULL)
+                {
+                perror("Couldn't allocate object pool");
+                exit(1);
+                }
+            slab->next  = slabs;
+            slabs       = slab;
+            pool->bump  = (char*)slab + POOL_GRANULE;
+            pool->end   = (char*)slab + POOL_SLAB_SIZE;
+            }
+        
+        void* result = pool->bump;
+        pool->bump  += slotSize;
+        return result;
+    #endif
+    }
+
+/*****************************************************************************\
+|* Release the memory for an object, returning small ones to their pool
+\*****************************************************************************/
+void freeObjectMemory(void* pointer, size_t size)
+    {
+    #ifdef DEBUG_NO_OBJECT_POOLS
+        reallocate(pointer, size, 0);
+    #else
+        if (size > POOL_MAX_SIZE)
+            {
+            reallocate(pointer, size, 0);
+            return;
+            }
+        
+        accountFor(size, 0);
+        
+        Pool* pool      = &pools[(size - 1) / POOL_GRANULE];
+        PoolSlot* slot  = (PoolSlot*)pointer;
+        slot->next      = pool->freeList;
+        pool->freeList  = slot;
+    #endif
+    }
+
+/*****************************************************************************\
+|* Release all the slabs used by the object pools. Every object allocated
+|* from them must already have been freed
+\*****************************************************************************/
+void freePools(void)
+    {
+    while (slabs != NULL)
+        {
+        PoolSlab* next = slabs->next;
+        free(slabs);
+        slabs = next;
+        }
+    
+    for (int i = 0; i < POOL_CLASSES; i++)
+        {
+        pools[i].freeList   = NULL;
+        pools[i].bump       = NULL;
+        pools[i].end        = NULL;
+        }
+    }
+
 /*****************************************************************************\
 |* Free an object
 \*****************************************************************************/
@@ -56,18 +191,17 @@ static void freeObject(Obj* object)
     switch (object->type)
         {
         case OBJ_BOUND_METHOD:
-            FREE(ObjBoundMethod, object);
+            FREE_OBJ(ObjBoundMethod, object);
             break;
 
         case OBJ_NATIVE:
-            FREE(ObjNative, object);
+            FREE_OBJ(ObjNative, object);
             break;
 
         case OBJ_STRING:
             {
             ObjString* string = (ObjString*)object;
-            FREE_ARRAY(char, string->chars, string->length + 1);
-            FREE(ObjString, object);
+            freeObjectMemory(object, sizeof(ObjString) + string->length + 1);
             break;
             }
 
@@ -75,7 +209,8 @@ static void freeObject(Obj* object)
             {
             ObjFunction* function = (ObjFunction*)object;
             freeChunk(&function->chunk);
-            FREE(ObjFunction, object);
+            freeRegisterCode(function->registers);
+            FREE_OBJ(ObjFunction, object);
             break;
             }
 
@@ -83,27 +218,56 @@ static void freeObject(Obj* object)
             {
             ObjClosure* closure = (ObjClosure*)object;
             FREE_ARRAY(ObjUpvalue*, closure->upvalues, closure->upvalueCount);
-            FREE(ObjClosure, object);
+            FREE_OBJ(ObjClosure, object);
             break;
             }
             
         case OBJ_UPVALUE:
-            FREE(ObjUpvalue, object);
+            FREE_OBJ(ObjUpvalue, object);
             break;
         
         case OBJ_CLASS:
             {
             ObjClass* klass = (ObjClass*)object;
             freeTable(&klass->methods);
-            FREE(ObjClass, object);
+            FREE_OBJ(ObjClass, object);
             break;
             }
             
         case OBJ_INSTANCE:
             {
             ObjInstance* instance = (ObjInstance*)object;
-            freeTable(&instance->fields);
-            FREE(ObjInstance, object);
+            FREE_ARRAY(Value, instance->fields, instance->fieldCapacity);
+            FREE_OBJ(ObjInstance, object);
+            break;
+            }
+            
+        case OBJ_SHAPE:
+            {
+            ObjShape* shape = (ObjShape*)object;
+            freeTable(&shape->slots);
+            freeTable(&shape->transitions);
+            FREE_OBJ(ObjShape, object);
+            break;
+            }
+            
+        case OBJ_INTEGER:
+            FREE_OBJ(ObjInteger, object);
+            break;
+
+        case OBJ_SIGNAL:
+            {
+            ObjSignal* signal = (ObjSignal*)object;
+            freeObjectMemory(object, sizeof(ObjSignal)
+                                     + 2 * SIGNAL_WORDS(signal->width)
+                                         * sizeof(uint64_t));
+            break;
+            }
+
+        case OBJ_MEMORY:
+            {
+            freeMemoryPages((ObjMemory*)object);
+            FREE_OBJ(ObjMemory, object);
             break;
             }
        }
@@ -115,6 +279,22 @@ static void freeObject(Obj* object)
 void freeObjects(void)
     {
     Obj* object = vm.objects;
+    while (object != NULL)
+        {
+        Obj* next = object->next;
+        freeObject(object);
+        object = next;
+        }
+    
+    object = vm.youngObjects;
+    while (object != NULL)
+        {
+        Obj* next = object->next;
+        freeObject(object);
+        object = next;
+        }
+    
+    object = vm.sweepList;
     while (object != NULL)
         {
         Obj* next = object->next;
@@ -123,6 +303,15 @@ void freeObjects(void)
         }
     }
 
+/*****************************************************************************\
+|* GC Help: Mark an array of objects
+\*****************************************************************************/
+static void markArray(ValueArray* array)
+    {
+    for (int i = 0; i < array->count; i++)
+        markValue(array->values[i]);
+    }
+
 /*****************************************************************************\
 |* GC Help: Mark all the active root objects
 \*****************************************************************************/
@@ -132,8 +321,13 @@ static void markRoots(void)
     for (Value* slot = vm.stack; slot < vm.stackTop; slot++)
         markValue(*slot);
     
-    // Keys and Values within hashtables
-    markTable(&vm.globals);
+    // Global variables, and the names of their slots
+    markTable(&vm.globalNames);
+    markArray(&vm.globalValues);
+    markArray(&vm.globalSlotNames);
+
+    // Actions waiting on simulated time
+    markScheduler(&vm.scheduler);
 
     // Stack frames
     for (int i = 0; i < vm.frameCount; i++)
@@ -149,12 +343,17 @@ static void markRoots(void)
     }
 
 /*****************************************************************************\
-|* GC Help: Mark an array of objects
+|* GC Help: Mark the shapes and methods held in a chunk's inline caches
 \*****************************************************************************/
-static void markArray(ValueArray* array)
+static void markInlineCaches(Chunk* chunk)
     {
-    for (int i = 0; i < array->count; i++)
-        markValue(array->values[i]);
+    for (int i = 0; i < chunk->cacheCount; i++)
+        for (int j = 0; j < IC_WAYS; j++)
+            {
+            InlineCacheEntry* entry = &chunk->caches[i].entries[j];
+            markObject(entry->shape);
+            markObject(entry->target);
+            }
     }
 
 /*****************************************************************************\
@@ -182,7 +381,19 @@ static void blackenObject(Obj* object)
             {
             ObjInstance* instance = (ObjInstance*)object;
             markObject((Obj*)instance->klass);
-            markTable(&instance->fields);
+            markObject((Obj*)instance->shape);
+            for (int i = 0; i < instance->shape->slotCount; i++)
+                markValue(instance->fields[i]);
+            break;
+            }
+            
+        case OBJ_SHAPE:
+            {
+            ObjShape* shape = (ObjShape*)object;
+            markObject((Obj*)shape->parent);
+            markObject((Obj*)shape->name);
+            markTable(&shape->slots);
+            markTable(&shape->transitions);
             break;
             }
            
@@ -190,6 +401,7 @@ static void blackenObject(Obj* object)
             {
             ObjClass* klass = (ObjClass*)object;
             markObject((Obj*)klass->name);
+            markObject((Obj*)klass->rootShape);
             markTable(&klass->methods);
             break;
             }
@@ -208,6 +420,7 @@ static void blackenObject(Obj* object)
             ObjFunction* function = (ObjFunction*)object;
             markObject((Obj*)function->name);
             markArray(&function->chunk.constants);
+            markInlineCaches(&function->chunk);
             break;
             }
         
@@ -217,73 +430,354 @@ static void blackenObject(Obj* object)
 
         case OBJ_NATIVE:
         case OBJ_STRING:
+        case OBJ_INTEGER:
+        case OBJ_SIGNAL:
+        case OBJ_MEMORY:
             break;  // nothing to do
         }
     }
 
 /*****************************************************************************\
-|* GC Help: Use the roots to find references we care about
+|* GC Help: Blacken gray objects until only 'floor' are left on the gray stack
+|* or the budget runs out. Returns the unused budget
 \*****************************************************************************/
-static void traceReferences(void)
+static size_t traceReferences(int floor, size_t budget)
     {
-    while (vm.grayCount > 0)
+    while ((vm.grayCount > floor) && (budget > 0))
         {
         Obj* object = vm.grayStack[--vm.grayCount];
         blackenObject(object);
+        budget --;
         }
+    return budget;
     }
 
+/*****************************************************************************\
+|* GC Help: Put an object on the gray stack, the work-list of objects that are
+|* known to be live but whose references haven't been traced yet
+\*****************************************************************************/
+static void grayObject(Obj* object)
+    {
+    object->isMarked = true;
+
+    if (vm.grayCapacity < vm.grayCount + 1)
+        {
+        vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
+        vm.grayStack    = (Obj**)realloc(vm.grayStack,
+                                  sizeof(Obj*) * vm.grayCapacity);
+
+        if (vm.grayStack == NULL)
+            {
+            perror("Cannot allocate GC space");
+            exit(1);
+            }
+        }
+
+    vm.grayStack[vm.grayCount++] = object;
+    }
 
 /*****************************************************************************\
-|* GC Help: Free any object that wasn't marked to be kept
+|* GC Help: Free any old object that wasn't marked to be kept, visiting at most
+|* 'budget' objects of the list detached at the end of marking. Survivors are
+|* returned to vm.objects. Returns the unused budget
 \*****************************************************************************/
-static void sweep(void)
+static size_t sweep(size_t budget)
     {
-    Obj* previous = NULL;
-    Obj* object = vm.objects;
-  
-    while (object != NULL)
+    while ((vm.sweepList != NULL) && (budget > 0))
         {
+        Obj* object     = vm.sweepList;
+        vm.sweepList    = object->next;
+        
         if (object->isMarked)
             {
-            object->isMarked = false;
-            previous = object;
-            object = object->next;
+            object->isMarked    = false;
+            object->next        = vm.objects;
+            vm.objects          = object;
             }
         else
+            freeObject(object);
+        
+        budget --;
+        }
+    return budget;
+    }
+
+/*****************************************************************************\
+|* GC Help: Free any young object that wasn't marked to be kept, and promote
+|* the survivors into the old generation. While a major GC is marking, the
+|* survivors are grayed so it traces them too: they may be the only path to
+|* an old object it hasn't reached yet
+\*****************************************************************************/
+static void sweepNursery(void)
+    {
+    Obj* object = vm.youngObjects;
+  
+    while (object != NULL)
+        {
+        Obj* next = object->next;
+        
+        if (object->isMarked)
             {
-            Obj* unreached = object;
-            object = object->next;
-      
-            if (previous != NULL)
-                previous->next = object;
-            else
-                vm.objects = object;
-
-            freeObject(unreached);
+            object->isMarked    = false;
+            object->isOld       = true;
+            object->next        = vm.objects;
+            vm.objects          = object;
+            
+            if (vm.gcState == GC_MARKING)
+                grayObject(object);
             }
+        else
+            freeObject(object);
+        
+        object = next;
+        }
+    
+    vm.youngObjects = NULL;
+    }
+
+/*****************************************************************************\
+|* GC Help: Empty the remembered set. Every young object is promoted by the
+|* nursery sweep, so no old object points at a young one afterwards
+\*****************************************************************************/
+static void clearRememberedSet(void)
+    {
+    for (int i = 0; i < vm.rememberedCount; i++)
+        vm.rememberedSet[i]->isRemembered = false;
+    vm.rememberedCount = 0;
+    }
+
+/*****************************************************************************\
+|* GC Help: Start a major GC cycle by graying the roots. The incremental steps
+|* then only trace the old generation: young objects are left to minor GCs,
+|* which gray what they promote, and to finishMarking()
+\*****************************************************************************/
+static void startCycle(void)
+    {
+    #ifdef DEBUG_LOG_GC
+      printf("-- gc cycle begin\n");
+    #endif
+
+    vm.gcState      = GC_MARKING;
+    vm.gcMarkMode   = GC_MARK_OLD;
+    markRoots();
+    }
+
+/*****************************************************************************\
+|* GC Help: Finish marking in one atomic step. The roots aren't covered by the
+|* write barrier, so gray them again, and retrace the remembered objects
+|* since they can be the only path to young ones. Then everything reachable
+|* is marked, so the nursery can be swept and the old generation detached
+|* for sweeping in slices
+\*****************************************************************************/
+static void finishMarking(void)
+    {
+    vm.gcMarkMode = GC_MARK_ALL;
+    
+    markRoots();
+    for (int i = 0; i < vm.rememberedCount; i++)
+        {
+        vm.rememberedSet[i]->isMarked = true;
+        blackenObject(vm.rememberedSet[i]);
+        }
+    clearRememberedSet();
+    traceReferences(0, SIZE_MAX);
+    
+    tableRemoveWhite(&(vm.strings));
+    
+    // Detach first: the nursery sweep clears the marks on what it promotes
+    vm.gcState      = GC_SWEEPING;
+    vm.sweepList    = vm.objects;
+    vm.objects      = NULL;
+    sweepNursery();
+    }
+
+/*****************************************************************************\
+|* GC Help: End a major GC cycle and set the thresholds for the next one
+\*****************************************************************************/
+static void finishCycle(void)
+    {
+    vm.gcState      = GC_IDLE;
+    vm.gcMarkMode   = GC_MARK_ALL;
+    
+    // Let the heap grow in proportion to what survived before the next run
+    vm.nextGC = vm.bytesAllocated * vm.gcGrowFactor;
+    if (vm.nextGC < GC_INITIAL_THRESHOLD)
+        vm.nextGC = GC_INITIAL_THRESHOLD;
+    
+    #ifdef DEBUG_LOG_GC
+      printf("-- gc cycle end\n");
+      printf("   %zu bytes in use, next at %zu\n",
+             vm.bytesAllocated, vm.nextGC);
+    #endif
+    }
+
+/*****************************************************************************\
+|* GC Help: Do up to 'budget' objects' worth of the current major GC cycle
+\*****************************************************************************/
+static void gcStep(size_t budget)
+    {
+    if (vm.gcState == GC_MARKING)
+        {
+        budget = traceReferences(0, budget);
+        if (vm.grayCount > 0)
+            return;
+        finishMarking();
+        }
+    
+    if (vm.gcState == GC_SWEEPING)
+        {
+        sweep(budget);
+        if (vm.sweepList == NULL)
+            finishCycle();
         }
     }
 
 /*****************************************************************************\
-|* Perform garbage collection
+|* Perform garbage collection. Called as the heap grows: runs minor GCs, and
+|* starts and advances major GC cycles one slice at a time
+\*****************************************************************************/
+static void gcSafePoint(void)
+    {
+    collectNursery();
+    
+    if (vm.gcState == GC_IDLE)
+        {
+        if (vm.bytesAllocated > vm.nextGC)
+            startCycle();
+        }
+    else if (vm.bytesAllocated > vm.nextGC * vm.gcGrowFactor)
+        {
+        // The mutator is allocating faster than the slices can keep up,
+        // so finish the cycle rather than let the heap run away
+        gcStep(SIZE_MAX);
+        }
+    else
+        gcStep(vm.gcSliceBudget);
+    }
+
+/*****************************************************************************\
+|* Perform garbage collection of both generations, to completion
 \*****************************************************************************/
 void collectGarbage(void)
     {
     #ifdef DEBUG_LOG_GC
       printf("-- gc begin\n");
+      size_t before = vm.bytesAllocated;
     #endif
 
+    // Finish any cycle in progress, then run a whole new one
+    if (vm.gcState != GC_IDLE)
+        gcStep(SIZE_MAX);
+    
+    startCycle();
+    gcStep(SIZE_MAX);
+    vm.nurseryBytes = 0;
+
+    #ifdef DEBUG_LOG_GC
+      printf("-- gc end\n");
+      printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
+             before - vm.bytesAllocated, before, vm.bytesAllocated,
+             vm.nextGC);
+    #endif
+    }
+
+/*****************************************************************************\
+|* Perform a minor garbage collection, of the young generation only. Old
+|* objects are treated as live and are neither marked nor traced, except for
+|* those in the remembered set, which may be the only path to a young object.
+|* Any gray objects belonging to a major GC in progress are left alone
+\*****************************************************************************/
+void collectNursery(void)
+    {
+    #ifdef DEBUG_LOG_GC
+      printf("-- minor gc begin\n");
+      size_t before = vm.bytesAllocated;
+    #endif
+
+    GCMarkMode mode = vm.gcMarkMode;
+    int floor       = vm.grayCount;
+    vm.gcMarkMode   = GC_MARK_YOUNG;
+    
     markRoots();
-    traceReferences();
+    for (int i = 0; i < vm.rememberedCount; i++)
+        blackenObject(vm.rememberedSet[i]);
+    clearRememberedSet();
+    
+    traceReferences(floor, SIZE_MAX);
     tableRemoveWhite(&(vm.strings));
-    sweep();
+    
+    vm.gcMarkMode   = mode;
+    sweepNursery();
+    vm.nurseryBytes = 0;
 
     #ifdef DEBUG_LOG_GC
-      printf("-- gc end\n");
+      printf("-- minor gc end\n");
+      printf("   collected %zu bytes (from %zu to %zu)\n",
+             before - vm.bytesAllocated, before, vm.bytesAllocated);
     #endif
     }
 
+/*****************************************************************************\
+|* GC: Add an old object to the remembered set, so the next minor GC traces
+|* it. If a major GC is marking and has already traced it, trace it again
+\*****************************************************************************/
+void rememberObject(Obj* object)
+    {
+    if (!object->isOld)
+        return;
+    
+    if ((vm.gcState == GC_MARKING) && object->isMarked)
+        grayObject(object);
+
+    if (object->isRemembered)
+        return;
+    object->isRemembered = true;
+    
+    if (vm.rememberedCapacity < vm.rememberedCount + 1)
+        {
+        vm.rememberedCapacity   = GROW_CAPACITY(vm.rememberedCapacity);
+        vm.rememberedSet        = (Obj**)realloc(vm.rememberedSet,
+                                    sizeof(Obj*) * vm.rememberedCapacity);
+
+        if (vm.rememberedSet == NULL)
+            {
+            perror("Cannot allocate GC space");
+            exit(1);
+            }
+        }
+
+    vm.rememberedSet[vm.rememberedCount++] = object;
+    }
+
+/*****************************************************************************\
+|* GC: Write barrier slow path, for when 'object' has been stored into the
+|* old object 'owner'
+\*****************************************************************************/
+void barrierObject(Obj* owner, Obj* object)
+    {
+    if (!object->isOld)
+        {
+        if (!owner->isRemembered)
+            rememberObject(owner);
+        }
+    else if ((vm.gcState == GC_MARKING) && owner->isMarked)
+        {
+        // Never let a traced object point at an untraced one mid-cycle
+        markObject(object);
+        }
+    }
+
+/*****************************************************************************\
+|* GC: Return true if an object was not reached during the current collection.
+|* A minor GC never marks old objects, but they're still alive
+\*****************************************************************************/
+bool isWhite(Obj* object)
+    {
+    if ((vm.gcMarkMode == GC_MARK_YOUNG) && object->isOld)
+        return false;
+    return !object->isMarked;
+    }
+
 
 /*****************************************************************************\
 |* GC: Mark a value/object as a root
@@ -296,6 +790,13 @@ void markObject(Obj* object)
     // Prevent acyclic loops
     if (object->isMarked)
         return;
+    
+    // A minor GC stops at the old generation, and the incremental steps of a
+    // major GC leave the young generation to finishMarking()
+    if ((vm.gcMarkMode == GC_MARK_YOUNG) && object->isOld)
+        return;
+    if ((vm.gcMarkMode == GC_MARK_OLD) && !object->isOld)
+        return;
 
     #ifdef DEBUG_LOG_GC
         printf("%p mark ", (void*)object);
@@ -303,23 +804,8 @@ void markObject(Obj* object)
         printf("\n");
     #endif
 
-    object->isMarked = true;
-
     // Update the "gray" list, or work-queue of items to process
-    if (vm.grayCapacity < vm.grayCount + 1)
-        {
-        vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
-        vm.grayStack    = (Obj**)realloc(vm.grayStack,
-                                  sizeof(Obj*) * vm.grayCapacity);
-
-        if (vm.grayStack == NULL)
-            {
-            perror("Cannot allocate GC space");
-            exit(1);
-            }
-        }
-
-    vm.grayStack[vm.grayCount++] = object;
+    grayObject(object);
     }
 
 void markValue(Value value)
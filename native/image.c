@@ -0,0 +1,442 @@
+//
+//  image.c
+//  psim
+//
+//  Created by ThrudTheBarbarian on 16/10/2026.
+//
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "image.h"
+
+#include "object.h"
+
+// Longest record: a count byte, 4 address bytes, 255 data bytes and more
+#define RECORD_MAX          (1 + 4 + 255 + 1)
+
+/*****************************************************************************\
+|* Helper function: The size of a memory in bytes
+\*****************************************************************************/
+static size_t memoryBytes(ObjMemory* memory)
+    {
+    return (size_t)memory->size << memory->cellShift;
+    }
+
+/*****************************************************************************\
+|* Helper function: Check the arguments common to every image native, and
+|* return the memory, or NULL if they're wrong
+\*****************************************************************************/
+static ObjMemory* imageArgs(int argCount, Value* args, int extra)
+    {
+    if ((argCount < 2) || (argCount > 2 + extra))
+        return NULL;
+    if (!IS_MEMORY(args[0]) || !IS_STRING(args[1]))
+        return NULL;
+    for (int i = 2; i < argCount; i++)
+        if (!IS_INT(args[i]) || (AS_INT(args[i]) < 0))
+            return NULL;
+    return AS_MEMORY(args[0]);
+    }
+
+/*****************************************************************************\
+|* Helper function: Open a file, and get its length
+\*****************************************************************************/
+static int openImage(const char* path, size_t* length)
+    {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        {
+        fprintf(stderr, "Could not open file \"%s\".\n", path);
+        return -1;
+        }
+
+    struct stat info;
+    if (fstat(fd, &info) != 0)
+        {
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        close(fd);
+        return -1;
+        }
+
+    *length = (size_t)info.st_size;
+    return fd;
+    }
+
+/*****************************************************************************\
+|* Helper function: Map a text file read-only, to parse in place. An empty
+|* file maps to ""
+\*****************************************************************************/
+static const char* mapText(const char* path, size_t* length)
+    {
+    int fd = openImage(path, length);
+    if (fd < 0)
+        return NULL;
+
+    if (*length == 0)
+        {
+        close(fd);
+        return "";
+        }
+
+    void* text = mmap(NULL, *length, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (text == MAP_FAILED)
+        {
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        return NULL;
+        }
+    return (const char*)text;
+    }
+
+/*****************************************************************************\
+|* Helper function: Release a file mapped by mapText()
+\*****************************************************************************/
+static void unmapText(const char* text, size_t length)
+    {
+    if (length > 0)
+        munmap((void*)text, length);
+    }
+
+/*****************************************************************************\
+|* Helper function: Decode the pairs of hex digits from 'text' to the end of
+|* the line. Returns the number of bytes, or -1 if they aren't all hex, are
+|* an odd number of digits, or are too many. Leaves 'text' at the line end
+\*****************************************************************************/
+static int hexValue(char c)
+    {
+    if ((c >= '0') && (c <= '9'))
+        return c - '0';
+    if ((c >= 'A') && (c <= 'F'))
+        return c - 'A' + 10;
+    if ((c >= 'a') && (c <= 'f'))
+        return c - 'a' + 10;
+    return -1;
+    }
+
+static int decodeRecord(const char** text, const char* end, uint8_t* bytes)
+    {
+    const char* p   = *text;
+    int count       = 0;
+    bool valid      = true;
+
+    while ((p < end) && (*p != '\n') && (*p != '\r'))
+        {
+        int high    = hexValue(*p++);
+        int low     = ((p < end) && (*p != '\n') && (*p != '\r'))
+                    ? hexValue(*p++)
+                    : -1;
+        if ((high < 0) || (low < 0) || (count == RECORD_MAX))
+            valid   = false;
+        else
+            bytes[count++] = (uint8_t)((high << 4) | low);
+        }
+
+    *text = p;
+    return valid ? count : -1;
+    }
+
+/*****************************************************************************\
+|* Helper function: Store a record's data, if it fits
+\*****************************************************************************/
+static bool storeRecord(ObjMemory* memory,
+                        uint64_t address,
+                        const uint8_t* data,
+                        int count)
+    {
+    if (address + count > memoryBytes(memory))
+        return false;
+    memoryWrite(memory, (size_t)address, data, count);
+    return true;
+    }
+
+/*****************************************************************************\
+|* Helper function: Say why a text image couldn't be loaded
+\*****************************************************************************/
+static Value badRecord(const char* format, int line, const char* path)
+    {
+    fprintf(stderr, format, line, path);
+    return NIL_VAL;
+    }
+
+
+#pragma mark - Raw binary
+
+Value loadBinaryNative(int argCount, Value* args)
+    {
+    ObjMemory* memory   = imageArgs(argCount, args, 1);
+    if (memory == NULL)
+        return NIL_VAL;
+
+    const char* path    = AS_CSTRING(args[1]);
+    size_t offset       = (argCount > 2) ? (size_t)AS_INT(args[2]) : 0;
+    size_t length;
+    int fd              = openImage(path, &length);
+    if (fd < 0)
+        return NIL_VAL;
+
+    if ((offset > memoryBytes(memory))
+     || (length > memoryBytes(memory) - offset))
+        {
+        fprintf(stderr, "Image \"%s\" doesn't fit in the memory.\n", path);
+        close(fd);
+        return NIL_VAL;
+        }
+
+    bool loaded         = memoryMapFile(memory, offset, fd, length);
+    close(fd);
+    if (!loaded)
+        {
+        fprintf(stderr, "Could not read file \"%s\".\n", path);
+        return NIL_VAL;
+        }
+    return INT_VAL((int64_t)length);
+    }
+
+Value dumpBinaryNative(int argCount, Value* args)
+    {
+    ObjMemory* memory   = imageArgs(argCount, args, 2);
+    if ((memory == NULL) || (argCount == 3))
+        return NIL_VAL;
+
+    const char* path    = AS_CSTRING(args[1]);
+    size_t offset       = 0;
+    size_t length       = memoryBytes(memory);
+    if (argCount == 4)
+        {
+        offset          = (size_t)AS_INT(args[2]);
+        length          = (size_t)AS_INT(args[3]);
+        if ((offset > memoryBytes(memory))
+         || (length > memoryBytes(memory) - offset))
+            return NIL_VAL;
+        }
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL)
+        {
+        fprintf(stderr, "Could not write file \"%s\".\n", path);
+        return NIL_VAL;
+        }
+
+    // Copy out a batch of pages at a time. Untouched pages read as zeros
+    static uint8_t buffer[16 * MEMORY_PAGE_SIZE];
+    bool written = true;
+    for (size_t done = 0; written && (done < length); )
+        {
+        size_t count = length - done;
+        if (count > sizeof(buffer))
+            count    = sizeof(buffer);
+
+        memoryRead(memory, offset + done, buffer, count);
+        written      = fwrite(buffer, 1, count, file) == count;
+        done        += count;
+        }
+
+    if ((fclose(file) != 0) || !written)
+        {
+        fprintf(stderr, "Could not write file \"%s\".\n", path);
+        return NIL_VAL;
+        }
+    return INT_VAL((int64_t)length);
+    }
+
+
+#pragma mark - Intel HEX
+
+Value loadHexNative(int argCount, Value* args)
+    {
+    ObjMemory* memory   = imageArgs(argCount, args, 0);
+    if (memory == NULL)
+        return NIL_VAL;
+
+    const char* path    = AS_CSTRING(args[1]);
+    size_t length;
+    const char* text    = mapText(path, &length);
+    if (text == NULL)
+        return NIL_VAL;
+
+    const char* end     = text + length;
+    const char* p       = text;
+    uint64_t base       = 0;        // From extended address records
+    int64_t loaded      = 0;
+    int line            = 1;
+    Value result        = NIL_VAL;
+
+    for (;;)
+        {
+        // Skip blank lines, counting them
+        while ((p < end) && ((*p == '\n') || (*p == '\r')))
+            if (*p++ == '\n')
+                line++;
+        if (p == end)
+            {
+            result = badRecord("No end of file record by line %d of "
+                               "\"%s\".\n", line, path);
+            break;
+            }
+
+        uint8_t bytes[RECORD_MAX];
+        int count       = -1;
+        if (*p == ':')
+            {
+            p++;
+            count       = decodeRecord(&p, end, bytes);
+            }
+
+        // count, address (2), type, data..., checksum
+        uint8_t sum     = 0;
+        for (int i = 0; i < count; i++)
+            sum        += bytes[i];
+        if ((count < 5) || (bytes[0] != count - 5) || (sum != 0))
+            {
+            result = badRecord("Bad Intel HEX record on line %d of "
+                               "\"%s\".\n", line, path);
+            break;
+            }
+
+        uint16_t address    = (uint16_t)((bytes[1] << 8) | bytes[2]);
+        uint8_t* data       = &bytes[4];
+        int dataCount       = bytes[0];
+
+        bool valid          = true;
+        bool finished       = false;
+        switch (bytes[3])
+            {
+            case 0x00:      // Data
+                valid       = storeRecord(memory, base + address,
+                                          data, dataCount);
+                loaded     += dataCount;
+                break;
+
+            case 0x01:      // End of file
+                finished    = true;
+                break;
+
+            case 0x02:      // Extended segment address
+                valid       = (dataCount == 2);
+                base        = (uint64_t)((data[0] << 8) | data[1]) << 4;
+                break;
+
+            case 0x04:      // Extended linear address
+                valid       = (dataCount == 2);
+                base        = (uint64_t)((data[0] << 8) | data[1]) << 16;
+                break;
+
+            case 0x03:      // Start segment address
+            case 0x05:      // Start linear address
+                break;
+
+            default:
+                valid       = false;
+                break;
+            }
+
+        if (!valid)
+            {
+            result = badRecord("Bad Intel HEX record on line %d of "
+                               "\"%s\", or it doesn't fit in the memory.\n",
+                               line, path);
+            break;
+            }
+        if (finished)
+            {
+            result = INT_VAL(loaded);
+            break;
+            }
+        }
+
+    unmapText(text, length);
+    return result;
+    }
+
+
+#pragma mark - Motorola S-records
+
+Value loadSrecNative(int argCount, Value* args)
+    {
+    ObjMemory* memory   = imageArgs(argCount, args, 0);
+    if (memory == NULL)
+        return NIL_VAL;
+
+    const char* path    = AS_CSTRING(args[1]);
+    size_t length;
+    const char* text    = mapText(path, &length);
+    if (text == NULL)
+        return NIL_VAL;
+
+    // Bytes of address in each type of record, S0 to S9. There is no S4
+    static const int addressBytes[10] = { 2, 2, 3, 4, 0, 2, 3, 4, 3, 2 };
+
+    const char* end     = text + length;
+    const char* p       = text;
+    int64_t loaded      = 0;
+    int line            = 1;
+    Value result        = NIL_VAL;
+
+    for (;;)
+        {
+        while ((p < end) && ((*p == '\n') || (*p == '\r')))
+            if (*p++ == '\n')
+                line++;
+
+        // A file can just stop, with no termination record
+        if (p == end)
+            {
+            result = INT_VAL(loaded);
+            break;
+            }
+
+        uint8_t bytes[RECORD_MAX];
+        int type        = -1;
+        int count       = -1;
+        if ((*p == 'S') && (p + 1 < end) && (p[1] >= '0') && (p[1] <= '9'))
+            {
+            type        = p[1] - '0';
+            p          += 2;
+            count       = decodeRecord(&p, end, bytes);
+            }
+
+        // count, address..., data..., checksum
+        int address     = (type >= 0) ? addressBytes[type] : 0;
+        uint8_t sum     = 0;
+        for (int i = 0; i < count; i++)
+            sum        += bytes[i];
+        if ((type == 4)
+         || (count < 2 + address)
+         || (bytes[0] != count - 1)
+         || (sum != 0xFF))
+            {
+            result = badRecord("Bad S-record on line %d of \"%s\".\n",
+                               line, path);
+            break;
+            }
+
+        // S7, S8 and S9 end the data
+        if (type >= 7)
+            {
+            result = INT_VAL(loaded);
+            break;
+            }
+
+        if ((type >= 1) && (type <= 3))
+            {
+            uint64_t where  = 0;
+            for (int i = 0; i < address; i++)
+                where       = (where << 8) | bytes[1 + i];
+
+            int dataCount   = count - 2 - address;
+            if (!storeRecord(memory, where, &bytes[1 + address], dataCount))
+                {
+                result = badRecord("S-record on line %d of \"%s\" doesn't "
+                                   "fit in the memory.\n", line, path);
+                break;
+                }
+            loaded         += dataCount;
+            }
+        }
+
+    unmapText(text, length);
+    return result;
+    }
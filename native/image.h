@@ -0,0 +1,49 @@
+//
+//  image.h
+//  psim
+//
+//  Created by ThrudTheBarbarian on 16/10/2026.
+//
+
+#ifndef image_h
+#define image_h
+
+#include <stdio.h>
+
+#include "value.h"
+
+/*****************************************************************************\
+|* Memory images. Offsets and addresses are in bytes of the memory, which is
+|* the same as cells for a memory of bytes, and wider cells are stored
+|* little-endian. Each loader returns the number of bytes loaded, and each
+|* returns nil, after saying why, if the file can't be read, is malformed,
+|* or doesn't fit in the memory
+\*****************************************************************************/
+
+/*****************************************************************************\
+|* loadBinary(memory, path [, offset]): load a raw image at 'offset', or 0.
+|* The file is mapped copy-on-write rather than copied where it can be
+\*****************************************************************************/
+Value loadBinaryNative(int argCount, Value* args);
+
+/*****************************************************************************\
+|* loadHex(memory, path): load an Intel HEX file. Data, end of file and
+|* extended segment and linear address records are understood, and start
+|* address records are ignored
+\*****************************************************************************/
+Value loadHexNative(int argCount, Value* args);
+
+/*****************************************************************************\
+|* loadSrec(memory, path): load a Motorola S-record file. S1, S2 and S3 data
+|* records are loaded, and header, count and termination records ignored
+\*****************************************************************************/
+Value loadSrecNative(int argCount, Value* args);
+
+/*****************************************************************************\
+|* dumpBinary(memory, path [, offset, length]): write a raw image of the
+|* memory, or 'length' bytes of it from 'offset'. Returns the number of
+|* bytes written, or nil if the file couldn't be written
+\*****************************************************************************/
+Value dumpBinaryNative(int argCount, Value* args);
+
+#endif /* image_h */
@@ -6,6 +6,8 @@
 //
 
 #include "clock.h"
+#include "image.h"
+#include "sim.h"
 
 #include "vm.h"
 /*****************************************************************************\
@@ -15,6 +17,16 @@
 void installNativeFunctions(void)
     {
     defineNative("clock", clockNative);
+    defineNative("signal", signalNative);
+    defineNative("resolve", resolveNative);
+    defineNative("memory", memoryNative);
+    defineNative("loadBinary", loadBinaryNative);
+    defineNative("loadHex", loadHexNative);
+    defineNative("loadSrec", loadSrecNative);
+    defineNative("dumpBinary", dumpBinaryNative);
+    defineNative("schedule", scheduleNative);
+    defineNative("now", nowNative);
+    defineNative("stop", stopNative);
     }
 
 
@@ -0,0 +1,100 @@
+//
+//  sim.c
+//  psim
+//
+//  Created by ThrudTheBarbarian on 16/10/2026.
+//
+
+#include "sim.h"
+
+#include "logic.h"
+#include "vm.h"
+
+Value scheduleNative(int argCount, Value* args)
+    {
+    if (argCount != 2)
+        return BOOL_VAL(false);
+
+    SimTime delay;
+    if (IS_INT(args[0]) && (AS_INT(args[0]) >= 0))
+        delay = (SimTime)AS_INT(args[0]);
+    else if (IS_NUMBER(args[0])
+         &&  (AS_NUMBER(args[0]) >= 0)
+         &&  (AS_NUMBER(args[0]) < 18446744073709551616.0)
+         &&  (AS_NUMBER(args[0]) == (SimTime)AS_NUMBER(args[0])))
+        delay = (SimTime)AS_NUMBER(args[0]);
+    else
+        return BOOL_VAL(false);
+
+    return BOOL_VAL(scheduleEvent(&vm.scheduler, delay, args[1]));
+    }
+
+Value signalNative(int argCount, Value* args)
+    {
+    if ((argCount < 1)
+     || (argCount > 2)
+     || !IS_INT(args[0])
+     || (AS_INT(args[0]) < 1)
+     || (AS_INT(args[0]) > SIGNAL_MAX_WIDTH))
+        return NIL_VAL;
+
+    // Bit states, as the value and unknown planes
+    static const char* states   = "01zx";
+    int state                   = 0;
+    if (argCount == 2)
+        {
+        if (!IS_STRING(args[1]) || (AS_STRING(args[1])->length != 1))
+            return NIL_VAL;
+
+        const char* found = strchr(states, AS_CSTRING(args[1])[0]);
+        if ((found == NULL) || (*found == '\0'))
+            return NIL_VAL;
+        state = (int)(found - states);
+        }
+
+    ObjSignal* signal = newSignal((int)AS_INT(args[0]));
+    if (state != 0)
+        signalFill(signal, (state & 1) != 0, (state & 2) != 0);
+    return OBJ_VAL(signal);
+    }
+
+Value memoryNative(int argCount, Value* args)
+    {
+    if ((argCount < 1) || (argCount > 2) || !IS_INT(args[0]))
+        return NIL_VAL;
+
+    int64_t bits = 8;
+    if (argCount == 2)
+        {
+        if (!IS_INT(args[1]))
+            return NIL_VAL;
+        bits = AS_INT(args[1]);
+        }
+    if ((bits != 8) && (bits != 16) && (bits != 32) && (bits != 64))
+        return NIL_VAL;
+
+    int64_t size = AS_INT(args[0]);
+    if ((size < 1) || (size > MEMORY_MAX_BYTES / (bits / 8)))
+        return NIL_VAL;
+
+    return OBJ_VAL(newMemory(size, (int)(bits / 8)));
+    }
+
+Value resolveNative(int argCount, Value* args)
+    {
+    Value result;
+    if ((argCount != 2) || !signalResolve(args[0], args[1], &result))
+        return NIL_VAL;
+    return result;
+    }
+
+Value nowNative(int argCount, Value* args)
+    {
+    return INT_VAL((int64_t)vm.scheduler.now);
+    }
+
+Value stopNative(int argCount, Value* args)
+    {
+    clearEvents(&vm.scheduler);
+    return NIL_VAL;
+    }
@@ -0,0 +1,58 @@
+//
+//  sim.h
+//  psim
+//
+//  Created by ThrudTheBarbarian on 16/10/2026.
+//
+
+#ifndef sim_h
+#define sim_h
+
+#include <stdio.h>
+
+#include "value.h"
+
+/*****************************************************************************\
+|* schedule(delay, action): call 'action' with no arguments 'delay' ticks
+|* from now. Returns false, and schedules nothing, if 'delay' isn't a whole
+|* number of ticks
+\*****************************************************************************/
+Value scheduleNative(int argCount, Value* args);
+
+/*****************************************************************************\
+|* signal(width [, state]): a new signal or bus 'width' bits wide, with every
+|* bit in 'state', one of "0", "1", "x" or "z", or 0 if it's left out.
+|* Returns nil if 'width' isn't from 1 to SIGNAL_MAX_WIDTH, or 'state' isn't
+|* one of those
+\*****************************************************************************/
+Value signalNative(int argCount, Value* args);
+
+/*****************************************************************************\
+|* memory(size [, bits]): a new memory of 'size' cells, each 8, 16, 32 or 64
+|* bits wide, or 8 if 'bits' is left out. Every cell starts at 0. Returns nil
+|* if the arguments are out of range. A value stored is truncated to the cell
+|* width, and narrower cells read back unsigned, so -1 in an 8-bit cell reads
+|* as 255. A 64-bit cell reads back as a two's-complement signed integer,
+|* since there are no unsigned 64-bit integers, so -1 reads as -1
+\*****************************************************************************/
+Value memoryNative(int argCount, Value* args);
+
+/*****************************************************************************\
+|* resolve(a, b): the value of a bus driven by both 'a' and 'b', signals or
+|* integers, as a signal. Two integers resolve as 64-bit buses. Returns nil
+|* if either is anything else
+\*****************************************************************************/
+Value resolveNative(int argCount, Value* args);
+
+/*****************************************************************************\
+|* now(): the current simulated time, in ticks
+\*****************************************************************************/
+Value nowNative(int argCount, Value* args);
+
+/*****************************************************************************\
+|* stop(): drop every pending event, which ends the simulation once the
+|* current action returns
+\*****************************************************************************/
+Value stopNative(int argCount, Value* args);
+
+#endif /* sim_h */
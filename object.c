@@ -7,6 +7,7 @@
 
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
 
 #include "memory.h"
 #include "object.h"
@@ -16,6 +17,7 @@
 
 
 static void printFunction(ObjFunction* function);
+static void printSignal(ObjSignal* signal);
 
 /*****************************************************************************\
 |* Allocate space on the heap for an object
@@ -25,12 +27,15 @@ static void printFunction(ObjFunction* function);
 
 static Obj* allocateObject(size_t size, ObjType type)
     {
-    Obj* object         = (Obj*)reallocate(NULL, 0, size);
-    object->type        = type;
-    object->isMarked    = false;
-
-    object->next        = vm.objects;
-    vm.objects          = object;
+    Obj* object          = (Obj*)allocateObjectMemory(size);
+    object->type         = type;
+    object->isMarked     = false;
+    object->isOld        = false;
+    object->isRemembered = false;
+
+    // New objects always start out in the young generation
+    object->next         = vm.youngObjects;
+    vm.youngObjects      = object;
     
     #ifdef DEBUG_LOG_GC
         printf("%p allocate %zu for type %d\n", (void*)object, size, type);
@@ -77,19 +82,49 @@ void printObject(Value value)
         case OBJ_INSTANCE:
             printf("%s instance", AS_INSTANCE(value)->klass->name->chars);
             break;
+
+        case OBJ_SHAPE:
+            printf("shape");
+            break;
+
+        case OBJ_INTEGER:
+            printf(INT_FORMAT_STRING, ((ObjInteger*)AS_OBJ(value))->value);
+            break;
+
+        case OBJ_SIGNAL:
+            printSignal(AS_SIGNAL(value));
+            break;
+
+        case OBJ_MEMORY:
+            printf("<memory of %lld %d-bit cells>",
+                   (long long)AS_MEMORY(value)->size,
+                   8 << AS_MEMORY(value)->cellShift);
+            break;
        }
     }
 
 #pragma mark - Strings
 
 /*****************************************************************************\
-|* Helper function: Do the real allocation for a string
+|* Helper function: Do the real allocation for a string, with the characters
+|* inline after the header
 \*****************************************************************************/
-static ObjString* allocateString(char* chars, int length, uint32_t hash)
+static ObjString* allocateString(int length)
     {
-    ObjString* string   = ALLOCATE_OBJ(ObjString, OBJ_STRING);
+    ObjString* string   = (ObjString*)allocateObject(sizeof(ObjString)
+                                                     + length + 1,
+                                                     OBJ_STRING);
     string->length      = length;
-    string->chars       = chars;
+    string->hash        = 0;
+    string->chars[length] = '\0';
+    return string;
+    }
+
+/*****************************************************************************\
+|* Helper function: Add a string to the set of unique strings
+\*****************************************************************************/
+static ObjString* registerString(ObjString* string, uint32_t hash)
+    {
     string->hash        = hash;
     
     // Protect against GC
@@ -132,29 +167,34 @@ ObjString* copyString(const char* chars, int length)
     if (interned != NULL)
         return interned;
 
-    char* heapChars = ALLOCATE(char, length + 1);
-    memcpy(heapChars, chars, length);
-    heapChars[length]   = '\0';
+    ObjString* string   = allocateString(length);
+    memcpy(string->chars, chars, length);
 
-    return allocateString(heapChars, length, hash);
+    return registerString(string, hash);
     }
     
 /*****************************************************************************\
-|* Take a copy of a C string and put it into an ObjString. Takes ownership of
-|* the passed-in pointer
+|* Create a string with room for 'length' characters, for the caller to fill
+|* in place. It must then be passed to internString() before use
 \*****************************************************************************/
-ObjString* takeString(char* chars, int length)
+ObjString* newString(int length)
     {
-    uint32_t hash       = hashString(chars, length);
-    ObjString* interned = tableFindString(&(vm.strings), chars, length,
-                                        hash);
+    return allocateString(length);
+    }
+
+/*****************************************************************************\
+|* Intern a string made by newString(). Returns the existing copy if there is
+|* one, in which case the new string is simply left for the GC
+\*****************************************************************************/
+ObjString* internString(ObjString* string)
+    {
+    uint32_t hash       = hashString(string->chars, string->length);
+    ObjString* interned = tableFindString(&(vm.strings), string->chars,
+                                          string->length, hash);
     if (interned != NULL)
-        {
-        FREE_ARRAY(char, chars, length + 1);
         return interned;
-        }
 
-    return allocateString(chars, length, hash);
+    return registerString(string, hash);
     }
 
 
@@ -168,7 +208,9 @@ ObjFunction* newFunction(void)
     ObjFunction* function   = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
     function->arity         = 0;
     function->upvalueCount  = 0;
+    function->maxSlots      = 0;
     function->name          = NULL;
+    function->registers     = NULL;
     
     initChunk(&function->chunk);
     return function;
@@ -240,14 +282,35 @@ ObjUpvalue* newUpvalue(Value* slot)
 
 #pragma mark - Classes and instances
 
+/*****************************************************************************\
+|* Create a new shape, one field on from its parent
+\*****************************************************************************/
+static ObjShape* newShape(ObjShape* parent, ObjString* name)
+    {
+    ObjShape* shape         = ALLOCATE_OBJ(ObjShape, OBJ_SHAPE);
+    shape->parent           = parent;
+    shape->name             = name;
+    shape->slotCount        = 0;
+    initTable(&shape->slots);
+    initTable(&shape->transitions);
+    return shape;
+    }
+
 /*****************************************************************************\
 |* Create a new class
 \*****************************************************************************/
 ObjClass* newClass(ObjString* name)
     {
+    // Protect against GC
+    ObjShape* rootShape     = newShape(NULL, NULL);
+    push(OBJ_VAL(rootShape));
+    
     ObjClass* klass         = ALLOCATE_OBJ(ObjClass, OBJ_CLASS);
     klass->name             = name;
+    klass->rootShape        = rootShape;
     initTable(&klass->methods);
+    
+    pop();
     return klass;
     }
 
@@ -258,7 +321,9 @@ ObjInstance* newInstance(ObjClass* klass)
     {
     ObjInstance* instance   = ALLOCATE_OBJ(ObjInstance, OBJ_INSTANCE);
     instance->klass         = klass;
-    initTable(&instance->fields);
+    instance->shape         = klass->rootShape;
+    instance->fieldCapacity = 0;
+    instance->fields        = NULL;
     return instance;
     }
 
@@ -272,3 +337,454 @@ ObjBoundMethod* newBoundMethod(Value receiver, ObjClosure* method)
     bound->method           = method;
     return bound;
     }
+
+
+#pragma mark - Shapes
+
+/*****************************************************************************\
+|* Return the slot holding a field in a shape, or -1 if it has no such field
+\*****************************************************************************/
+int shapeSlot(ObjShape* shape, ObjString* name)
+    {
+    Value slot;
+    if (!tableGet(&shape->slots, name, &slot))
+        return -1;
+    return (int)AS_NUMBER(slot);
+    }
+
+/*****************************************************************************\
+|* Return the shape reached by adding a field to a shape, creating it the
+|* first time that transition is taken
+\*****************************************************************************/
+ObjShape* shapeTransition(ObjShape* shape, ObjString* name)
+    {
+    Value child;
+    if (tableGet(&shape->transitions, name, &child))
+        return AS_SHAPE(child);
+
+    // Protect against GC
+    ObjShape* result    = newShape(shape, name);
+    push(OBJ_VAL(result));
+    
+    tableAddAll(&shape->slots, &result->slots);
+    tableSet(&result->slots, name, NUMBER_VAL(shape->slotCount));
+    result->slotCount   = shape->slotCount + 1;
+
+    tableSet(&shape->transitions, name, OBJ_VAL(result));
+    writeBarrier((Obj*)shape, OBJ_VAL(result));
+    
+    // relinquish the protection
+    pop();
+    return result;
+    }
+
+/*****************************************************************************\
+|* Add a new field to an instance, moving it on to 'shape', which must be the
+|* transition from its current shape for that field
+\*****************************************************************************/
+void instanceAddField(ObjInstance* instance, ObjShape* shape, Value value)
+    {
+    int slot = instance->shape->slotCount;
+    if (instance->fieldCapacity < slot + 1)
+        {
+        // Most instances only have a handful of fields, so start small
+        int oldCapacity         = instance->fieldCapacity;
+        int capacity            = oldCapacity < 4 ? 4 : oldCapacity * 2;
+        instance->fields        = GROW_ARRAY(Value,
+                                             instance->fields,
+                                             oldCapacity,
+                                             capacity);
+        instance->fieldCapacity = capacity;
+        }
+
+    instance->fields[slot]  = value;
+    instance->shape         = shape;
+    writeBarrier((Obj*)instance, OBJ_VAL(shape));
+    writeBarrier((Obj*)instance, value);
+    }
+
+
+#pragma mark - Integers
+
+#ifdef NAN_BOXING
+
+/*****************************************************************************\
+|* Is a value an integer too wide to be held inline
+\*****************************************************************************/
+bool isBoxedInt(Value value)
+    {
+    return isObjType(value, OBJ_INTEGER);
+    }
+
+/*****************************************************************************\
+|* Get the integer out of a boxed integer
+\*****************************************************************************/
+int64_t boxedInt(Value value)
+    {
+    return ((ObjInteger*)AS_OBJ(value))->value;
+    }
+
+/*****************************************************************************\
+|* Box an integer too wide to be held inline
+\*****************************************************************************/
+Value boxInt(int64_t i)
+    {
+    ObjInteger* integer = ALLOCATE_OBJ(ObjInteger, OBJ_INTEGER);
+    integer->value      = i;
+    return OBJ_VAL(integer);
+    }
+
+#endif /* NAN_BOXING */
+
+
+#pragma mark - Signals
+
+/*****************************************************************************\
+|* Create a new signal 'width' bits wide, with every bit clear
+\*****************************************************************************/
+ObjSignal* newSignal(int width)
+    {
+    size_t size         = 2 * SIGNAL_WORDS(width) * sizeof(uint64_t);
+    ObjSignal* signal   = (ObjSignal*)allocateObject(sizeof(ObjSignal) + size,
+                                                     OBJ_SIGNAL);
+    signal->width       = width;
+    memset(signal->bits, 0, size);
+    return signal;
+    }
+
+/*****************************************************************************\
+|* Helper function: A mask of the low 'count' bits, for 'count' up to 64
+\*****************************************************************************/
+static inline uint64_t lowBits(int count)
+    {
+    return (count >= 64) ? UINT64_MAX : ((uint64_t)1 << count) - 1;
+    }
+
+/*****************************************************************************\
+|* Helper function: Read 'count' bits of a plane. A field can straddle two
+|* words
+\*****************************************************************************/
+static uint64_t readPlane(const uint64_t* plane, int low, int count)
+    {
+    int word        = low / 64;
+    int shift       = low % 64;
+
+    uint64_t value  = plane[word] >> shift;
+    if ((shift != 0) && (shift + count > 64))
+        value |= plane[word + 1] << (64 - shift);
+    return value & lowBits(count);
+    }
+
+/*****************************************************************************\
+|* Helper function: Write 'count' bits of a plane
+\*****************************************************************************/
+static void writePlane(uint64_t* plane, int low, int count, uint64_t value)
+    {
+    int word        = low / 64;
+    int shift       = low % 64;
+    uint64_t mask   = lowBits(count);
+
+    value          &= mask;
+    plane[word]     = (plane[word] & ~(mask << shift)) | (value << shift);
+    if ((shift != 0) && (shift + count > 64))
+        plane[word + 1] = (plane[word + 1] & ~(mask >> (64 - shift)))
+                        | (value >> (64 - shift));
+    }
+
+/*****************************************************************************\
+|* Read the 'count' bits from bit 'low' up, returning the value plane and
+|* setting 'unknown' to the unknown plane
+\*****************************************************************************/
+uint64_t signalRead(ObjSignal* signal, int low, int count, uint64_t* unknown)
+    {
+    *unknown = readPlane(SIGNAL_UNKNOWN(signal), low, count);
+    return readPlane(signal->bits, low, count);
+    }
+
+/*****************************************************************************\
+|* Write the 'count' bits from bit 'low' up, from the low bits of 'value'
+|* and 'unknown'
+\*****************************************************************************/
+void signalWrite(ObjSignal* signal,
+                 int low,
+                 int count,
+                 uint64_t value,
+                 uint64_t unknown)
+    {
+    writePlane(signal->bits, low, count, value);
+    writePlane(SIGNAL_UNKNOWN(signal), low, count, unknown);
+    }
+
+/*****************************************************************************\
+|* Copy one signal onto another, truncating or zero-extending to fit
+\*****************************************************************************/
+void signalCopy(ObjSignal* to, ObjSignal* from)
+    {
+    int toWords     = SIGNAL_WORDS(to->width);
+    int fromWords   = SIGNAL_WORDS(from->width);
+    int words       = (toWords < fromWords) ? toWords : fromWords;
+    uint64_t top    = lowBits(to->width - (toWords - 1) * 64);
+
+    uint64_t* toPlanes[2]   = { to->bits, SIGNAL_UNKNOWN(to) };
+    uint64_t* fromPlanes[2] = { from->bits, SIGNAL_UNKNOWN(from) };
+    for (int i = 0; i < 2; i++)
+        {
+        memmove(toPlanes[i], fromPlanes[i], words * sizeof(uint64_t));
+        memset(toPlanes[i] + words, 0, (toWords - words) * sizeof(uint64_t));
+        toPlanes[i][toWords - 1] &= top;
+        }
+    }
+
+/*****************************************************************************\
+|* Print a signal as a sized literal. Fully known signals are printed in
+|* hex, eg: 16'h01ff, and anything else in binary, eg: 4'b01xz
+\*****************************************************************************/
+static void printSignal(ObjSignal* signal)
+    {
+    int words           = SIGNAL_WORDS(signal->width);
+    uint64_t* unknown   = SIGNAL_UNKNOWN(signal);
+
+    bool known = true;
+    for (int i = 0; i < words; i++)
+        known = known && (unknown[i] == 0);
+
+    if (known)
+        {
+        printf("%d'h", signal->width);
+        for (int digit = (signal->width + 3) / 4 - 1; digit >= 0; digit--)
+            {
+            uint64_t word = signal->bits[digit / 16];
+            printf("%x", (unsigned)(word >> ((digit % 16) * 4)) & 0xF);
+            }
+        return;
+        }
+
+    printf("%d'b", signal->width);
+    for (int bit = signal->width - 1; bit >= 0; bit--)
+        {
+        int value   = (int)(signal->bits[bit / 64] >> (bit % 64)) & 1;
+        int state   = (int)(unknown[bit / 64] >> (bit % 64)) & 1;
+        putchar(state ? (value ? 'x' : 'z') : (value ? '1' : '0'));
+        }
+    }
+
+
+#pragma mark - Memories
+
+/*****************************************************************************\
+|* Create a new memory of 'size' cells, 'cellBytes' wide, all 0
+\*****************************************************************************/
+ObjMemory* newMemory(int64_t size, int cellBytes)
+    {
+    int cellShift = 0;
+    while ((1 << cellShift) < cellBytes)
+        cellShift++;
+
+    int64_t bytes       = size << cellShift;
+    int pageCount       = (int)((bytes + MEMORY_PAGE_SIZE - 1)
+                                 >> MEMORY_PAGE_SHIFT);
+    uint8_t** pages     = ALLOCATE(uint8_t*, pageCount);
+    for (int i = 0; i < pageCount; i++)
+        pages[i] = NULL;
+
+    ObjMemory* memory   = ALLOCATE_OBJ(ObjMemory, OBJ_MEMORY);
+    memory->size        = size;
+    memory->cellShift   = cellShift;
+    memory->pageCount   = pageCount;
+    memory->pages       = pages;
+    memory->mappingCount = 0;
+    memory->mappings    = NULL;
+    return memory;
+    }
+
+/*****************************************************************************\
+|* Helper function: Is a page part of a mapped image, rather than owned
+\*****************************************************************************/
+static bool isMappedPage(ObjMemory* memory, uint8_t* page)
+    {
+    for (int i = 0; i < memory->mappingCount; i++)
+        {
+        MemoryMapping* mapping = &memory->mappings[i];
+        if ((page >= mapping->base) && (page < mapping->base + mapping->length))
+            return true;
+        }
+    return false;
+    }
+
+/*****************************************************************************\
+|* Helper function: Get a page to store to, allocating it if need be
+\*****************************************************************************/
+static uint8_t* writablePage(ObjMemory* memory, size_t index)
+    {
+    if (memory->pages[index] == NULL)
+        {
+        memory->pages[index] = ALLOCATE(uint8_t, MEMORY_PAGE_SIZE);
+        memset(memory->pages[index], 0, MEMORY_PAGE_SIZE);
+        }
+    return memory->pages[index];
+    }
+
+/*****************************************************************************\
+|* Copy bytes into a memory, a page at a time
+\*****************************************************************************/
+void memoryWrite(ObjMemory* memory,
+                 size_t offset,
+                 const uint8_t* bytes,
+                 size_t length)
+    {
+    while (length > 0)
+        {
+        size_t within   = offset & (MEMORY_PAGE_SIZE - 1);
+        size_t count    = MEMORY_PAGE_SIZE - within;
+        if (count > length)
+            count       = length;
+
+        uint8_t* page   = writablePage(memory, offset >> MEMORY_PAGE_SHIFT);
+        memcpy(page + within, bytes, count);
+
+        offset         += count;
+        bytes          += count;
+        length         -= count;
+        }
+    }
+
+/*****************************************************************************\
+|* Copy bytes out of a memory, a page at a time
+\*****************************************************************************/
+void memoryRead(ObjMemory* memory,
+                size_t offset,
+                uint8_t* bytes,
+                size_t length)
+    {
+    while (length > 0)
+        {
+        size_t within   = offset & (MEMORY_PAGE_SIZE - 1);
+        size_t count    = MEMORY_PAGE_SIZE - within;
+        if (count > length)
+            count       = length;
+
+        uint8_t* page   = memory->pages[offset >> MEMORY_PAGE_SHIFT];
+        if (page == NULL)
+            memset(bytes, 0, count);
+        else
+            memcpy(bytes, page + within, count);
+
+        offset         += count;
+        bytes          += count;
+        length         -= count;
+        }
+    }
+
+/*****************************************************************************\
+|* Load an image file into a memory, mapping it where it lines up with the
+|* pages. A page the image only partly covers is mapped if it was empty,
+|* since the mapping reads as 0 past the end of the file, and otherwise the
+|* image is copied over what's already there
+\*****************************************************************************/
+bool memoryMapFile(ObjMemory* memory, size_t offset, int fd, size_t length)
+    {
+    if (length == 0)
+        return true;
+
+    uint8_t* base = (uint8_t*)mmap(NULL, length, PROT_READ | PROT_WRITE,
+                                   MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED)
+        return false;
+
+    // An image that doesn't start on a page boundary can only be copied
+    bool mapped = false;
+    if ((offset & (MEMORY_PAGE_SIZE - 1)) != 0)
+        memoryWrite(memory, offset, base, length);
+    else
+        for (size_t done = 0; done < length; done += MEMORY_PAGE_SIZE)
+            {
+            size_t count    = length - done;
+            if (count > MEMORY_PAGE_SIZE)
+                count       = MEMORY_PAGE_SIZE;
+
+            size_t index    = (offset + done) >> MEMORY_PAGE_SHIFT;
+            uint8_t* page   = memory->pages[index];
+            if ((count < MEMORY_PAGE_SIZE) && (page != NULL))
+                {
+                memoryWrite(memory, offset + done, base + done, count);
+                continue;
+                }
+
+            if ((page != NULL) && !isMappedPage(memory, page))
+                FREE_ARRAY(uint8_t, page, MEMORY_PAGE_SIZE);
+            memory->pages[index] = base + done;
+            mapped          = true;
+            }
+
+    if (!mapped)
+        {
+        munmap(base, length);
+        return true;
+        }
+
+    memory->mappings = GROW_ARRAY(MemoryMapping, memory->mappings,
+                                  memory->mappingCount,
+                                  memory->mappingCount + 1);
+    memory->mappings[memory->mappingCount].base     = base;
+    memory->mappings[memory->mappingCount].length   = length;
+    memory->mappingCount ++;
+    return true;
+    }
+
+/*****************************************************************************\
+|* Free a memory's pages and unmap any image files
+\*****************************************************************************/
+void freeMemoryPages(ObjMemory* memory)
+    {
+    for (int i = 0; i < memory->pageCount; i++)
+        {
+        uint8_t* page = memory->pages[i];
+        if ((page != NULL) && !isMappedPage(memory, page))
+            FREE_ARRAY(uint8_t, page, MEMORY_PAGE_SIZE);
+        }
+    FREE_ARRAY(uint8_t*, memory->pages, memory->pageCount);
+
+    for (int i = 0; i < memory->mappingCount; i++)
+        munmap(memory->mappings[i].base, memory->mappings[i].length);
+    FREE_ARRAY(MemoryMapping, memory->mappings, memory->mappingCount);
+    }
+
+/*****************************************************************************\
+|* Store the low bits of 'value' in a cell, allocating its page if need be
+\*****************************************************************************/
+void memoryStore(ObjMemory* memory, int64_t address, uint64_t value)
+    {
+    size_t offset   = (size_t)address << memory->cellShift;
+    size_t index    = offset >> MEMORY_PAGE_SHIFT;
+
+    // A store of 0 to an untouched page changes nothing
+    if ((memory->pages[index] == NULL) && (value == 0))
+        return;
+
+    uint8_t* cell   = writablePage(memory, index)
+                    + (offset & (MEMORY_PAGE_SIZE - 1));
+    switch (memory->cellShift)
+        {
+        case 0:
+            *cell = (uint8_t)value;
+            break;
+
+        case 1:
+            {
+            uint16_t cellValue = (uint16_t)value;
+            memcpy(cell, &cellValue, sizeof(cellValue));
+            break;
+            }
+
+        case 2:
+            {
+            uint32_t cellValue = (uint32_t)value;
+            memcpy(cell, &cellValue, sizeof(cellValue));
+            break;
+            }
+
+        default:
+            memcpy(cell, &value, sizeof(value));
+            break;
+        }
+    }
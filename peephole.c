@@ -0,0 +1,136 @@
+//
+//  peephole.c
+//  psim
+//
+//  Created by ThrudTheBarbarian on 16/10/2026.
+//
+
+#include "common.h"
+#include "object.h"
+#include "peephole.h"
+
+/*****************************************************************************\
+|* Helper function - return true if the chunk holds the given opcodes at the
+|* given offsets
+\*****************************************************************************/
+static bool opsAt(Chunk* chunk,
+                  int offset,
+                  const uint8_t* ops,
+                  const int* at,
+                  int count)
+    {
+    for (int i = 0; i < count; i++)
+        {
+        int where = offset + at[i];
+        if ((where >= chunk->count) || (chunk->code[where] != ops[i]))
+            return false;
+        }
+    return true;
+    }
+
+/*****************************************************************************\
+|* Helper function - fuse 'local = local + constant;' into OP_INC_LOCAL
+|*
+|*  +0 OP_GET_LOCAL a   +2 OP_CONSTANT k   +4 OP_ADD   +5 OP_SET_LOCAL a
+|*  +7 OP_POP
+\*****************************************************************************/
+static bool fuseIncLocal(Chunk* chunk, int offset)
+    {
+    static const uint8_t ops[] = {OP_GET_LOCAL, OP_CONSTANT, OP_ADD,
+                                  OP_SET_LOCAL, OP_POP};
+    static const int at[]      = {0, 2, 4, 5, 7};
+    
+    uint8_t* code = chunk->code + offset;
+    if (!opsAt(chunk, offset, ops, at, sizeof(ops)) || (code[1] != code[6]))
+        return false;
+    
+    code[0] = OP_INC_LOCAL;
+    return true;
+    }
+
+/*****************************************************************************\
+|* Helper function - fuse 'global = global + constant;' into OP_INC_GLOBAL
+|*
+|*  +0 OP_GET_GLOBAL s  +3 OP_CONSTANT k   +5 OP_ADD   +6 OP_SET_GLOBAL s
+|*  +9 OP_POP
+\*****************************************************************************/
+static bool fuseIncGlobal(Chunk* chunk, int offset)
+    {
+    static const uint8_t ops[] = {OP_GET_GLOBAL, OP_CONSTANT, OP_ADD,
+                                  OP_SET_GLOBAL, OP_POP};
+    static const int at[]      = {0, 3, 5, 6, 9};
+    
+    uint8_t* code = chunk->code + offset;
+    if (!opsAt(chunk, offset, ops, at, sizeof(ops))
+    ||  (code[1] != code[7]) || (code[2] != code[8]))
+        return false;
+    
+    code[0] = OP_INC_GLOBAL;
+    return true;
+    }
+
+/*****************************************************************************\
+|* Helper function - fuse 'local + constant' into OP_ADD_LOCAL_CONST
+|*
+|*  +0 OP_GET_LOCAL a   +2 OP_CONSTANT k   +4 OP_ADD
+\*****************************************************************************/
+static bool fuseAddLocalConst(Chunk* chunk, int offset)
+    {
+    static const uint8_t ops[] = {OP_GET_LOCAL, OP_CONSTANT, OP_ADD};
+    static const int at[]      = {0, 2, 4};
+    
+    if (!opsAt(chunk, offset, ops, at, sizeof(ops)))
+        return false;
+    
+    chunk->code[offset] = OP_ADD_LOCAL_CONST;
+    return true;
+    }
+
+/*****************************************************************************\
+|* Helper function - fuse a comparison used as a condition into a compare-
+|* and-jump. The jump's target must pop the condition, which the fused
+|* instruction never pushes, so it jumps one past that pop instead
+|*
+|*  +0 OP_LESS/OP_GREATER   +1 OP_JUMP_IF_FALSE offset   +4 OP_POP
+\*****************************************************************************/
+static bool fuseCompareJump(Chunk* chunk, int offset)
+    {
+    static const uint8_t ops[] = {OP_JUMP_IF_FALSE, OP_POP};
+    static const int at[]      = {1, 4};
+    
+    uint8_t* code = chunk->code + offset;
+    if ((code[0] != OP_LESS) && (code[0] != OP_GREATER))
+        return false;
+    if (!opsAt(chunk, offset, ops, at, sizeof(ops)))
+        return false;
+
+    int target = offset + 4 + ((code[2] << 8) | code[3]);
+    if ((target >= chunk->count) || (chunk->code[target] != OP_POP))
+        return false;
+    
+    code[0] = (code[0] == OP_LESS) ? OP_LESS_JUMP : OP_GREATER_JUMP;
+    return true;
+    }
+
+/*****************************************************************************\
+|* Fuse common instruction sequences in a compiled chunk into single
+|* superinstructions. The longest pattern is tried first, and the scan then
+|* carries on after the whole fused sequence
+\*****************************************************************************/
+void fuseSuperinstructions(Chunk* chunk)
+    {
+    int offset = 0;
+    while (offset < chunk->count)
+        {
+        if (fuseIncGlobal(chunk, offset))
+            offset += 10;
+        else if (fuseIncLocal(chunk, offset))
+            offset += 8;
+        else if (fuseAddLocalConst(chunk, offset))
+            offset += 5;
+        else if (fuseCompareJump(chunk, offset))
+            offset += 5;
+        else
+            offset += instructionLength(chunk, offset);
+        }
+    }
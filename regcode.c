@@ -0,0 +1,500 @@
+//
+//  regcode.c
+//  psim
+//
+//  Created by ThrudTheBarbarian on 16/10/2026.
+//
+
+#include <stdlib.h>
+
+#include "memory.h"
+#include "regcode.h"
+
+/*****************************************************************************\
+|* The translator runs the stack code symbolically. Each stack slot is the
+|* register with the same index, but a value isn't moved into its register
+|* until something needs it there: until then its operand says where the
+|* value really is, which lets 'local + constant' become a single R_ADD
+\*****************************************************************************/
+typedef enum
+    {
+    OPERAND_REGISTER,               // In its own register
+    OPERAND_LOCAL,                  // Same as another register, 'index'
+    OPERAND_CONSTANT                // Constant 'index' in the chunk
+    } OperandKind;
+
+typedef struct
+    {
+    OperandKind kind;               // Where the value is
+    int index;                      // Register or constant, as above
+    } Operand;
+
+#define MAX_REGISTERS   (2 * UINT8_COUNT)
+
+typedef struct
+    {
+    Chunk* chunk;                   // Stack code being translated
+    RegisterCode* out;              // Register code being generated
+    Operand stack[MAX_REGISTERS];   // Where each stack slot's value is
+    int depth;                      // Stack depth at the current insn
+    int maxDepth;                   // Deepest the stack ever gets
+    bool reachable;                 // Can control fall into this insn
+    int lastWrite;                  // Insn that made the top value, or -1
+    int* depthAt;                   // Stack depth at each jump target
+    bool* isTarget;                 // Whether each offset is jumped to
+    int* startOf;                   // Register insn for each stack offset
+    int* fixups;                    // Forward jumps: insn, target offset
+    int fixupCount;                 // Number of ints used in fixups
+    bool failed;                    // Translation isn't possible
+    } Translator;
+
+/*****************************************************************************\
+|* Helper function - append an instruction, returning its index
+\*****************************************************************************/
+static int emit(Translator* t, RegOpCode op, int a, int b, int c, int line)
+    {
+    RegisterCode* out = t->out;
+    if (out->capacity < out->count + 1)
+        {
+        int oldCapacity = out->capacity;
+        out->capacity   = GROW_CAPACITY(oldCapacity);
+        out->code       = GROW_ARRAY(RegInstruction,
+                                     out->code,
+                                     oldCapacity,
+                                     out->capacity);
+        out->lines      = GROW_ARRAY(int,
+                                     out->lines,
+                                     oldCapacity,
+                                     out->capacity);
+        }
+
+    RegInstruction* insn    = &out->code[out->count];
+    insn->op                = (uint16_t)op;
+    insn->a                 = (uint16_t)a;
+    insn->b                 = (uint16_t)b;
+    insn->c                 = (uint16_t)c;
+    out->lines[out->count]  = line;
+    return out->count++;
+    }
+
+/*****************************************************************************\
+|* Helper function - encode a stack slot's value as an RK operand
+\*****************************************************************************/
+static int rk(Translator* t, int slot)
+    {
+    Operand* operand = &t->stack[slot];
+    switch (operand->kind)
+        {
+        case OPERAND_LOCAL:
+            return operand->index;
+        case OPERAND_CONSTANT:
+            return RK_CONSTANT | operand->index;
+        default:
+            return slot;
+        }
+    }
+
+/*****************************************************************************\
+|* Helper function - move a stack slot's value into its own register
+\*****************************************************************************/
+static void materialize(Translator* t, int slot, int line)
+    {
+    if (t->stack[slot].kind == OPERAND_REGISTER)
+        return;
+
+    emit(t, R_MOVE, slot, rk(t, slot), 0, line);
+    t->stack[slot].kind = OPERAND_REGISTER;
+    }
+
+/*****************************************************************************\
+|* Helper function - move every stack value into its own register, as must
+|* be the case wherever control flow joins
+\*****************************************************************************/
+static void flush(Translator* t, int line)
+    {
+    for (int i = 0; i < t->depth; i++)
+        materialize(t, i, line);
+    }
+
+/*****************************************************************************\
+|* Helper function - push a value described by an operand
+\*****************************************************************************/
+static void pushOperand(Translator* t, OperandKind kind, int index)
+    {
+    if (t->depth >= MAX_REGISTERS - 1)
+        {
+        t->failed = true;
+        return;
+        }
+
+    t->stack[t->depth].kind     = kind;
+    t->stack[t->depth].index    = index;
+    t->depth++;
+    if (t->depth > t->maxDepth)
+        t->maxDepth = t->depth;
+    }
+
+/*****************************************************************************\
+|* Helper function - push the result of the instruction just emitted, which
+|* wrote it into the register for the new top of stack
+\*****************************************************************************/
+static void pushResult(Translator* t, int insn)
+    {
+    pushOperand(t, OPERAND_REGISTER, t->depth);
+    t->lastWrite = insn;
+    }
+
+/*****************************************************************************\
+|* Helper function - record a jump to a stack offset
+\*****************************************************************************/
+static void jumpTo(Translator* t, int insn, int target)
+    {
+    if (t->depthAt[target] < 0)
+        t->depthAt[target] = t->depth;
+
+    if (t->startOf[target] >= 0)
+        t->out->code[insn].b = (uint16_t)t->startOf[target];
+    else
+        {
+        t->fixups[t->fixupCount++] = insn;
+        t->fixups[t->fixupCount++] = target;
+        }
+    }
+
+/*****************************************************************************\
+|* Helper function - assign a local from the top of the stack. 'lastWrite' is
+|* the instruction that computed the top value, if it was the previous one
+\*****************************************************************************/
+static void setLocal(Translator* t, int local, int lastWrite, int line)
+    {
+    int top = t->depth - 1;
+
+    // Anything still waiting to read the old value must read it now
+    bool aliased = false;
+    for (int i = 0; i < top; i++)
+        if ((t->stack[i].kind == OPERAND_LOCAL)
+        &&  (t->stack[i].index == local))
+            {
+            materialize(t, i, line);
+            aliased = true;
+            }
+
+    // If the value was just computed, compute it straight into the local
+    RegisterCode* out = t->out;
+    if (!aliased
+    &&  (local != top)
+    &&  (t->stack[top].kind == OPERAND_REGISTER)
+    &&  (lastWrite >= 0)
+    &&  (lastWrite == out->count - 1)
+    &&  (out->code[lastWrite].a == top))
+        out->code[lastWrite].a = (uint16_t)local;
+    else if (rk(t, top) != local)
+        emit(t, R_MOVE, local, rk(t, top), 0, line);
+
+    t->stack[local].kind    = OPERAND_REGISTER;
+    t->stack[top].kind      = OPERAND_LOCAL;
+    t->stack[top].index     = local;
+    }
+
+/*****************************************************************************\
+|* Helper function - read a 16-bit operand
+\*****************************************************************************/
+static int readShort(uint8_t* code)
+    {
+    return (code[0] << 8) | code[1];
+    }
+
+/*****************************************************************************\
+|* Helper function - find the stack offsets that jumps land on
+\*****************************************************************************/
+static void findTargets(Translator* t)
+    {
+    Chunk* chunk = t->chunk;
+    for (int offset = 0; offset < chunk->count;)
+        {
+        uint8_t* code = chunk->code + offset;
+        
+        if ((code[0] == OP_JUMP) || (code[0] == OP_JUMP_IF_FALSE))
+            t->isTarget[offset + 3 + readShort(code + 1)] = true;
+        else if (code[0] == OP_LOOP)
+            t->isTarget[offset + 3 - readShort(code + 1)] = true;
+
+        offset += instructionLength(chunk, offset);
+        }
+    }
+
+/*****************************************************************************\
+|* Helper function - translate a single stack instruction
+\*****************************************************************************/
+static void translateInstruction(Translator* t, int offset)
+    {
+    uint8_t* code   = t->chunk->code + offset;
+    int line        = getLine(t->chunk, offset);
+    int top         = t->depth - 1;
+    int lastWrite   = t->lastWrite;
+    
+    t->lastWrite    = -1;
+
+    switch (code[0])
+        {
+        case OP_CONSTANT:
+            pushOperand(t, OPERAND_CONSTANT, code[1]);
+            break;
+
+        case OP_CONSTANT_LONG:
+            // RK operands only have room for 15 bits of constant index
+            if (readShort(code + 1) >= RK_CONSTANT)
+                t->failed = true;
+            else
+                pushOperand(t, OPERAND_CONSTANT, readShort(code + 1));
+            break;
+
+        case OP_NIL:
+            pushResult(t, emit(t, R_NIL, t->depth, 0, 0, line));
+            break;
+
+        case OP_TRUE:
+            pushResult(t, emit(t, R_TRUE, t->depth, 0, 0, line));
+            break;
+
+        case OP_FALSE:
+            pushResult(t, emit(t, R_FALSE, t->depth, 0, 0, line));
+            break;
+
+        case OP_POP:
+            t->depth--;
+            break;
+
+        case OP_GET_LOCAL:
+            materialize(t, code[1], line);
+            pushOperand(t, OPERAND_LOCAL, code[1]);
+            break;
+
+        case OP_GET_LOCAL_LONG:
+            materialize(t, readShort(code + 1), line);
+            pushOperand(t, OPERAND_LOCAL, readShort(code + 1));
+            break;
+
+        case OP_SET_LOCAL:
+            setLocal(t, code[1], lastWrite, line);
+            break;
+
+        case OP_SET_LOCAL_LONG:
+            setLocal(t, readShort(code + 1), lastWrite, line);
+            break;
+
+        case OP_GET_GLOBAL:
+            pushResult(t, emit(t,
+                               R_GET_GLOBAL,
+                               t->depth,
+                               readShort(code + 1),
+                               0,
+                               line));
+            break;
+
+        case OP_SET_GLOBAL:
+            emit(t, R_SET_GLOBAL, readShort(code + 1), rk(t, top), 0, line);
+            break;
+
+        case OP_DEFINE_GLOBAL:
+            emit(t, R_DEFINE_GLOBAL, readShort(code + 1), rk(t, top), 0, line);
+            t->depth--;
+            break;
+
+        case OP_EQUAL:
+        case OP_GREATER:
+        case OP_LESS:
+        case OP_ADD:
+        case OP_SUBTRACT:
+        case OP_MULTIPLY:
+        case OP_DIVIDE:
+            {
+            RegOpCode op    = R_EQUAL + (code[0] - OP_EQUAL);
+            int b           = rk(t, top - 1);
+            int c           = rk(t, top);
+            t->depth       -= 2;
+            pushResult(t, emit(t, op, t->depth, b, c, line));
+            break;
+            }
+
+        case OP_BIT_AND:
+        case OP_BIT_OR:
+        case OP_BIT_XOR:
+        case OP_SHIFT_LEFT:
+        case OP_SHIFT_RIGHT:
+            {
+            RegOpCode op    = R_BIT_AND + (code[0] - OP_BIT_AND);
+            int b           = rk(t, top - 1);
+            int c           = rk(t, top);
+            t->depth       -= 2;
+            pushResult(t, emit(t, op, t->depth, b, c, line));
+            break;
+            }
+
+        case OP_NOT:
+        case OP_NEGATE:
+        case OP_BIT_NOT:
+            {
+            RegOpCode op    = (code[0] == OP_NOT)    ? R_NOT
+                            : (code[0] == OP_NEGATE) ? R_NEGATE
+                                                     : R_BIT_NOT;
+            int b           = rk(t, top);
+            t->depth--;
+            pushResult(t, emit(t, op, t->depth, b, 0, line));
+            break;
+            }
+
+        case OP_PRINT:
+            emit(t, R_PRINT, rk(t, top), 0, 0, line);
+            t->depth--;
+            break;
+
+        case OP_JUMP:
+            flush(t, line);
+            jumpTo(t,
+                   emit(t, R_JUMP, 0, 0, 0, line),
+                   offset + 3 + readShort(code + 1));
+            t->reachable = false;
+            break;
+
+        case OP_JUMP_IF_FALSE:
+            flush(t, line);
+            jumpTo(t,
+                   emit(t, R_JUMP_IF_FALSE, top, 0, 0, line),
+                   offset + 3 + readShort(code + 1));
+            break;
+
+        case OP_LOOP:
+            flush(t, line);
+            jumpTo(t,
+                   emit(t, R_JUMP, 0, 0, 0, line),
+                   offset + 3 - readShort(code + 1));
+            t->reachable = false;
+            break;
+
+        case OP_CALL:
+            {
+            flush(t, line);
+            int argCount    = code[1];
+            t->depth       -= argCount + 1;
+            emit(t, R_CALL, t->depth, argCount, 0, line);
+            pushOperand(t, OPERAND_REGISTER, t->depth);
+            break;
+            }
+
+        case OP_RETURN:
+            emit(t, R_RETURN, rk(t, top), 0, 0, line);
+            t->depth--;
+            t->reachable = false;
+            break;
+
+        default:
+            // Closures, upvalues, classes, properties... stay as stack code
+            t->failed = true;
+            break;
+        }
+    }
+
+/*****************************************************************************\
+|* Translate a function's stack bytecode into register code. Returns NULL if
+|* the function uses anything the register machine doesn't support (classes,
+|* closures, upvalues, properties...), in which case it stays as stack code
+\*****************************************************************************/
+RegisterCode* translateToRegisters(Chunk* chunk, int arity)
+    {
+    Translator t;
+    t.chunk         = chunk;
+    t.out           = ALLOCATE(RegisterCode, 1);
+    t.out->count    = 0;
+    t.out->capacity = 0;
+    t.out->code     = NULL;
+    t.out->lines    = NULL;
+    t.depth         = 0;
+    t.maxDepth      = 0;
+    t.reachable     = true;
+    t.lastWrite     = -1;
+    t.fixupCount    = 0;
+    t.failed        = false;
+    t.depthAt       = ALLOCATE(int, chunk->count);
+    t.isTarget      = ALLOCATE(bool, chunk->count);
+    t.startOf       = ALLOCATE(int, chunk->count);
+    t.fixups        = ALLOCATE(int, chunk->count * 2);
+    for (int i = 0; i < chunk->count; i++)
+        {
+        t.depthAt[i]    = -1;
+        t.isTarget[i]   = false;
+        t.startOf[i]    = -1;
+        }
+
+    // The closure and the parameters start out in their registers
+    for (int i = 0; i <= arity; i++)
+        pushOperand(&t, OPERAND_REGISTER, i);
+
+    findTargets(&t);
+    for (int offset = 0; (offset < chunk->count) && !t.failed;)
+        {
+        if (t.isTarget[offset])
+            {
+            int line = getLine(chunk, offset);
+            if (t.reachable)
+                {
+                flush(&t, line);
+                if ((t.depthAt[offset] >= 0) && (t.depthAt[offset] != t.depth))
+                    t.failed = true;
+                }
+            else if (t.depthAt[offset] >= 0)
+                t.depth = t.depthAt[offset];
+
+            for (int i = 0; i < t.depth; i++)
+                t.stack[i].kind = OPERAND_REGISTER;
+            t.lastWrite = -1;
+            t.reachable = true;
+            }
+
+        t.startOf[offset] = t.out->count;
+        translateInstruction(&t, offset);
+        offset += instructionLength(chunk, offset);
+
+        if (t.depth < 0)
+            t.failed = true;
+        }
+
+    // Patch the forward jumps, now that we know where they land
+    for (int i = 0; i < t.fixupCount; i += 2)
+        {
+        int target = t.startOf[t.fixups[i + 1]];
+        if (target < 0)
+            t.failed = true;
+        else
+            t.out->code[t.fixups[i]].b = (uint16_t)target;
+        }
+
+    if (t.out->count > UINT16_MAX)
+        t.failed = true;
+    t.out->registerCount = t.maxDepth;
+
+    FREE_ARRAY(int, t.depthAt, chunk->count);
+    FREE_ARRAY(bool, t.isTarget, chunk->count);
+    FREE_ARRAY(int, t.startOf, chunk->count);
+    FREE_ARRAY(int, t.fixups, chunk->count * 2);
+
+    if (t.failed)
+        {
+        freeRegisterCode(t.out);
+        return NULL;
+        }
+    return t.out;
+    }
+
+/*****************************************************************************\
+|* Free a function's register code
+\*****************************************************************************/
+void freeRegisterCode(RegisterCode* code)
+    {
+    if (code == NULL)
+        return;
+
+    FREE_ARRAY(RegInstruction, code->code, code->capacity);
+    FREE_ARRAY(int, code->lines, code->capacity);
+    FREE(RegisterCode, code);
+    }
@@ -15,17 +15,19 @@ typedef struct
     {
     const char* start;          // beginning of current lexeme being scanned
     const char* current;        // current point within lexeme being scanned
+    const char* end;            // one past the last character of the source
     int line;
     } Scanner;
 
 Scanner scanner;
 
 /*****************************************************************************\
-|* Helper function - are we at the end of the source
+|* Helper function - are we at the end of the source. The source is a range
+|* rather than a C string, so it needn't be NUL-terminated
 \*****************************************************************************/
 static bool isAtEnd(void)
     {
-    return *(scanner.current) == '\0';
+    return scanner.current >= scanner.end;
     }
 
 /*****************************************************************************\
@@ -68,6 +70,8 @@ static char advance(void)
 \*****************************************************************************/
 static char peek(void)
     {
+    if (isAtEnd())
+        return '\0';
     return *scanner.current;
     }
 
@@ -76,7 +80,7 @@ static char peek(void)
 \*****************************************************************************/
 static char peekNext(void)
     {
-    if (isAtEnd())
+    if (scanner.current + 1 >= scanner.end)
         return '\0';
     return scanner.current[1];
     }
@@ -156,12 +160,43 @@ static Token string(void)
     return makeToken(TOKEN_STRING);
     }
 
+/*****************************************************************************\
+|* Character classes, so the scanner's inner loops need one table lookup per
+|* character rather than a chain of range tests
+\*****************************************************************************/
+#define CHAR_DIGIT      0x01        // 0-9
+#define CHAR_ALPHA      0x02        // a-z, A-Z and _
+
+#define DIGITS_10(c)    [c] = CHAR_DIGIT, [c + 1] = CHAR_DIGIT,              \
+                        [c + 2] = CHAR_DIGIT, [c + 3] = CHAR_DIGIT,          \
+                        [c + 4] = CHAR_DIGIT, [c + 5] = CHAR_DIGIT,          \
+                        [c + 6] = CHAR_DIGIT, [c + 7] = CHAR_DIGIT,          \
+                        [c + 8] = CHAR_DIGIT, [c + 9] = CHAR_DIGIT
+#define ALPHA_2(c)      [c] = CHAR_ALPHA, [c + 1] = CHAR_ALPHA
+#define ALPHA_26(c)     ALPHA_2(c), ALPHA_2(c + 2), ALPHA_2(c + 4),          \
+                        ALPHA_2(c + 6), ALPHA_2(c + 8), ALPHA_2(c + 10),     \
+                        ALPHA_2(c + 12), ALPHA_2(c + 14), ALPHA_2(c + 16),   \
+                        ALPHA_2(c + 18), ALPHA_2(c + 20), ALPHA_2(c + 22),   \
+                        ALPHA_2(c + 24)
+
+static const uint8_t charClass[256] =
+    {
+    DIGITS_10('0'),
+    ALPHA_26('a'),
+    ALPHA_26('A'),
+    ['_'] = CHAR_ALPHA,
+    };
+
+#undef DIGITS_10
+#undef ALPHA_2
+#undef ALPHA_26
+
 /*****************************************************************************\
 |* Helper function - Is a character a decimal digit
 \*****************************************************************************/
 static bool isDigit(char c)
     {
-    return c >= '0' && c <= '9';
+    return (charClass[(uint8_t)c] & CHAR_DIGIT) != 0;
     }
 
 /*****************************************************************************\
@@ -169,9 +204,7 @@ static bool isDigit(char c)
 \*****************************************************************************/
 static bool isAlpha(char c)
     {
-    return (c >= 'a' && c <= 'z') ||
-           (c >= 'A' && c <= 'Z') ||
-           (c == '_');
+    return (charClass[(uint8_t)c] & CHAR_ALPHA) != 0;
     }
 
 /*****************************************************************************\
@@ -196,95 +229,112 @@ static Token number(void)
     }
 
 /*****************************************************************************\
-|* Helper function - check that the source matches the remaining constraints
-|* for something to be considered an identifier
+|* Keywords are found with a perfect hash. The table is generated the first
+|* time the scanner is used, by trying seeds until every keyword hashes to a
+|* slot of its own, so a keyword is added just by listing it here
 \*****************************************************************************/
-static TokenType checkKeyword(int start,
-                              int length,
-                              const char* rest,
-                              TokenType type)
+typedef struct
     {
-    bool matchLength = (scanner.current - scanner.start == start + length);
+    const char* name;
+    TokenType   type;
+    } Keyword;
 
-    if (matchLength && (memcmp(scanner.start + start, rest, length) == 0))
-        return type;
+static const Keyword keywords[] =
+    {
+    {"and",     TOKEN_AND},
+    {"class",   TOKEN_CLASS},
+    {"else",    TOKEN_ELSE},
+    {"false",   TOKEN_FALSE},
+    {"for",     TOKEN_FOR},
+    {"fun",     TOKEN_FUN},
+    {"if",      TOKEN_IF},
+    {"nil",     TOKEN_NIL},
+    {"or",      TOKEN_OR},
+    {"print",   TOKEN_PRINT},
+    {"return",  TOKEN_RETURN},
+    {"super",   TOKEN_SUPER},
+    {"this",    TOKEN_THIS},
+    {"true",    TOKEN_TRUE},
+    {"var",     TOKEN_VAR},
+    {"while",   TOKEN_WHILE},
+    };
+
+#define KEYWORD_COUNT   ((int)(sizeof(keywords) / sizeof(keywords[0])))
+#define KEYWORD_SLOTS   128         // Power of two, well above KEYWORD_COUNT
+
+static struct
+    {
+    bool        built;              // Has the table been generated yet
+    uint32_t    seed;               // Seed that makes the hash perfect
+    int         maxLength;          // Longest keyword, anything longer isn't
+    int8_t      slots[KEYWORD_SLOTS]; // Index into keywords[], or -1
+    } keywordTable;
 
-    return TOKEN_IDENTIFIER;
+/*****************************************************************************\
+|* Helper function - FNV-1a hash of a name, starting from the table's seed
+\*****************************************************************************/
+static uint32_t keywordHash(uint32_t seed, const char* name, int length)
+    {
+    uint32_t hash = 2166136261u ^ seed;
+    for (int i = 0; i < length; i++)
+        {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619;
+        }
+    return hash & (KEYWORD_SLOTS - 1);
     }
-    
+
 /*****************************************************************************\
-|* Helper function - Determine the identifier type. This uses nested switch
-|* statements to form a deterministic finite automaton. This is a very fast
-|* and relatively easy to maintain algorithm
+|* Helper function - generate the keyword table
 \*****************************************************************************/
-static TokenType identifierType(void)
+static void buildKeywordTable(void)
     {
-    switch (scanner.start[0])
+    for (uint32_t seed = 0; ; seed++)
         {
-        case 'a':
-            return checkKeyword(1, 2, "nd", TOKEN_AND);
-        
-        case 'c':
-            return checkKeyword(1, 4, "lass", TOKEN_CLASS);
+        bool perfect = true;
+        memset(keywordTable.slots, -1, sizeof(keywordTable.slots));
+        keywordTable.maxLength = 0;
         
-        case 'e':
-            return checkKeyword(1, 3, "lse", TOKEN_ELSE);
+        for (int i = 0; perfect && (i < KEYWORD_COUNT); i++)
+            {
+            int length  = (int)strlen(keywords[i].name);
+            uint32_t at = keywordHash(seed, keywords[i].name, length);
+            if (keywordTable.slots[at] >= 0)
+                perfect = false;
+            
+            keywordTable.slots[at] = (int8_t)i;
+            if (length > keywordTable.maxLength)
+                keywordTable.maxLength = length;
+            }
 
-        case 'f':
-            if (scanner.current - scanner.start > 1)
-                {
-                switch (scanner.start[1])
-                    {
-                    case 'a':
-                        return checkKeyword(2, 3, "lse", TOKEN_FALSE);
-                    
-                    case 'o':
-                        return checkKeyword(2, 1, "r", TOKEN_FOR);
-          
-                    case 'u':
-                        return checkKeyword(2, 1, "n", TOKEN_FUN);
-                    }
-                }
-            break;
-
-        case 'i':
-            return checkKeyword(1, 1, "f", TOKEN_IF);
-      
-        case 'n':
-            return checkKeyword(1, 2, "il", TOKEN_NIL);
-        
-        case 'o':
-            return checkKeyword(1, 1, "r", TOKEN_OR);
-        
-        case 'p':
-            return checkKeyword(1, 4, "rint", TOKEN_PRINT);
-        
-        case 'r':
-            return checkKeyword(1, 5, "eturn", TOKEN_RETURN);
-        
-        case 's':
-            return checkKeyword(1, 4, "uper", TOKEN_SUPER);
- 
-        case 't':
-            if (scanner.current - scanner.start > 1)
-                {
-                switch (scanner.start[1])
-                    {
-                    case 'h':
-                        return checkKeyword(2, 2, "is", TOKEN_THIS);
-                        
-                    case 'r':
-                        return checkKeyword(2, 2, "ue", TOKEN_TRUE);
-                    }
-                }
-            break;
-
-        case 'v':
-            return checkKeyword(1, 2, "ar", TOKEN_VAR);
-       
-        case 'w':
-            return checkKeyword(1, 4, "hile", TOKEN_WHILE);
+        if (perfect)
+            {
+            keywordTable.seed  = seed;
+            keywordTable.built = true;
+            return;
+            }
         }
+    }
+
+/*****************************************************************************\
+|* Helper function - Determine the identifier type. Only one keyword can hash
+|* to the identifier's slot, so at most one comparison is needed
+\*****************************************************************************/
+static TokenType identifierType(void)
+    {
+    int length = (int)(scanner.current - scanner.start);
+    if (length > keywordTable.maxLength)
+        return TOKEN_IDENTIFIER;
+    
+    uint32_t at = keywordHash(keywordTable.seed, scanner.start, length);
+    int index   = keywordTable.slots[at];
+    if (index < 0)
+        return TOKEN_IDENTIFIER;
+
+    const Keyword* keyword = &keywords[index];
+    if ((strncmp(keyword->name, scanner.start, length) == 0)
+    &&  (keyword->name[length] == '\0'))
+        return keyword->type;
 
     return TOKEN_IDENTIFIER;
     }
@@ -294,19 +344,23 @@ static TokenType identifierType(void)
 \*****************************************************************************/
 static Token identifier(void)
     {
-    while (isAlpha(peek()) || isDigit(peek()))
+    while (charClass[(uint8_t)peek()] & (CHAR_ALPHA | CHAR_DIGIT))
         advance();
     return makeToken(identifierType());
     }
 
 /*****************************************************************************\
-|* Initialise the sourcecode scanner
+|* Initialise the sourcecode scanner to read 'length' characters of 'source'
 \*****************************************************************************/
-void initScanner(const char* source)
+void initScanner(const char* source, size_t length)
     {
     scanner.start   = source;
     scanner.current = source;
+    scanner.end     = source + length;
     scanner.line    = 1;
+    
+    if (!keywordTable.built)
+        buildKeywordTable();
     }
 
 /*****************************************************************************\
@@ -347,6 +401,12 @@ Token scanToken(void)
         case '}':
             return makeToken(TOKEN_RIGHT_BRACE);
         
+        case '[':
+            return makeToken(TOKEN_LEFT_BRACKET);
+        
+        case ']':
+            return makeToken(TOKEN_RIGHT_BRACKET);
+        
         case ';':
             return makeToken(TOKEN_SEMICOLON);
         
@@ -370,6 +430,18 @@ Token scanToken(void)
         
         case ':':
             return makeToken(TOKEN_COLON);
+        
+        case '&':
+            return makeToken(TOKEN_AMPERSAND);
+        
+        case '|':
+            return makeToken(TOKEN_PIPE);
+        
+        case '^':
+            return makeToken(TOKEN_CARET);
+        
+        case '~':
+            return makeToken(TOKEN_TILDE);
  
  
         /*********************************************************************\
@@ -382,9 +454,13 @@ Token scanToken(void)
             return makeToken(match('=') ? TOKEN_EQUAL_EQUAL : TOKEN_EQUAL);
     
         case '<':
+            if (match('<'))
+                return makeToken(TOKEN_LESS_LESS);
             return makeToken(match('=') ? TOKEN_LESS_EQUAL : TOKEN_LESS);
     
         case '>':
+            if (match('>'))
+                return makeToken(TOKEN_GREATER_GREATER);
             return makeToken(match('=') ? TOKEN_GREATER_EQUAL : TOKEN_GREATER);
  
  
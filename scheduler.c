@@ -0,0 +1,217 @@
+//
+//  scheduler.c
+//  psim
+//
+//  Created by ThrudTheBarbarian on 16/10/2026.
+//
+
+#include <stdlib.h>
+
+#include "memory.h"
+#include "scheduler.h"
+
+#define WHEEL_MASK          (WHEEL_SIZE - 1)
+
+/*****************************************************************************\
+|* Initialise the scheduler, with time at 0
+\*****************************************************************************/
+void initScheduler(Scheduler* scheduler)
+    {
+    scheduler->now          = 0;
+    scheduler->count        = 0;
+    scheduler->freeEvents   = NULL;
+
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+        {
+        scheduler->occupied[level] = 0;
+        for (int slot = 0; slot < WHEEL_SIZE; slot++)
+            {
+            scheduler->slots[level][slot].head = NULL;
+            scheduler->slots[level][slot].tail = NULL;
+            }
+        }
+    }
+
+/*****************************************************************************\
+|* Free the scheduler and anything still pending
+\*****************************************************************************/
+void freeScheduler(Scheduler* scheduler)
+    {
+    clearEvents(scheduler);
+
+    Event* event = scheduler->freeEvents;
+    while (event != NULL)
+        {
+        Event* next = event->next;
+        free(event);
+        event = next;
+        }
+    initScheduler(scheduler);
+    }
+
+/*****************************************************************************\
+|* Helper function: The level an event belongs on, which is the level of the
+|* highest bit where its time differs from the current time
+\*****************************************************************************/
+static inline int levelFor(SimTime now, SimTime time)
+    {
+    SimTime differ = now ^ time;
+    if (differ == 0)
+        return 0;
+    return (63 - __builtin_clzll(differ)) / WHEEL_BITS;
+    }
+
+/*****************************************************************************\
+|* Helper function: Add an event to the end of its slot
+\*****************************************************************************/
+static void insertEvent(Scheduler* scheduler, Event* event)
+    {
+    int level       = levelFor(scheduler->now, event->time);
+    int slot        = (int)(event->time >> (level * WHEEL_BITS)) & WHEEL_MASK;
+    EventList* list = &scheduler->slots[level][slot];
+
+    event->next     = NULL;
+    if (list->tail == NULL)
+        list->head  = event;
+    else
+        list->tail->next = event;
+    list->tail      = event;
+
+    scheduler->occupied[level] |= (uint64_t)1 << slot;
+    }
+
+/*****************************************************************************\
+|* Helper function: Unlink a slot's events, leaving it empty
+\*****************************************************************************/
+static Event* takeSlot(Scheduler* scheduler, int level, int slot)
+    {
+    EventList* list = &scheduler->slots[level][slot];
+    Event* events   = list->head;
+
+    list->head      = NULL;
+    list->tail      = NULL;
+    scheduler->occupied[level] &= ~((uint64_t)1 << slot);
+    return events;
+    }
+
+/*****************************************************************************\
+|* Schedule 'action' to be run 'delay' ticks from now
+\*****************************************************************************/
+bool scheduleEvent(Scheduler* scheduler, SimTime delay, Value action)
+    {
+    if (delay > UINT64_MAX - scheduler->now)
+        return false;
+
+    Event* event = scheduler->freeEvents;
+    if (event != NULL)
+        scheduler->freeEvents = event->next;
+    else
+        {
+        event = (Event*)malloc(sizeof(Event));
+        if (event == NULL)
+            exit(1);
+        }
+
+    event->time     = scheduler->now + delay;
+    event->action   = action;
+    insertEvent(scheduler, event);
+    scheduler->count ++;
+    return true;
+    }
+
+/*****************************************************************************\
+|* Take the next event off the queue, moving time on to when it's due
+\*****************************************************************************/
+bool nextEvent(Scheduler* scheduler, Value* action)
+    {
+    if (scheduler->count == 0)
+        return false;
+
+    for (;;)
+        {
+        // Nothing is ever scheduled in the past, so the lowest level with
+        // anything in it holds the next event, in its lowest occupied slot
+        int level = 0;
+        while (scheduler->occupied[level] == 0)
+            level++;
+        int slot  = __builtin_ctzll(scheduler->occupied[level]);
+
+        if (level == 0)
+            {
+            EventList* list = &scheduler->slots[0][slot];
+            Event* event    = list->head;
+
+            list->head      = event->next;
+            if (list->head == NULL)
+                {
+                list->tail  = NULL;
+                scheduler->occupied[0] &= ~((uint64_t)1 << slot);
+                }
+
+            scheduler->now  = (scheduler->now & ~(SimTime)WHEEL_MASK) | slot;
+            scheduler->count --;
+
+            *action         = event->action;
+            event->next     = scheduler->freeEvents;
+            scheduler->freeEvents = event;
+            return true;
+            }
+
+        // Move time on to the start of the slot's block, and spread its
+        // events over the levels below
+        int shift       = level * WHEEL_BITS;
+        SimTime below   = (shift + WHEEL_BITS >= 64)
+                        ? UINT64_MAX
+                        : ((SimTime)1 << (shift + WHEEL_BITS)) - 1;
+        scheduler->now  = (scheduler->now & ~below) | ((SimTime)slot << shift);
+
+        Event* event    = takeSlot(scheduler, level, slot);
+        while (event != NULL)
+            {
+            Event* next = event->next;
+            insertEvent(scheduler, event);
+            event       = next;
+            }
+        }
+    }
+
+/*****************************************************************************\
+|* Drop every pending event. Time stays where it is
+\*****************************************************************************/
+void clearEvents(Scheduler* scheduler)
+    {
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+        while (scheduler->occupied[level] != 0)
+            {
+            int slot        = __builtin_ctzll(scheduler->occupied[level]);
+            Event* event    = takeSlot(scheduler, level, slot);
+            while (event != NULL)
+                {
+                Event* next = event->next;
+                event->next = scheduler->freeEvents;
+                scheduler->freeEvents = event;
+                event       = next;
+                }
+            }
+    scheduler->count = 0;
+    }
+
+/*****************************************************************************\
+|* GC: Mark the actions of pending events
+\*****************************************************************************/
+void markScheduler(Scheduler* scheduler)
+    {
+    for (int level = 0; level < WHEEL_LEVELS; level++)
+        {
+        uint64_t occupied = scheduler->occupied[level];
+        while (occupied != 0)
+            {
+            int slot    = __builtin_ctzll(occupied);
+            occupied   &= occupied - 1;
+
+            Event* event = scheduler->slots[level][slot].head;
+            for ( ; event != NULL; event = event->next)
+                markValue(event->action);
+            }
+        }
+    }
@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "logic.h"
 #include "memory.h"
 #include "value.h"
 #include "object.h"
@@ -55,25 +56,44 @@ void freeValueArray(ValueArray* array)
 \*****************************************************************************/
 void printValue(Value value)
     {
-    switch (value.type)
-        {
-        case VAL_BOOL:
+    #ifdef NAN_BOXING
+        if (IS_BOOL(value))
             printf(AS_BOOL(value) ? "true" : "false");
-            break;
-        
-        case VAL_NIL:
+        else if (IS_NIL(value))
             printf("nil");
-            break;
-    
-        case VAL_NUMBER:
+        else if (IS_NUMBER(value))
             printf(VALUE_FORMAT_STRING, AS_NUMBER(value));
-            break;
-
-        case VAL_OBJ:
+        else if (IS_INT(value))
+            printf(INT_FORMAT_STRING, AS_INT(value));
+        else if (IS_OBJ(value))
             printObject(value);
-            break;
+    #else
+        switch (value.type)
+            {
+            case VAL_BOOL:
+                printf(AS_BOOL(value) ? "true" : "false");
+                break;
+            
+            case VAL_NIL:
+                printf("nil");
+                break;
+        
+            case VAL_NUMBER:
+                printf(VALUE_FORMAT_STRING, AS_NUMBER(value));
+                break;
 
-        }
+            case VAL_INT:
+                printf(INT_FORMAT_STRING, AS_INT(value));
+                break;
+
+            case VAL_OBJ:
+                printObject(value);
+                break;
+                
+            case VAL_UNDEFINED:
+                break;  // Only ever held in an undefined global's slot
+            }
+    #endif
     }
 
 /*****************************************************************************\
@@ -81,27 +101,215 @@ void printValue(Value value)
 \*****************************************************************************/
 bool valuesEqual(Value a, Value b)
     {
-    if (a.type != b.type)
+    #ifdef NAN_BOXING
+        // Compare numbers as doubles so that NaN != NaN, as IEEE 754 requires
+        if (IS_NUMBER(a) && IS_NUMBER(b))
+            return AS_NUMBER(a) == AS_NUMBER(b);
+        
+        // Everything else is equal if the bits are (strings are interned)
+        if (a == b)
+            return true;
+        
+        // ...apart from boxed integers, and integers compared to numbers
+        if (IS_INT(a) && IS_INT(b))
+            return AS_INT(a) == AS_INT(b);
+        if (IS_NUMERIC(a) && IS_NUMERIC(b))
+            return AS_NUMERIC(a) == AS_NUMERIC(b);
+        
+        // ...and signals, which are compared bit for bit
+        if (IS_SIGNAL(a) || IS_SIGNAL(b))
+            return signalEquals(a, b);
         return false;
-  
-    switch (a.type)
-        {
-        case VAL_BOOL:
-            return AS_BOOL(a) == AS_BOOL(b);
+    #else
+        // Signals are compared bit for bit, with each other or integers
+        if (IS_SIGNAL(a) || IS_SIGNAL(b))
+            return signalEquals(a, b);
+
+        if (a.type != b.type)
+            {
+            // An integer and a number are compared as numbers
+            if (IS_NUMERIC(a) && IS_NUMERIC(b))
+                return AS_NUMERIC(a) == AS_NUMERIC(b);
+            return false;
+            }
+      
+        switch (a.type)
+            {
+            case VAL_BOOL:
+                return AS_BOOL(a) == AS_BOOL(b);
+        
+            case VAL_NIL:
+                return true;
+        
+            case VAL_NUMBER:
+                return AS_NUMBER(a) == AS_NUMBER(b);
+
+            case VAL_INT:
+                return AS_INT(a) == AS_INT(b);
+
+            case VAL_OBJ:
+                // works because of interned strings
+                return AS_OBJ(a) == AS_OBJ(b);
+                
+            default:
+                return false; // Unreachable.
+            }
+    #endif
+    }
+
+/*****************************************************************************\
+|* Helper function - integer division. Stays an integer when it divides
+|* exactly, and otherwise gives the same number as dividing numbers would,
+|* so scripts written before there were integers still get fractions
+\*****************************************************************************/
+static Value divideInts(int64_t x, int64_t y)
+    {
+    // INT64_MIN / -1 overflows, so negate instead, which wraps
+    if (y == -1)
+        return INT_VAL((int64_t)(0 - (uint64_t)x));
     
-        case VAL_NIL:
-            return true;
+    if ((y != 0) && (x % y == 0))
+        return INT_VAL(x / y);
     
-        case VAL_NUMBER:
-            return AS_NUMBER(a) == AS_NUMBER(b);
+    return NUMBER_VAL((VALUE_TYPE)x / (VALUE_TYPE)y);
+    }
+
+/*****************************************************************************\
+|* Helper function - shift an integer. Shifting by 64 or more leaves nothing
+|* but the sign, and a negative count shifts the other way. Right shifts are
+|* arithmetic, so the sign is kept
+\*****************************************************************************/
+static int64_t shiftInt(int64_t x, int64_t count, bool left)
+    {
+    if (count < 0)
+        {
+        left    = !left;
+        count   = (count < -63) ? 64 : -count;
+        }
+    
+    if (left)
+        return (count > 63) ? 0 : (int64_t)((uint64_t)x << count);
+    return (count > 63) ? ((x < 0) ? -1 : 0) : (x >> count);
+    }
 
-        case VAL_OBJ:
-            // works because of interned strings
-            return AS_OBJ(a) == AS_OBJ(b);
+/*****************************************************************************\
+|* Apply an arithmetic or comparison operator to two integers or numbers. A
+|* pair of integers gives an integer, and wraps around rather than overflow.
+|* Anything else is done on numbers, except that bitwise operators only work
+|* on integers
+\*****************************************************************************/
+bool arithmetic(ArithOp op, Value a, Value b, Value* result)
+    {
+    if (IS_INT(a) && IS_INT(b))
+        {
+        int64_t x = AS_INT(a);
+        int64_t y = AS_INT(b);
+        switch (op)
+            {
+            case ARITH_ADD:
+                *result = INT_VAL((int64_t)((uint64_t)x + (uint64_t)y));
+                return true;
+            
+            case ARITH_SUBTRACT:
+                *result = INT_VAL((int64_t)((uint64_t)x - (uint64_t)y));
+                return true;
+            
+            case ARITH_MULTIPLY:
+                *result = INT_VAL((int64_t)((uint64_t)x * (uint64_t)y));
+                return true;
+            
+            case ARITH_DIVIDE:
+                *result = divideInts(x, y);
+                return true;
+            
+            case ARITH_LESS:
+                *result = BOOL_VAL(x < y);
+                return true;
+            
+            case ARITH_GREATER:
+                *result = BOOL_VAL(x > y);
+                return true;
+            
+            case ARITH_BIT_AND:
+                *result = INT_VAL(x & y);
+                return true;
+            
+            case ARITH_BIT_OR:
+                *result = INT_VAL(x | y);
+                return true;
             
+            case ARITH_BIT_XOR:
+                *result = INT_VAL(x ^ y);
+                return true;
+            
+            case ARITH_SHIFT_LEFT:
+                *result = INT_VAL(shiftInt(x, y, true));
+                return true;
+            
+            case ARITH_SHIFT_RIGHT:
+                *result = INT_VAL(shiftInt(x, y, false));
+                return true;
+            }
+        }
+    
+    if (IS_BITWISE(op) || !IS_NUMERIC(a) || !IS_NUMERIC(b))
+        return false;
+    
+    VALUE_TYPE x = AS_NUMERIC(a);
+    VALUE_TYPE y = AS_NUMERIC(b);
+    switch (op)
+        {
+        case ARITH_ADD:
+            *result = NUMBER_VAL(x + y);
+            break;
+        
+        case ARITH_SUBTRACT:
+            *result = NUMBER_VAL(x - y);
+            break;
+        
+        case ARITH_MULTIPLY:
+            *result = NUMBER_VAL(x * y);
+            break;
+        
+        case ARITH_DIVIDE:
+            *result = NUMBER_VAL(x / y);
+            break;
+        
+        case ARITH_LESS:
+            *result = BOOL_VAL(x < y);
+            break;
+        
+        case ARITH_GREATER:
+            *result = BOOL_VAL(x > y);
+            break;
+        
         default:
-            return false; // Unreachable.
+            return false;   // Bitwise, ruled out above
         }
+    return true;
     }
 
+/*****************************************************************************\
+|* Take the bitwise complement of an integer
+\*****************************************************************************/
+bool complementInt(Value a, Value* result)
+    {
+    if (!IS_INT(a))
+        return false;
+    *result = INT_VAL(~AS_INT(a));
+    return true;
+    }
 
+/*****************************************************************************\
+|* Negate an integer or number
+\*****************************************************************************/
+bool negateNumeric(Value a, Value* result)
+    {
+    if (IS_INT(a))
+        *result = INT_VAL((int64_t)(0 - (uint64_t)AS_INT(a)));
+    else if (IS_NUMBER(a))
+        *result = NUMBER_VAL(-AS_NUMBER(a));
+    else
+        return false;
+    return true;
+    }
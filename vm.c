@@ -10,11 +10,19 @@
 
 #include "compiler.h"
 #include "debug.h"
+#include "logic.h"
 #include "vm.h"
 #include "object.h"
 #include "memory.h"
 #include "native.h"
 
+/*****************************************************************************\
+|* Threaded dispatch needs the GCC/clang labels-as-values extension
+\*****************************************************************************/
+#if defined(THREADED_DISPATCH) && (defined(__GNUC__) || defined(__clang__))
+#  define USE_COMPUTED_GOTO
+#endif
+
 /*****************************************************************************\
 |* Declare the virtual machine instance
 \*****************************************************************************/
@@ -37,20 +45,37 @@ void initVM(void)
     {
     resetStack();
     vm.objects      = NULL;
+    vm.youngObjects = NULL;
     vm.openUpvalues = NULL;
     
+    // Garbage collection. Set up before anything below allocates
+    vm.grayCount            = 0;
+    vm.grayCapacity         = 0;
+    vm.grayStack            = NULL;
+    vm.bytesAllocated       = 0;
+    vm.nextGC               = GC_INITIAL_THRESHOLD;
+    vm.gcGrowFactor         = GC_HEAP_GROW_FACTOR;
+    vm.nurseryBytes         = 0;
+    vm.nurserySize          = GC_NURSERY_SIZE;
+    vm.gcState              = GC_IDLE;
+    vm.gcMarkMode           = GC_MARK_ALL;
+    vm.gcSliceBudget        = GC_SLICE_BUDGET;
+    vm.sweepList            = NULL;
+    vm.rememberedCount      = 0;
+    vm.rememberedCapacity   = 0;
+    vm.rememberedSet        = NULL;
+
+    vm.registerMode         = false;
+
     initTable(&(vm.strings));
-    initTable(&(vm.globals));
+    initTable(&(vm.globalNames));
+    initValueArray(&(vm.globalValues));
+    initValueArray(&(vm.globalSlotNames));
+    initScheduler(&(vm.scheduler));
+    vm.initString   = NULL;
     installNativeFunctions();
 
-    vm.initString   = NULL;
     vm.initString   = copyString("init", 4);
-
-    // Garbage collection
-    vm.grayCount        = 0;
-    vm.grayCapacity     = 0;
-    vm.grayStack        = NULL;
-
     }
 
 /*****************************************************************************\
@@ -59,14 +84,32 @@ void initVM(void)
 void freeVM(void)
     {
     freeTable(&(vm.strings));
-    freeTable(&(vm.globals));
+    freeTable(&(vm.globalNames));
+    freeValueArray(&(vm.globalValues));
+    freeValueArray(&(vm.globalSlotNames));
+    freeScheduler(&(vm.scheduler));
     vm.initString = NULL;
     freeObjects();
+    freePools();
     
     free(vm.grayStack);
+    free(vm.rememberedSet);
     }
 
 
+/*****************************************************************************\
+|* Helper function - the source line of the instruction a frame is running
+\*****************************************************************************/
+static int frameLine(CallFrame* frame)
+    {
+    ObjFunction* function = frame->closure->function;
+    if (frame->pc != NULL)
+        return function->registers->lines[frame->pc
+                                          - function->registers->code - 1];
+    return getLine(&function->chunk,
+                   (int)(frame->ip - function->chunk.code - 1));
+    }
+
 /*****************************************************************************\
 |* Implement runtime errors
 \*****************************************************************************/
@@ -78,20 +121,20 @@ static void runtimeError(const char* format, ...)
     va_end(args);
     fputs("\n", stderr);
 
-    CallFrame* frame        = &vm.frames[vm.frameCount - 1];
-    ObjFunction* function   = frame->closure->function;
-    size_t instruction      = frame->ip - function->chunk.code - 1;
-    int line                = function->chunk.lines[instruction];
-    fprintf(stderr, "[line %d] in script\n", line);
+    // Scheduled events are called from the top level, with no frame yet
+    if (vm.frameCount > 0)
+        {
+        CallFrame* frame    = &vm.frames[vm.frameCount - 1];
+        fprintf(stderr, "[line %d] in script\n", frameLine(frame));
+        }
     
     // Dump a stack trace
     for (int i = vm.frameCount - 1; i >= 0; i--)
         {
         CallFrame* frame        = &vm.frames[i];
         ObjFunction* function   = frame->closure->function;
-        size_t instruction      = frame->ip - function->chunk.code - 1;
     
-        fprintf(stderr, "[line %d] in ",  function->chunk.lines[instruction]);
+        fprintf(stderr, "[line %d] in ",  frameLine(frame));
         if (function->name == NULL)
             fprintf(stderr, "script\n");
         else
@@ -101,6 +144,29 @@ static void runtimeError(const char* format, ...)
     resetStack();
     }
 
+/*****************************************************************************\
+|* Return the slot for a global variable, allocating an undefined one if this
+|* is the first time the name has been seen
+\*****************************************************************************/
+int globalSlot(ObjString* name)
+    {
+    Value slot;
+    if (tableGet(&vm.globalNames, name, &slot))
+        return (int)AS_NUMBER(slot);
+
+    // Protect against GC
+    push(OBJ_VAL(name));
+    
+    int index = vm.globalValues.count;
+    writeValueArray(&vm.globalValues, UNDEFINED_VAL);
+    writeValueArray(&vm.globalSlotNames, OBJ_VAL(name));
+    tableSet(&vm.globalNames, name, NUMBER_VAL(index));
+    
+    // relinquish the protection
+    pop();
+    return index;
+    }
+
 /*****************************************************************************\
 |* Define a native function
 \*****************************************************************************/
@@ -108,7 +174,8 @@ void defineNative(const char* name, NativeFn function)
     {
     push(OBJ_VAL(copyString(name, (int)strlen(name))));
     push(OBJ_VAL(newNative(function)));
-    tableSet(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+    int slot = globalSlot(AS_STRING(vm.stack[0]));
+    vm.globalValues.values[slot] = vm.stack[1];
     pop();
     pop();
     }
@@ -122,14 +189,20 @@ static Value peek(int distance)
     }
 
 /*****************************************************************************\
-|* "False" is a fairly permissive definition
+|* Integer fast paths. Arithmetic is done unsigned so it wraps around instead
+|* of overflowing, and comparisons are signed
 \*****************************************************************************/
-static bool isFalsey(Value value)
-    {
-    return IS_NIL(value)
-        || (IS_BOOL(value) && !AS_BOOL(value))
-        || (IS_NUMBER(value) && !AS_NUMBER(value));
-    }
+#define INT_ARITH(x, op, y)                                                 \
+    INT_VAL((int64_t)((uint64_t)(x) op (uint64_t)(y)))
+#define INT_COMPARE(x, op, y)   BOOL_VAL((x) op (y))
+
+/*****************************************************************************\
+|* Shift fast paths, for counts of 0-63. Left shifts are done unsigned so
+|* they wrap, and right shifts keep the sign
+\*****************************************************************************/
+#define IS_SHIFT_COUNT(value)   ((uint64_t)AS_SMALL_INT(value) < 64)
+#define SHIFT_LEFT(x, n)        INT_VAL((int64_t)((uint64_t)(x) << (n)))
+#define SHIFT_RIGHT(x, n)       SMALL_INT_VAL((x) >> (n))
 
 /*****************************************************************************\
 |* Add 2 strings by concatenation
@@ -140,13 +213,12 @@ static void concatenate(void)
     ObjString* b = AS_STRING(peek(0));
     ObjString* a = AS_STRING(peek(1));
 
-    int length      = a->length + b->length;
-    char* chars     = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
+    // Build the result in place, then swap in any existing interned copy
+    ObjString* result = newString(a->length + b->length);
+    memcpy(result->chars, a->chars, a->length);
+    memcpy(result->chars + a->length, b->chars, b->length);
+    result = internString(result);
 
-    ObjString* result = takeString(chars, length);
     // Now pull them off the stack
     pop();
     pop();
@@ -166,8 +238,10 @@ static bool call(ObjClosure* closure, int argCount)
         return false;
         }
 
-    // Check frames count
-    if (vm.frameCount == FRAMES_MAX)
+    // Check frames count, and that there's room for the locals
+    Value* slots = vm.stackTop - argCount - 1;
+    if ((vm.frameCount == FRAMES_MAX)
+    ||  (slots + closure->function->maxSlots > vm.stack + STACK_MAX))
         {
         runtimeError("Stack overflow.");
         return false;
@@ -176,7 +250,25 @@ static bool call(ObjClosure* closure, int argCount)
     CallFrame* frame    = &vm.frames[vm.frameCount++];
     frame->closure      = closure;
     frame->ip           = closure->function->chunk.code;
-    frame->slots        = vm.stackTop - argCount - 1; // '1' accounts for slot 0
+    frame->pc           = NULL;
+    frame->slots        = slots;    // Includes slot 0, the closure
+
+    // Register code needs its whole frame up front, and the GC to see it
+    RegisterCode* registers = closure->function->registers;
+    if (registers != NULL)
+        {
+        Value* frameEnd = frame->slots + registers->registerCount;
+        if (frameEnd + 2 > vm.stack + STACK_MAX)
+            {
+            runtimeError("Stack overflow.");
+            return false;
+            }
+
+        for (Value* slot = vm.stackTop; slot < frameEnd; slot++)
+            *slot = NIL_VAL;
+        frame->pc   = registers->code;
+        vm.stackTop = frameEnd;
+        }
     return true;
     }
 
@@ -218,6 +310,7 @@ static void closeUpvalues(Value* last)
         upvalue->closed         = *upvalue->location;
         upvalue->location       = &upvalue->closed;
         vm.openUpvalues         = upvalue->next;
+        writeBarrier((Obj*)upvalue, upvalue->closed);
         }
     }
 
@@ -229,7 +322,18 @@ static void defineMethod(ObjString* name)
     Value method                = peek(0);
     ObjClass* klass             = AS_CLASS(peek(1));
     tableSet(&klass->methods, name, method);
+    writeBarrier((Obj*)klass, method);
+    pop();
+    }
+
+/*****************************************************************************\
+|* Replace the receiver on top of the stack with a method bound to it
+\*****************************************************************************/
+static void bindClosure(Value method)
+    {
+    ObjBoundMethod* bound = newBoundMethod(peek(0), AS_CLOSURE(method));
     pop();
+    push(OBJ_VAL(bound));
     }
 
 /*****************************************************************************\
@@ -244,12 +348,207 @@ static bool bindMethod(ObjClass* klass, ObjString* name)
         return false;
         }
 
-    ObjBoundMethod* bound = newBoundMethod(peek(0), AS_CLOSURE(method));
-    pop();
-    push(OBJ_VAL(bound));
+    bindClosure(method);
+    return true;
+    }
+
+/*****************************************************************************\
+|* Check the operand 'distance' down the stack is a signal
+\*****************************************************************************/
+static bool isSignalOperand(int distance)
+    {
+    if (IS_SIGNAL(peek(distance)))
+        return true;
+
+    runtimeError("Only signals have bits.");
+    return false;
+    }
+
+/*****************************************************************************\
+|* Check the operand 'distance' down the stack can be indexed. Memories are
+|* checked for first, so this is only left to check for a signal
+\*****************************************************************************/
+static bool isIndexable(int distance)
+    {
+    if (IS_SIGNAL(peek(distance)))
+        return true;
+
+    runtimeError("Only memories and signals can be indexed.");
+    return false;
+    }
+
+/*****************************************************************************\
+|* Check an address is an integer inside a memory
+\*****************************************************************************/
+static bool isAddress(ObjMemory* memory, Value address)
+    {
+    if (!IS_INT(address))
+        {
+        runtimeError("Memory addresses must be integers.");
+        return false;
+        }
+
+    if ((AS_INT(address) < 0) || (AS_INT(address) >= memory->size))
+        {
+        runtimeError("Address %lld is outside a memory of %lld cells.",
+                     (long long)AS_INT(address), (long long)memory->size);
+        return false;
+        }
+    return true;
+    }
+
+/*****************************************************************************\
+|* Work out which bits of a signal [high:low] covers, as the first bit and
+|* the number of bits. At most 64 bits can be read or written at once
+\*****************************************************************************/
+static bool signalBits(ObjSignal* signal,
+                       Value high,
+                       Value low,
+                       int* first,
+                       int* count)
+    {
+    if (!IS_INT(high) || !IS_INT(low))
+        {
+        runtimeError("Signal bits must be integers.");
+        return false;
+        }
+
+    int64_t highBit = AS_INT(high);
+    int64_t lowBit  = AS_INT(low);
+    if ((lowBit < 0) || (highBit < lowBit) || (highBit >= signal->width))
+        {
+        runtimeError("Bits [%lld:%lld] are outside a %d-bit signal.",
+                     (long long)highBit, (long long)lowBit, signal->width);
+        return false;
+        }
+    if (highBit - lowBit >= 64)
+        {
+        runtimeError("Can't access more than 64 bits of a signal at once.");
+        return false;
+        }
+
+    *first = (int)lowBit;
+    *count = (int)(highBit - lowBit) + 1;
+    return true;
+    }
+
+/*****************************************************************************\
+|* Read 'count' bits of a signal from bit 'first' up. Known bits read as an
+|* integer, but if any of them are X or Z they're returned as a signal that
+|* wide. The signal must be reachable by the GC, since this can allocate
+\*****************************************************************************/
+static Value readBits(ObjSignal* signal, int first, int count)
+    {
+    uint64_t unknown;
+    uint64_t value      = signalRead(signal, first, count, &unknown);
+    if (unknown == 0)
+        return INT_VAL((int64_t)value);
+
+    ObjSignal* bits     = newSignal(count);
+    signalWrite(bits, 0, count, value, unknown);
+    return OBJ_VAL(bits);
+    }
+
+/*****************************************************************************\
+|* Set 'count' bits of a signal from bit 'first' up, from the low bits of an
+|* integer or signal
+\*****************************************************************************/
+static bool writeBits(ObjSignal* signal, int first, int count, Value value)
+    {
+    uint64_t bits       = 0;
+    uint64_t unknown    = 0;
+
+    if (IS_INT(value))
+        bits            = (uint64_t)AS_INT(value);
+    else if (IS_SIGNAL(value))
+        {
+        ObjSignal* from = AS_SIGNAL(value);
+        bits            = signalRead(from, 0,
+                                     (count < from->width) ? count
+                                                           : from->width,
+                                     &unknown);
+        }
+    else
+        {
+        runtimeError("Signal bits can only be set to integers or signals.");
+        return false;
+        }
+
+    signalWrite(signal, first, count, bits, unknown);
+    return true;
+    }
+
+/*****************************************************************************\
+|* Set the whole of a bus, from an integer or another signal. An integer
+|* fills the low 64 bits and clears the rest
+\*****************************************************************************/
+static bool writeBus(ObjSignal* signal, Value value)
+    {
+    if (IS_SIGNAL(value))
+        {
+        signalCopy(signal, AS_SIGNAL(value));
+        return true;
+        }
+
+    if (!IS_INT(value))
+        {
+        runtimeError("A bus can only be set to an integer or a signal.");
+        return false;
+        }
+
+    int count = signal->width;
+    if (count > 64)
+        {
+        signalFill(signal, false, false);
+        count = 64;
+        }
+    signalWrite(signal, 0, count, (uint64_t)AS_INT(value), 0);
     return true;
     }
 
+/*****************************************************************************\
+|* Inline caches: find the cache entry for the instance's shape, or NULL on a
+|* miss
+\*****************************************************************************/
+static inline InlineCacheEntry* cacheLookup(InlineCache* cache,
+                                            ObjInstance* instance)
+    {
+    for (int i = 0; i < IC_WAYS; i++)
+        if (cache->entries[i].shape == (Obj*)instance->shape)
+            return &cache->entries[i];
+    return NULL;
+    }
+
+/*****************************************************************************\
+|* Inline caches: record where a property was found for a shape. The newest
+|* entry moves to the front, so when the cache is full the least recently
+|* filled shape falls off the end
+\*****************************************************************************/
+static void cacheUpdate(ObjFunction* owner,
+                        InlineCache* cache,
+                        ObjShape* shape,
+                        int slot,
+                        Obj* target)
+    {
+    InlineCacheEntry* entries = cache->entries;
+
+    int i = 0;
+    while ((i < IC_WAYS - 1)
+       &&  (entries[i].shape != NULL)
+       &&  (entries[i].shape != (Obj*)shape))
+        i++;
+    memmove(&entries[1], &entries[0], i * sizeof(InlineCacheEntry));
+
+    entries[0].shape    = (Obj*)shape;
+    entries[0].slot     = slot;
+    entries[0].target   = target;
+
+    // The cache lives in the function, so it holds on to what it caches
+    writeBarrier((Obj*)owner, OBJ_VAL(shape));
+    if (target != NULL)
+        writeBarrier((Obj*)owner, OBJ_VAL(target));
+    }
+
 /*****************************************************************************\
 |* Get the instance's class and call the named method if it's present
 \*****************************************************************************/
@@ -319,9 +618,12 @@ static bool callValue(Value callee, int argCount)
 
 
 /*****************************************************************************\
-|* invoke a method
+|* invoke a method, through the instruction's inline cache
 \*****************************************************************************/
-static bool invoke(ObjString* name, int argCount)
+static bool invoke(ObjFunction* owner,
+                   InlineCache* cache,
+                   ObjString* name,
+                   int argCount)
     {
     Value receiver = peek(argCount);
 
@@ -331,17 +633,58 @@ static bool invoke(ObjString* name, int argCount)
         return false;
         }
 
-    ObjInstance* instance = AS_INSTANCE(receiver);
+    ObjInstance* instance   = AS_INSTANCE(receiver);
+    ObjShape* shape         = instance->shape;
+
+    InlineCacheEntry* entry = cacheLookup(cache, instance);
+    if (entry != NULL)
+        {
+        if (entry->slot == IC_METHOD)
+            return call((ObjClosure*)entry->target, argCount);
+
+        Value value = instance->fields[entry->slot];
+        vm.stackTop[-argCount - 1] = value;
+        return callValue(value, argCount);
+        }
 
-    Value value;
-    if (tableGet(&instance->fields, name, &value))
+    int slot = shapeSlot(shape, name);
+    if (slot >= 0)
         {
+        Value value = instance->fields[slot];
+        cacheUpdate(owner, cache, shape, slot, NULL);
         vm.stackTop[-argCount - 1] = value;
         return callValue(value, argCount);
         }
 
-    return invokeFromClass(instance->klass, name, argCount);
+    Value method;
+    if (!tableGet(&instance->klass->methods, name, &method))
+        {
+        runtimeError("Undefined property '%s'.", name->chars);
+        return false;
+        }
+    cacheUpdate(owner, cache, shape, IC_METHOD, AS_OBJ(method));
+    return call(AS_CLOSURE(method), argCount);
+    }
+
+#ifdef DEBUG_TRACE_EXECUTION
+/*****************************************************************************\
+|* Print the stack and the instruction about to be executed
+\*****************************************************************************/
+static void traceExecution(CallFrame* frame)
+    {
+    printf("              ");
+    for (Value* slot = vm.stack; slot < vm.stackTop; slot++)
+        {
+        printf("[");
+        printValue(*slot);
+        printf("] ");
+        }
+    printf("\n");
+    
+    disassembleInstruction(&frame->closure->function->chunk,
+            (int)(frame->ip - frame->closure->function->chunk.code));
     }
+#endif
 
 /*****************************************************************************\
 |* Run the VM and return the result, the actual implementation
@@ -358,364 +701,1239 @@ static InterpretResult run(void)
 
     #define READ_CONSTANT()                                                 \
         (frame->closure->function->chunk.constants.values[READ_BYTE()])
-    #define READ_STRING() AS_STRING(READ_CONSTANT())
-    #define BINARY_OP(valueType, op)                                        \
+    #define CONSTANT_AT(index)                                              \
+        (frame->closure->function->chunk.constants.values[index])
+    #define READ_STRING() AS_STRING(CONSTANT_AT(READ_SHORT()))
+    #define GLOBAL_NAME(slot)                                               \
+        (AS_CSTRING(vm.globalSlotNames.values[slot]))
+    #define READ_CACHE()                                                    \
+        (&frame->closure->function->chunk.caches[READ_SHORT()])
+    // Mixed integers and numbers, and boxed integers. Operands are left on
+    // the stack until the result is ready, since boxing it may run the GC
+    #define ARITHMETIC(arith)                                               \
         do                                                                  \
             {                                                               \
-            if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1)))                 \
+            Value result;                                                   \
+            if (!arithmetic(arith, peek(1), peek(0), &result))              \
                 {                                                           \
                 runtimeError("Operands must be numbers.");                  \
                 return INTERPRET_RUNTIME_ERROR;                             \
                 }                                                           \
-            VALUE_TYPE b = AS_NUMBER(pop());                                   \
-            VALUE_TYPE a = AS_NUMBER(pop());                                   \
-            push(valueType(a op b));                                        \
+            pop();                                                          \
+            pop();                                                          \
+            push(result);                                                   \
             }                                                               \
         while (false)
 
-    for (;;)
+    // Integers, or for &, | and ^, signals too. 'expr' gives the result
+    // from x and y, the values of two inline integers, as long as 'guard'
+    // holds as well
+    #define INTEGER_OP(arith, guard, expr)                                  \
+        do                                                                  \
+            {                                                               \
+            Value b = peek(0);                                              \
+            Value a = peek(1);                                              \
+            Value result;                                                   \
+            if (IS_SMALL_INT(a) && IS_SMALL_INT(b) && (guard))              \
+                {                                                           \
+                int64_t x = AS_SMALL_INT(a);                                \
+                int64_t y = AS_SMALL_INT(b);                                \
+                result    = (expr);                                         \
+                }                                                           \
+            else if (!arithmetic(arith, a, b, &result)                      \
+                 &&  !signalLogic(arith, a, b, &result))                    \
+                {                                                           \
+                runtimeError("Operands must be integers.");                 \
+                return INTERPRET_RUNTIME_ERROR;                             \
+                }                                                           \
+            pop();                                                          \
+            pop();                                                          \
+            push(result);                                                   \
+            }                                                               \
+        while (false)
+
+    // Integer and number fast paths, falling back on ARITHMETIC()
+    #define BINARY_OP(valueType, intOp, op, arith)                          \
+        do                                                                  \
+            {                                                               \
+            Value b = peek(0);                                              \
+            Value a = peek(1);                                              \
+            if (IS_SMALL_INT(a) && IS_SMALL_INT(b))                         \
+                {                                                           \
+                Value result = intOp(AS_SMALL_INT(a), op, AS_SMALL_INT(b)); \
+                pop();                                                      \
+                pop();                                                      \
+                push(result);                                               \
+                }                                                           \
+            else if (IS_NUMBER(a) && IS_NUMBER(b))                          \
+                {                                                           \
+                pop();                                                      \
+                pop();                                                      \
+                push(valueType(AS_NUMBER(a) op AS_NUMBER(b)));              \
+                }                                                           \
+            else                                                            \
+                ARITHMETIC(arith);                                          \
+            }                                                               \
+        while (false)
+
+    // LESS/GREATER, JUMP_IF_FALSE offset, POP. The jump target pops the
+    // condition, which is never pushed here, so land just past it
+    #define COMPARE_JUMP(op, arith)                                         \
+        do                                                                  \
+            {                                                               \
+            Value b = peek(0);                                              \
+            Value a = peek(1);                                              \
+            bool truth;                                                     \
+            if (IS_SMALL_INT(a) && IS_SMALL_INT(b))                         \
+                truth = AS_SMALL_INT(a) op AS_SMALL_INT(b);                 \
+            else if (IS_NUMBER(a) && IS_NUMBER(b))                          \
+                truth = AS_NUMBER(a) op AS_NUMBER(b);                       \
+            else                                                            \
+                {                                                           \
+                Value result;                                               \
+                if (!arithmetic(arith, a, b, &result))                      \
+                    {                                                       \
+                    runtimeError("Operands must be numbers.");              \
+                    return INTERPRET_RUNTIME_ERROR;                         \
+                    }                                                       \
+                truth = AS_BOOL(result);                                    \
+                }                                                           \
+            pop();                                                          \
+            pop();                                                          \
+            if (truth)                                                      \
+                frame->ip += 4;                                             \
+            else                                                            \
+                frame->ip += 4 + ((frame->ip[1] << 8) | frame->ip[2]);      \
+            }                                                               \
+        while (false)
+
+    // Calls and returns can land in a frame that runs register code, which
+    // goes back to interpret() to be handed over to runRegisters()
+    #define LOAD_FRAME()                                                    \
+        do                                                                  \
+            {                                                               \
+            frame = &vm.frames[vm.frameCount - 1];                          \
+            if (frame->pc != NULL)                                          \
+                return INTERPRET_OK;                                        \
+            }                                                               \
+        while (false)
+
+    #ifdef DEBUG_TRACE_EXECUTION
+    #  define TRACE_EXECUTION() traceExecution(frame)
+    #else
+    #  define TRACE_EXECUTION() do { } while (false)
+    #endif
+
+    /*************************************************************************\
+    |* With computed gotos each handler ends in its own indirect jump through
+    |* the label table, which gives the branch predictor one site per opcode
+    |* to learn from. Otherwise every handler loops back to a shared switch
+    \*************************************************************************/
+    #ifdef USE_COMPUTED_GOTO
+        static void* dispatchTable[] =
+            {
+            [OP_CONSTANT]       = &&op_OP_CONSTANT,
+            [OP_CONSTANT_LONG]  = &&op_OP_CONSTANT_LONG,
+            [OP_NIL]            = &&op_OP_NIL,
+            [OP_TRUE]           = &&op_OP_TRUE,
+            [OP_FALSE]          = &&op_OP_FALSE,
+            [OP_POP]            = &&op_OP_POP,
+            [OP_GET_GLOBAL]     = &&op_OP_GET_GLOBAL,
+            [OP_GET_LOCAL]      = &&op_OP_GET_LOCAL,
+            [OP_GET_LOCAL_LONG] = &&op_OP_GET_LOCAL_LONG,
+            [OP_SET_GLOBAL]     = &&op_OP_SET_GLOBAL,
+            [OP_SET_LOCAL]      = &&op_OP_SET_LOCAL,
+            [OP_SET_LOCAL_LONG] = &&op_OP_SET_LOCAL_LONG,
+            [OP_DEFINE_GLOBAL]  = &&op_OP_DEFINE_GLOBAL,
+            [OP_EQUAL]          = &&op_OP_EQUAL,
+            [OP_GREATER]        = &&op_OP_GREATER,
+            [OP_LESS]           = &&op_OP_LESS,
+            [OP_ADD]            = &&op_OP_ADD,
+            [OP_SUBTRACT]       = &&op_OP_SUBTRACT,
+            [OP_MULTIPLY]       = &&op_OP_MULTIPLY,
+            [OP_DIVIDE]         = &&op_OP_DIVIDE,
+            [OP_NOT]            = &&op_OP_NOT,
+            [OP_NEGATE]         = &&op_OP_NEGATE,
+            [OP_BIT_AND]        = &&op_OP_BIT_AND,
+            [OP_BIT_OR]         = &&op_OP_BIT_OR,
+            [OP_BIT_XOR]        = &&op_OP_BIT_XOR,
+            [OP_SHIFT_LEFT]     = &&op_OP_SHIFT_LEFT,
+            [OP_SHIFT_RIGHT]    = &&op_OP_SHIFT_RIGHT,
+            [OP_BIT_NOT]        = &&op_OP_BIT_NOT,
+            [OP_PRINT]          = &&op_OP_PRINT,
+            [OP_JUMP]           = &&op_OP_JUMP,
+            [OP_JUMP_IF_FALSE]  = &&op_OP_JUMP_IF_FALSE,
+            [OP_LOOP]           = &&op_OP_LOOP,
+            [OP_CALL]           = &&op_OP_CALL,
+            [OP_INVOKE]         = &&op_OP_INVOKE,
+            [OP_SUPER_INVOKE]   = &&op_OP_SUPER_INVOKE,
+            [OP_CLOSURE]        = &&op_OP_CLOSURE,
+            [OP_GET_UPVALUE]    = &&op_OP_GET_UPVALUE,
+            [OP_SET_UPVALUE]    = &&op_OP_SET_UPVALUE,
+            [OP_GET_UPVALUE_LONG] = &&op_OP_GET_UPVALUE_LONG,
+            [OP_SET_UPVALUE_LONG] = &&op_OP_SET_UPVALUE_LONG,
+            [OP_CLOSE_UPVALUE]  = &&op_OP_CLOSE_UPVALUE,
+            [OP_CLASS]          = &&op_OP_CLASS,
+            [OP_GET_PROPERTY]   = &&op_OP_GET_PROPERTY,
+            [OP_SET_PROPERTY]   = &&op_OP_SET_PROPERTY,
+            [OP_GET_BUS]        = &&op_OP_GET_BUS,
+            [OP_SET_BUS]        = &&op_OP_SET_BUS,
+            [OP_MEM_LOAD]       = &&op_OP_MEM_LOAD,
+            [OP_MEM_STORE]      = &&op_OP_MEM_STORE,
+            [OP_GET_SLICE]      = &&op_OP_GET_SLICE,
+            [OP_SET_SLICE]      = &&op_OP_SET_SLICE,
+            [OP_GET_SUPER]      = &&op_OP_GET_SUPER,
+            [OP_METHOD]         = &&op_OP_METHOD,
+            [OP_INHERIT]        = &&op_OP_INHERIT,
+            [OP_RETURN]         = &&op_OP_RETURN,
+            [OP_INC_LOCAL]      = &&op_OP_INC_LOCAL,
+            [OP_INC_GLOBAL]     = &&op_OP_INC_GLOBAL,
+            [OP_ADD_LOCAL_CONST]= &&op_OP_ADD_LOCAL_CONST,
+            [OP_LESS_JUMP]      = &&op_OP_LESS_JUMP,
+            [OP_GREATER_JUMP]   = &&op_OP_GREATER_JUMP,
+            };
+
+    #  define INTERPRET_LOOP    DISPATCH();
+    #  define CASE(op)          op_##op
+    #  define DISPATCH()                                                    \
+            do                                                              \
+                {                                                           \
+                TRACE_EXECUTION();                                          \
+                goto *dispatchTable[READ_BYTE()];                           \
+                }                                                           \
+            while (false)
+    #else
+    #  define INTERPRET_LOOP                                                \
+            loop:                                                           \
+                TRACE_EXECUTION();                                          \
+                switch (READ_BYTE())
+    #  define CASE(op)          case op
+    #  define DISPATCH()        goto loop
+    #endif
+
+    INTERPRET_LOOP
         {
-        #ifdef DEBUG_TRACE_EXECUTION
-            printf("              ");
-            for (Value* slot = vm.stack; slot < vm.stackTop; slot++)
-                {
-                printf("[");
-                printValue(*slot);
-                printf("] ");
-                }
-            printf("\n");
+        CASE(OP_CONSTANT):
+            {
+            Value constant = READ_CONSTANT();
+            push(constant);
+            DISPATCH();
+            }
+
+        CASE(OP_CONSTANT_LONG):
+            push(CONSTANT_AT(READ_SHORT()));
+            DISPATCH();
+ 
+        CASE(OP_NIL):
+            push(NIL_VAL);
+            DISPATCH();
             
-            disassembleInstruction(&frame->closure->function->chunk,
-                    (int)(frame->ip - frame->closure->function->chunk.code));
-        #endif
+        CASE(OP_TRUE):
+            push(BOOL_VAL(true));
+            DISPATCH();
+            
+        CASE(OP_FALSE):
+            push(BOOL_VAL(false));
+            DISPATCH();
+  
+        CASE(OP_POP):
+            pop();
+            DISPATCH();
 
-        uint8_t instruction;
-        switch (instruction = READ_BYTE())
+        CASE(OP_GET_GLOBAL):
             {
-            case OP_CONSTANT:
+            uint16_t slot   = READ_SHORT();
+            Value value     = vm.globalValues.values[slot];
+            if (IS_UNDEFINED(value))
                 {
-                Value constant = READ_CONSTANT();
-                push(constant);
-                break;
+                runtimeError("Undefined variable '%s'.", GLOBAL_NAME(slot));
+                return INTERPRET_RUNTIME_ERROR;
                 }
- 
-            case OP_NIL:
-                push(NIL_VAL);
-                break;
-                
-            case OP_TRUE:
-                push(BOOL_VAL(true));
-                break;
-                
-            case OP_FALSE:
-                push(BOOL_VAL(false));
-                break;
-  
-            case OP_POP:
-                pop();
-                break;
+            push(value);
+            DISPATCH();
+            }
+
+        CASE(OP_GET_LOCAL):
+            {
+            uint8_t slot = READ_BYTE();
+            push(frame->slots[slot]);
+            DISPATCH();
+            }
+
+        CASE(OP_GET_LOCAL_LONG):
+            push(frame->slots[READ_SHORT()]);
+            DISPATCH();
 
-            case OP_GET_GLOBAL:
+        CASE(OP_SET_GLOBAL):
+            {
+            uint16_t slot = READ_SHORT();
+            if (IS_UNDEFINED(vm.globalValues.values[slot]))
                 {
-                ObjString* name = READ_STRING();
-                Value value;
-                if (!tableGet(&vm.globals, name, &value))
-                    {
-                    runtimeError("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                    }
-                push(value);
-                break;
+                runtimeError("Undefined variable '%s'.", GLOBAL_NAME(slot));
+                return INTERPRET_RUNTIME_ERROR;
                 }
+            vm.globalValues.values[slot] = peek(0);
+            DISPATCH();
+            }
+
+        CASE(OP_SET_LOCAL):
+            {
+            uint8_t slot = READ_BYTE();
+            frame->slots[slot] = peek(0);
+            DISPATCH();
+            }
+
+        CASE(OP_SET_LOCAL_LONG):
+            frame->slots[READ_SHORT()] = peek(0);
+            DISPATCH();
+
+        CASE(OP_DEFINE_GLOBAL):
+            {
+            uint16_t slot = READ_SHORT();
+            vm.globalValues.values[slot] = peek(0);
+            pop();
+            DISPATCH();
+            }
+
+        CASE(OP_EQUAL):
+            {
+            Value b = pop();
+            Value a = pop();
+            push(BOOL_VAL(valuesEqual(a, b)));
+            DISPATCH();
+            }
 
-            case OP_GET_LOCAL:
+        CASE(OP_GREATER):
+            BINARY_OP(BOOL_VAL, INT_COMPARE, >, ARITH_GREATER);
+            DISPATCH();
+  
+        CASE(OP_LESS):
+            BINARY_OP(BOOL_VAL, INT_COMPARE, <, ARITH_LESS);
+            DISPATCH();
+
+        CASE(OP_ADD):
+            {
+            Value b = peek(0);
+            Value a = peek(1);
+            if (IS_SMALL_INT(a) && IS_SMALL_INT(b))
                 {
-                uint8_t slot = READ_BYTE();
-                push(frame->slots[slot]);
-                break;
+                Value result = INT_ARITH(AS_SMALL_INT(a), +, AS_SMALL_INT(b));
+                pop();
+                pop();
+                push(result);
                 }
-
-            case OP_SET_GLOBAL:
+            else if (IS_NUMBER(a) && IS_NUMBER(b))
                 {
-                ObjString* name = READ_STRING();
-                if (tableSet(&vm.globals, name, peek(0)))
-                    {
-                    // tableSet always store, so delete the zonbie
-                    tableDelete(&vm.globals, name);
-                    runtimeError("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERROR;
-                    }
-                break;
+                pop();
+                pop();
+                push(NUMBER_VAL(AS_NUMBER(a) + AS_NUMBER(b)));
                 }
-
-            case OP_SET_LOCAL:
+            else if (IS_STRING(a) && IS_STRING(b))
                 {
-                uint8_t slot = READ_BYTE();
-                frame->slots[slot] = peek(0);
-                break;
+                concatenate();
                 }
-
-            case OP_DEFINE_GLOBAL:
+            else if (IS_NUMERIC(a) && IS_NUMERIC(b))
                 {
-                ObjString* name = READ_STRING();
-                tableSet(&vm.globals, name, peek(0));
-                pop();
-                break;
+                ARITHMETIC(ARITH_ADD);
                 }
-
-            case OP_EQUAL:
+            else
                 {
-                Value b = pop();
-                Value a = pop();
-                push(BOOL_VAL(valuesEqual(a, b)));
-                break;
+                runtimeError( "Operands must be 2 numbers or 2 strings.");
+                return INTERPRET_RUNTIME_ERROR;
                 }
+            DISPATCH();
+            }
+ 
+        CASE(OP_SUBTRACT):
+            BINARY_OP(NUMBER_VAL, INT_ARITH, -, ARITH_SUBTRACT);
+            DISPATCH();
+  
+        CASE(OP_MULTIPLY):
+            BINARY_OP(NUMBER_VAL, INT_ARITH, *, ARITH_MULTIPLY);
+            DISPATCH();
+  
+        CASE(OP_DIVIDE):
+            // Integers only stay integers if they divide exactly, which is
+            // too much for a fast path
+            if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1)))
+                {
+                VALUE_TYPE b = AS_NUMBER(pop());
+                VALUE_TYPE a = AS_NUMBER(pop());
+                push(NUMBER_VAL(a / b));
+                }
+            else
+                ARITHMETIC(ARITH_DIVIDE);
+            DISPATCH();
+
+        CASE(OP_NOT):
+            push(BOOL_VAL(isFalsey(pop())));
+            DISPATCH();
+
+        CASE(OP_NEGATE):
+            {
+            Value result;
+            if (!negateNumeric(peek(0), &result))
+                {
+                runtimeError("Operand must be a number.");
+                return INTERPRET_RUNTIME_ERROR;
+                }
+            pop();
+            push(result);
+            DISPATCH();
+            }
+
+        // &, | and ^ of two inline integers are always inline too
+        CASE(OP_BIT_AND):
+            INTEGER_OP(ARITH_BIT_AND, true, SMALL_INT_VAL(x & y));
+            DISPATCH();
+
+        CASE(OP_BIT_OR):
+            INTEGER_OP(ARITH_BIT_OR, true, SMALL_INT_VAL(x | y));
+            DISPATCH();
+
+        CASE(OP_BIT_XOR):
+            INTEGER_OP(ARITH_BIT_XOR, true, SMALL_INT_VAL(x ^ y));
+            DISPATCH();
+
+        CASE(OP_SHIFT_LEFT):
+            INTEGER_OP(ARITH_SHIFT_LEFT, IS_SHIFT_COUNT(peek(0)),
+                       SHIFT_LEFT(x, y));
+            DISPATCH();
+
+        CASE(OP_SHIFT_RIGHT):
+            INTEGER_OP(ARITH_SHIFT_RIGHT, IS_SHIFT_COUNT(peek(0)),
+                       SHIFT_RIGHT(x, y));
+            DISPATCH();
+
+        CASE(OP_BIT_NOT):
+            {
+            Value result;
+            if (!complementInt(peek(0), &result)
+             && !signalComplement(peek(0), &result))
+                {
+                runtimeError("Operand must be an integer.");
+                return INTERPRET_RUNTIME_ERROR;
+                }
+            pop();
+            push(result);
+            DISPATCH();
+            }
 
-            case OP_GREATER:
-                BINARY_OP(BOOL_VAL, >);
-                break;
-      
-            case OP_LESS:
-                BINARY_OP(BOOL_VAL, <);
-                break;
-
-            case OP_ADD:
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1)))
+        CASE(OP_PRINT):
+            printValue(pop());
+            printf("\n");
+            DISPATCH();
+
+        CASE(OP_JUMP):
+            {
+            uint16_t offset = READ_SHORT();
+            frame->ip += offset;
+            DISPATCH();
+            }
+            
+        CASE(OP_JUMP_IF_FALSE):
+            {
+            uint16_t offset = READ_SHORT();
+            if (isFalsey(peek(0)))
+                frame->ip += offset;
+            DISPATCH();
+            }
+                
+        CASE(OP_LOOP):
+            {
+            uint16_t offset = READ_SHORT();
+            frame->ip -= offset;
+            DISPATCH();
+            }
+ 
+        CASE(OP_CALL):
+            {
+            int argCount = READ_BYTE();
+            if (!callValue(peek(argCount), argCount))
+                return INTERPRET_RUNTIME_ERROR;
+            LOAD_FRAME();
+            DISPATCH();
+            }
+  
+        CASE(OP_INVOKE):
+            {
+            ObjString* method   = READ_STRING();
+            int argCount        = READ_BYTE();
+            InlineCache* cache  = READ_CACHE();
+            if (!invoke(frame->closure->function, cache, method, argCount))
+                return INTERPRET_RUNTIME_ERROR;
+ 
+            LOAD_FRAME();
+            DISPATCH();
+            }
+
+        CASE(OP_SUPER_INVOKE):
+            {
+            ObjString* method       = READ_STRING();
+            int argCount            = READ_BYTE();
+            ObjClass* superclass    = AS_CLASS(pop());
+            if (!invokeFromClass(superclass, method, argCount))
+                return INTERPRET_RUNTIME_ERROR;
+            LOAD_FRAME();
+            DISPATCH();
+            }
+
+        CASE(OP_CLOSURE):
+            {
+            ObjFunction* function   = AS_FUNCTION(CONSTANT_AT(READ_SHORT()));
+            ObjClosure* closure     = newClosure(function);
+            push(OBJ_VAL(closure));
+
+            for (int i = 0; i < closure->upvalueCount; i++)
+                {
+                uint8_t isLocal = READ_BYTE();
+                uint16_t idx    = READ_SHORT();
+                if (isLocal)
+                    closure->upvalues[i] = captureUpvalue(frame->slots + idx);
+                else
+                    closure->upvalues[i] = frame->closure->upvalues[idx];
+                
+                // captureUpvalue() can GC, which may have promoted closure
+                writeBarrier((Obj*)closure, OBJ_VAL(closure->upvalues[i]));
+                }
+            DISPATCH();
+            }
+            
+        CASE(OP_CLOSE_UPVALUE):
+            closeUpvalues(vm.stackTop - 1);
+            pop();
+            DISPATCH();
+              
+        CASE(OP_GET_UPVALUE):
+            {
+            uint8_t slot = READ_BYTE();
+            push(*frame->closure->upvalues[slot]->location);
+            DISPATCH();
+            }
+
+        CASE(OP_SET_UPVALUE):
+            {
+            uint8_t slot        = READ_BYTE();
+            ObjUpvalue* upvalue = frame->closure->upvalues[slot];
+            *upvalue->location  = peek(0);
+            writeBarrier((Obj*)upvalue, peek(0));
+            DISPATCH();
+            }
+
+        CASE(OP_GET_UPVALUE_LONG):
+            push(*frame->closure->upvalues[READ_SHORT()]->location);
+            DISPATCH();
+
+        CASE(OP_SET_UPVALUE_LONG):
+            {
+            ObjUpvalue* upvalue = frame->closure->upvalues[READ_SHORT()];
+            *upvalue->location  = peek(0);
+            writeBarrier((Obj*)upvalue, peek(0));
+            DISPATCH();
+            }
+
+        CASE(OP_CLASS):
+            push(OBJ_VAL(newClass(READ_STRING())));
+            DISPATCH();
+
+        CASE(OP_GET_PROPERTY):
+            {
+            if (!IS_INSTANCE(peek(0)))
+                {
+                runtimeError("Only instances have properties.");
+                return INTERPRET_RUNTIME_ERROR;
+                }
+                
+            ObjInstance* instance   = AS_INSTANCE(peek(0));
+            ObjString* name         = READ_STRING();
+            InlineCache* cache      = READ_CACHE();
+
+            InlineCacheEntry* entry = cacheLookup(cache, instance);
+            if (entry != NULL)
+                {
+                if (entry->slot == IC_METHOD)
+                    bindClosure(OBJ_VAL(entry->target));
+                else
                     {
-                    concatenate();
+                    pop(); // Instance.
+                    push(instance->fields[entry->slot]);
                     }
-                else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1)))
+                DISPATCH();
+                }
+
+            ObjFunction* owner  = frame->closure->function;
+            ObjShape* shape     = instance->shape;
+            int slot            = shapeSlot(shape, name);
+            if (slot >= 0)
+                {
+                cacheUpdate(owner, cache, shape, slot, NULL);
+                pop(); // Instance.
+                push(instance->fields[slot]);
+                DISPATCH();
+                }
+                
+            Value method;
+            if (!tableGet(&instance->klass->methods, name, &method))
+                {
+                runtimeError("Undefined property '%s'.", name->chars);
+                return INTERPRET_RUNTIME_ERROR;
+                }
+            cacheUpdate(owner, cache, shape, IC_METHOD, AS_OBJ(method));
+            bindClosure(method);
+            DISPATCH();
+            }
+
+        CASE(OP_SET_PROPERTY):
+            {
+            if (!IS_INSTANCE(peek(1)))
+                {
+                runtimeError("Only instances have fields.");
+                return INTERPRET_RUNTIME_ERROR;
+                }
+
+            ObjInstance* instance   = AS_INSTANCE(peek(1));
+            ObjString* name         = READ_STRING();
+            InlineCache* cache      = READ_CACHE();
+
+            // Either overwrite a field in place, or add one by moving the
+            // instance along the shape transition cached for it
+            InlineCacheEntry* entry = cacheLookup(cache, instance);
+            if (entry != NULL)
+                {
+                if (entry->target == NULL)
                     {
-                    VALUE_TYPE b = AS_NUMBER(pop());
-                    VALUE_TYPE a = AS_NUMBER(pop());
-                    push(NUMBER_VAL(a + b));
+                    instance->fields[entry->slot] = peek(0);
+                    writeBarrier((Obj*)instance, peek(0));
                     }
                 else
+                    instanceAddField(instance,
+                                     (ObjShape*)entry->target,
+                                     peek(0));
+                }
+            else
+                {
+                ObjFunction* owner  = frame->closure->function;
+                ObjShape* shape     = instance->shape;
+                int slot            = shapeSlot(shape, name);
+                if (slot >= 0)
                     {
-                    runtimeError( "Operands must be 2 numbers or 2 strings.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    cacheUpdate(owner, cache, shape, slot, NULL);
+                    instance->fields[slot] = peek(0);
+                    writeBarrier((Obj*)instance, peek(0));
                     }
-                break;
-     
-            case OP_SUBTRACT:
-                BINARY_OP(NUMBER_VAL, -);
-                break;
-      
-            case OP_MULTIPLY:
-                BINARY_OP(NUMBER_VAL, *);
-                break;
-      
-            case OP_DIVIDE:
-                BINARY_OP(NUMBER_VAL, /);
-                break;
-
-            case OP_NOT:
-                push(BOOL_VAL(isFalsey(pop())));
-                break;
-
-            case OP_NEGATE:
-                if (!IS_NUMBER(peek(0)))
+                else
                     {
-                    runtimeError("Operand must be a number.");
-                    return INTERPRET_RUNTIME_ERROR;
+                    ObjShape* next = shapeTransition(shape, name);
+                    cacheUpdate(owner, cache, shape, shape->slotCount,
+                                (Obj*)next);
+                    instanceAddField(instance, next, peek(0));
                     }
-                push(NUMBER_VAL(-AS_NUMBER(pop())));
-                break;
-
-            case OP_PRINT:
-                printValue(pop());
-                printf("\n");
-                break;
+                }
+            Value value = pop();
+            pop();
+            push(value);
+            DISPATCH();
+            }
 
-            case OP_JUMP:
+        /*********************************************************************\
+        |* Signals. Up to 64 known bits read as an integer, and anything else
+        |* as a signal. Stores leave the value stored on the stack, like any
+        |* other assignment
+        \*********************************************************************/
+        CASE(OP_GET_BUS):
+            {
+            if (!isSignalOperand(0))
+                return INTERPRET_RUNTIME_ERROR;
+
+            ObjSignal* signal   = AS_SIGNAL(peek(0));
+            Value value;
+            if (signal->width <= 64)
+                value           = readBits(signal, 0, signal->width);
+            else
                 {
-                uint16_t offset = READ_SHORT();
-                frame->ip += offset;
-                break;
+                ObjSignal* copy = newSignal(signal->width);
+                signalCopy(copy, signal);
+                value           = OBJ_VAL(copy);
                 }
-                
-            case OP_JUMP_IF_FALSE:
+            pop();
+            push(value);
+            DISPATCH();
+            }
+
+        CASE(OP_SET_BUS):
+            {
+            if (!isSignalOperand(1))
+                return INTERPRET_RUNTIME_ERROR;
+            if (!writeBus(AS_SIGNAL(peek(1)), peek(0)))
+                return INTERPRET_RUNTIME_ERROR;
+
+            Value value = pop();
+            pop();
+            push(value);
+            DISPATCH();
+            }
+
+        // A cell of a memory, or a single bit of a signal
+        CASE(OP_MEM_LOAD):
+            {
+            Value value;
+            if (IS_MEMORY(peek(1)))
                 {
-                uint16_t offset = READ_SHORT();
-                if (isFalsey(peek(0)))
-                    frame->ip += offset;
-                break;
+                ObjMemory* memory   = AS_MEMORY(peek(1));
+                if (!isAddress(memory, peek(0)))
+                    return INTERPRET_RUNTIME_ERROR;
+
+                uint64_t cell       = memoryLoad(memory, AS_INT(peek(0)));
+                value = (memory->cellShift < 3) ? SMALL_INT_VAL((int64_t)cell)
+                                                : INT_VAL((int64_t)cell);
                 }
-                    
-            case OP_LOOP:
-                frame->ip -= READ_SHORT();
-                break;
- 
-            case OP_CALL:
+            else
                 {
-                int argCount = READ_BYTE();
-                if (!callValue(peek(argCount), argCount))
+                if (!isIndexable(1))
                     return INTERPRET_RUNTIME_ERROR;
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+
+                ObjSignal* signal   = AS_SIGNAL(peek(1));
+                int first, count;
+                if (!signalBits(signal, peek(0), peek(0), &first, &count))
+                    return INTERPRET_RUNTIME_ERROR;
+                value               = readBits(signal, first, 1);
                 }
-  
-            case OP_INVOKE:
+            vm.stackTop -= 2;
+            push(value);
+            DISPATCH();
+            }
+
+        CASE(OP_MEM_STORE):
+            {
+            if (IS_MEMORY(peek(2)))
                 {
-                ObjString* method   = READ_STRING();
-                int argCount        = READ_BYTE();
-                if (!invoke(method, argCount))
+                ObjMemory* memory   = AS_MEMORY(peek(2));
+                if (!isAddress(memory, peek(1)))
                     return INTERPRET_RUNTIME_ERROR;
-     
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+                if (!IS_INT(peek(0)))
+                    {
+                    runtimeError("Memory cells can only hold integers.");
+                    return INTERPRET_RUNTIME_ERROR;
+                    }
+                memoryStore(memory, AS_INT(peek(1)), (uint64_t)AS_INT(peek(0)));
                 }
-
-            case OP_SUPER_INVOKE:
+            else
                 {
-                ObjString* method       = READ_STRING();
-                int argCount            = READ_BYTE();
-                ObjClass* superclass    = AS_CLASS(pop());
-                if (!invokeFromClass(superclass, method, argCount))
+                if (!isIndexable(2))
+                    return INTERPRET_RUNTIME_ERROR;
+
+                ObjSignal* signal   = AS_SIGNAL(peek(2));
+                int first, count;
+                if (!signalBits(signal, peek(1), peek(1), &first, &count))
+                    return INTERPRET_RUNTIME_ERROR;
+                if (!writeBits(signal, first, 1, peek(0)))
                     return INTERPRET_RUNTIME_ERROR;
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
                 }
 
-            case OP_CLOSURE:
+            Value value = pop();
+            vm.stackTop -= 2;
+            push(value);
+            DISPATCH();
+            }
+
+        CASE(OP_GET_SLICE):
+            {
+            if (!isSignalOperand(2))
+                return INTERPRET_RUNTIME_ERROR;
+
+            ObjSignal* signal   = AS_SIGNAL(peek(2));
+            int first, count;
+            if (!signalBits(signal, peek(1), peek(0), &first, &count))
+                return INTERPRET_RUNTIME_ERROR;
+
+            Value value = readBits(signal, first, count);
+            vm.stackTop -= 3;
+            push(value);
+            DISPATCH();
+            }
+
+        CASE(OP_SET_SLICE):
+            {
+            if (!isSignalOperand(3))
+                return INTERPRET_RUNTIME_ERROR;
+
+            ObjSignal* signal   = AS_SIGNAL(peek(3));
+            int first, count;
+            if (!signalBits(signal, peek(2), peek(1), &first, &count))
+                return INTERPRET_RUNTIME_ERROR;
+            if (!writeBits(signal, first, count, peek(0)))
+                return INTERPRET_RUNTIME_ERROR;
+
+            Value value = pop();
+            vm.stackTop -= 3;
+            push(value);
+            DISPATCH();
+            }
+
+        CASE(OP_METHOD):
+            defineMethod(READ_STRING());
+            DISPATCH();
+
+        CASE(OP_INHERIT):
+            {
+            Value superclass = peek(1);
+            
+            if (!IS_CLASS(superclass))
                 {
-                ObjFunction* function   = AS_FUNCTION(READ_CONSTANT());
-                ObjClosure* closure     = newClosure(function);
-                push(OBJ_VAL(closure));
-    
-                for (int i = 0; i < closure->upvalueCount; i++)
-                    {
-                    uint8_t isLocal = READ_BYTE();
-                    uint8_t idx = READ_BYTE();
-                    if (isLocal)
-                        closure->upvalues[i] = captureUpvalue(frame->slots + idx);
-                    else
-                        closure->upvalues[i] = frame->closure->upvalues[idx];
-                    }
-                break;
+                runtimeError("Superclass must be a class.");
+                return INTERPRET_RUNTIME_ERROR;
                 }
-                
-            case OP_CLOSE_UPVALUE:
-                closeUpvalues(vm.stackTop - 1);
+
+            ObjClass* subclass = AS_CLASS(peek(0));
+            tableAddAll(&AS_CLASS(superclass)->methods, &subclass->methods);
+            rememberObject((Obj*)subclass);
+            pop(); // Subclass.
+            DISPATCH();
+            }
+
+        CASE(OP_GET_SUPER):
+            {
+            ObjString* name = READ_STRING();
+            ObjClass* superclass = AS_CLASS(pop());
+
+            if (!bindMethod(superclass, name))
+                return INTERPRET_RUNTIME_ERROR;
+        
+            DISPATCH();
+            }
+
+        CASE(OP_RETURN):
+            {
+            Value result = pop();
+            closeUpvalues(frame->slots);
+            vm.frameCount--;
+            if (vm.frameCount == 0)
+                {
                 pop();
-                break;
-                  
-            case OP_GET_UPVALUE:
+                return INTERPRET_OK;
+                }
+
+            vm.stackTop = frame->slots;
+            push(result);
+            LOAD_FRAME();
+            DISPATCH();
+            }
+
+        /*********************************************************************\
+        |* Superinstructions. The fused instructions are still in the code
+        |* after the opcode, so each handler reads its operands from where
+        |* they lie, and skips the rest of the sequence. If the operands
+        |* aren't both inline integers or both numbers, it runs just the
+        |* first instruction instead and lets the rest of the sequence run
+        |* as normal
+        \*********************************************************************/
+        CASE(OP_INC_LOCAL):
+            {
+            // GET_LOCAL a, CONSTANT k, ADD, SET_LOCAL a, POP
+            Value* local    = &frame->slots[frame->ip[0]];
+            Value constant  = CONSTANT_AT(frame->ip[2]);
+            if (IS_SMALL_INT(*local) && IS_SMALL_INT(constant))
                 {
-                uint8_t slot = READ_BYTE();
-                push(*frame->closure->upvalues[slot]->location);
-                break;
+                *local = INT_ARITH(AS_SMALL_INT(*local), +,
+                                   AS_SMALL_INT(constant));
+                frame->ip += 7;
+                }
+            else if (IS_NUMBER(*local) && IS_NUMBER(constant))
+                {
+                *local = NUMBER_VAL(AS_NUMBER(*local) + AS_NUMBER(constant));
+                frame->ip += 7;
                 }
+            else
+                {
+                push(*local);
+                frame->ip += 1;
+                }
+            DISPATCH();
+            }
 
-            case OP_SET_UPVALUE:
+        CASE(OP_INC_GLOBAL):
+            {
+            // GET_GLOBAL s, CONSTANT k, ADD, SET_GLOBAL s, POP
+            uint16_t slot   = (uint16_t)((frame->ip[0] << 8) | frame->ip[1]);
+            Value* global   = &vm.globalValues.values[slot];
+            Value constant  = CONSTANT_AT(frame->ip[3]);
+            if (IS_SMALL_INT(*global) && IS_SMALL_INT(constant))
                 {
-                uint8_t slot = READ_BYTE();
-                *frame->closure->upvalues[slot]->location = peek(0);
-                break;
+                *global = INT_ARITH(AS_SMALL_INT(*global), +,
+                                    AS_SMALL_INT(constant));
+                frame->ip += 9;
+                }
+            else if (IS_NUMBER(*global) && IS_NUMBER(constant))
+                {
+                *global = NUMBER_VAL(AS_NUMBER(*global) + AS_NUMBER(constant));
+                frame->ip += 9;
+                }
+            else if (IS_UNDEFINED(*global))
+                {
+                runtimeError("Undefined variable '%s'.", GLOBAL_NAME(slot));
+                return INTERPRET_RUNTIME_ERROR;
+                }
+            else
+                {
+                push(*global);
+                frame->ip += 2;
                 }
+            DISPATCH();
+            }
 
-            case OP_CLASS:
-                push(OBJ_VAL(newClass(READ_STRING())));
+        CASE(OP_ADD_LOCAL_CONST):
+            {
+            // GET_LOCAL a, CONSTANT k, ADD
+            Value local     = frame->slots[frame->ip[0]];
+            Value constant  = CONSTANT_AT(frame->ip[2]);
+            if (IS_SMALL_INT(local) && IS_SMALL_INT(constant))
+                {
+                push(INT_ARITH(AS_SMALL_INT(local), +, AS_SMALL_INT(constant)));
+                frame->ip += 4;
+                }
+            else if (IS_NUMBER(local) && IS_NUMBER(constant))
+                {
+                push(NUMBER_VAL(AS_NUMBER(local) + AS_NUMBER(constant)));
+                frame->ip += 4;
+                }
+            else
+                {
+                push(local);
+                frame->ip += 1;
+                }
+            DISPATCH();
+            }
+
+        CASE(OP_LESS_JUMP):
+            COMPARE_JUMP(<, ARITH_LESS);
+            DISPATCH();
+
+        CASE(OP_GREATER_JUMP):
+            COMPARE_JUMP(>, ARITH_GREATER);
+            DISPATCH();
+
+        }   // INTERPRET_LOOP
+
+    // Only reachable via the switch fallback, on an opcode it doesn't know
+    runtimeError("Unknown opcode.");
+    return INTERPRET_RUNTIME_ERROR;
+
+    #undef INTERPRET_LOOP
+    #undef CASE
+    #undef DISPATCH
+    #undef TRACE_EXECUTION
+    #undef READ_STRING
+    #undef READ_CACHE
+    #undef CONSTANT_AT
+    #undef COMPARE_JUMP
+    #undef LOAD_FRAME
+    #undef GLOBAL_NAME
+    #undef READ_BYTE
+    #undef READ_CONSTANT
+    #undef ARITHMETIC
+    #undef INTEGER_OP
+    #undef BINARY_OP
+    #undef READ_SHORT
+    }
+
+/*****************************************************************************\
+|* Run register code, for as long as the top frame has some. Registers are the
+|* frame's stack slots, and the stack top is kept above them so the GC sees
+|* them all. Returns INTERPRET_OK without finishing if a call or return lands
+|* in a frame running stack code, which interpret() hands back to run()
+\*****************************************************************************/
+static InterpretResult runRegisters(void)
+    {
+    CallFrame* frame        = &(vm.frames[vm.frameCount - 1]);
+    ObjFunction* function   = frame->closure->function;
+    Value* constants        = function->chunk.constants.values;
+    Value* r                = frame->slots;
+    vm.stackTop             = r + function->registers->registerCount;
+
+    #define RK(x)                                                           \
+        (((x) & RK_CONSTANT) ? constants[(x) & ~RK_CONSTANT] : r[x])
+    #define GLOBAL_NAME(slot)                                               \
+        (AS_CSTRING(vm.globalSlotNames.values[slot]))
+
+    // Pick up whatever frame a call or return left on top
+    #define LOAD_FRAME()                                                    \
+        do                                                                  \
+            {                                                               \
+            frame = &vm.frames[vm.frameCount - 1];                          \
+            if (frame->pc == NULL)                                          \
+                return INTERPRET_OK;                                        \
+            function    = frame->closure->function;                         \
+            constants   = function->chunk.constants.values;                 \
+            r           = frame->slots;                                     \
+            vm.stackTop = r + function->registers->registerCount;           \
+            }                                                               \
+        while (false)
+
+    #define ARITHMETIC(arith, b, c)                                         \
+        do                                                                  \
+            {                                                               \
+            Value result;                                                   \
+            if (!arithmetic(arith, b, c, &result))                          \
+                {                                                           \
+                runtimeError("Operands must be numbers.");                  \
+                return INTERPRET_RUNTIME_ERROR;                             \
+                }                                                           \
+            r[insn.a] = result;                                             \
+            }                                                               \
+        while (false)
+
+    #define INTEGER_OP(arith, guard, expr)                                  \
+        do                                                                  \
+            {                                                               \
+            Value b = RK(insn.b);                                           \
+            Value c = RK(insn.c);                                           \
+            if (IS_SMALL_INT(b) && IS_SMALL_INT(c) && (guard))              \
+                {                                                           \
+                int64_t x = AS_SMALL_INT(b);                                \
+                int64_t y = AS_SMALL_INT(c);                                \
+                r[insn.a] = (expr);                                         \
+                }                                                           \
+            else                                                            \
+                {                                                           \
+                Value result;                                               \
+                if (!arithmetic(arith, b, c, &result)                       \
+                 && !signalLogic(arith, b, c, &result))                     \
+                    {                                                       \
+                    runtimeError("Operands must be integers.");             \
+                    return INTERPRET_RUNTIME_ERROR;                         \
+                    }                                                       \
+                r[insn.a] = result;                                         \
+                }                                                           \
+            }                                                               \
+        while (false)
+
+    #define BINARY_OP(valueType, intOp, op, arith)                          \
+        do                                                                  \
+            {                                                               \
+            Value b = RK(insn.b);                                           \
+            Value c = RK(insn.c);                                           \
+            if (IS_SMALL_INT(b) && IS_SMALL_INT(c))                         \
+                r[insn.a] = intOp(AS_SMALL_INT(b), op, AS_SMALL_INT(c));    \
+            else if (IS_NUMBER(b) && IS_NUMBER(c))                          \
+                r[insn.a] = valueType(AS_NUMBER(b) op AS_NUMBER(c));        \
+            else                                                            \
+                ARITHMETIC(arith, b, c);                                    \
+            }                                                               \
+        while (false)
+
+    for (;;)
+        {
+        RegInstruction insn = *frame->pc++;
+
+        #ifdef DEBUG_TRACE_EXECUTION
+            disassembleRegisterInstruction(function,
+                (int)(frame->pc - function->registers->code) - 1);
+        #endif
+
+        switch (insn.op)
+            {
+            case R_MOVE:
+                r[insn.a] = RK(insn.b);
+                break;
+
+            case R_NIL:
+                r[insn.a] = NIL_VAL;
+                break;
+
+            case R_TRUE:
+                r[insn.a] = BOOL_VAL(true);
                 break;
 
-            case OP_GET_PROPERTY:
+            case R_FALSE:
+                r[insn.a] = BOOL_VAL(false);
+                break;
+
+            case R_GET_GLOBAL:
                 {
-                if (!IS_INSTANCE(peek(0)))
+                Value value = vm.globalValues.values[insn.b];
+                if (IS_UNDEFINED(value))
                     {
-                    runtimeError("Only instances have properties.");
+                    runtimeError("Undefined variable '%s'.",
+                                 GLOBAL_NAME(insn.b));
                     return INTERPRET_RUNTIME_ERROR;
                     }
-                    
-                ObjInstance* instance   = AS_INSTANCE(peek(0));
-                ObjString* name         = READ_STRING();
+                r[insn.a] = value;
+                break;
+                }
 
-                Value value;
-                if (tableGet(&instance->fields, name, &value))
+            case R_SET_GLOBAL:
+                if (IS_UNDEFINED(vm.globalValues.values[insn.a]))
                     {
-                    pop(); // Instance.
-                    push(value);
-                    break;
-                    }
-                    
-                if (!bindMethod(instance->klass, name))
+                    runtimeError("Undefined variable '%s'.",
+                                 GLOBAL_NAME(insn.a));
                     return INTERPRET_RUNTIME_ERROR;
-                
-                
+                    }
+                vm.globalValues.values[insn.a] = RK(insn.b);
+                break;
+
+            case R_DEFINE_GLOBAL:
+                vm.globalValues.values[insn.a] = RK(insn.b);
+                break;
+
+            case R_EQUAL:
+                r[insn.a] = BOOL_VAL(valuesEqual(RK(insn.b), RK(insn.c)));
+                break;
+
+            case R_GREATER:
+                BINARY_OP(BOOL_VAL, INT_COMPARE, >, ARITH_GREATER);
                 break;
-                }
 
-            case OP_SET_PROPERTY:
+            case R_LESS:
+                BINARY_OP(BOOL_VAL, INT_COMPARE, <, ARITH_LESS);
+                break;
+
+            case R_ADD:
                 {
-                if (!IS_INSTANCE(peek(1)))
+                Value b = RK(insn.b);
+                Value c = RK(insn.c);
+                if (IS_SMALL_INT(b) && IS_SMALL_INT(c))
+                    r[insn.a] = INT_ARITH(AS_SMALL_INT(b), +, AS_SMALL_INT(c));
+                else if (IS_NUMBER(b) && IS_NUMBER(c))
+                    r[insn.a] = NUMBER_VAL(AS_NUMBER(b) + AS_NUMBER(c));
+                else if (IS_NUMERIC(b) && IS_NUMERIC(c))
+                    ARITHMETIC(ARITH_ADD, b, c);
+                else if (IS_STRING(b) && IS_STRING(c))
+                    {
+                    push(b);
+                    push(c);
+                    concatenate();
+                    r[insn.a] = pop();
+                    }
+                else
                     {
-                    runtimeError("Only instances have fields.");
+                    runtimeError( "Operands must be 2 numbers or 2 strings.");
                     return INTERPRET_RUNTIME_ERROR;
                     }
+                break;
+                }
 
-                ObjInstance* instance = AS_INSTANCE(peek(1));
-                tableSet(&instance->fields, READ_STRING(), peek(0));
-                Value value = pop();
-                pop();
-                push(value);
+            case R_SUBTRACT:
+                BINARY_OP(NUMBER_VAL, INT_ARITH, -, ARITH_SUBTRACT);
+                break;
+
+            case R_MULTIPLY:
+                BINARY_OP(NUMBER_VAL, INT_ARITH, *, ARITH_MULTIPLY);
+                break;
+
+            case R_DIVIDE:
+                {
+                Value b = RK(insn.b);
+                Value c = RK(insn.c);
+                if (IS_NUMBER(b) && IS_NUMBER(c))
+                    r[insn.a] = NUMBER_VAL(AS_NUMBER(b) / AS_NUMBER(c));
+                else
+                    ARITHMETIC(ARITH_DIVIDE, b, c);
                 break;
                 }
 
-            case OP_METHOD:
-                defineMethod(READ_STRING());
+            case R_NOT:
+                r[insn.a] = BOOL_VAL(isFalsey(RK(insn.b)));
                 break;
 
-            case OP_INHERIT:
+            case R_NEGATE:
                 {
-                Value superclass = peek(1);
-                
-                if (!IS_CLASS(superclass))
+                Value result;
+                if (!negateNumeric(RK(insn.b), &result))
                     {
-                    runtimeError("Superclass must be a class.");
+                    runtimeError("Operand must be a number.");
                     return INTERPRET_RUNTIME_ERROR;
                     }
-
-                ObjClass* subclass = AS_CLASS(peek(0));
-                tableAddAll(&AS_CLASS(superclass)->methods, &subclass->methods);
-                pop(); // Subclass.
+                r[insn.a] = result;
                 break;
                 }
 
-            case OP_GET_SUPER:
-                {
-                ObjString* name = READ_STRING();
-                ObjClass* superclass = AS_CLASS(pop());
+            case R_BIT_AND:
+                INTEGER_OP(ARITH_BIT_AND, true, SMALL_INT_VAL(x & y));
+                break;
 
-                if (!bindMethod(superclass, name))
+            case R_BIT_OR:
+                INTEGER_OP(ARITH_BIT_OR, true, SMALL_INT_VAL(x | y));
+                break;
+
+            case R_BIT_XOR:
+                INTEGER_OP(ARITH_BIT_XOR, true, SMALL_INT_VAL(x ^ y));
+                break;
+
+            case R_SHIFT_LEFT:
+                INTEGER_OP(ARITH_SHIFT_LEFT, IS_SHIFT_COUNT(RK(insn.c)),
+                           SHIFT_LEFT(x, y));
+                break;
+
+            case R_SHIFT_RIGHT:
+                INTEGER_OP(ARITH_SHIFT_RIGHT, IS_SHIFT_COUNT(RK(insn.c)),
+                           SHIFT_RIGHT(x, y));
+                break;
+
+            case R_BIT_NOT:
+                {
+                Value result;
+                if (!complementInt(RK(insn.b), &result)
+                 && !signalComplement(RK(insn.b), &result))
+                    {
+                    runtimeError("Operand must be an integer.");
                     return INTERPRET_RUNTIME_ERROR;
-            
+                    }
+                r[insn.a] = result;
                 break;
                 }
 
-            case OP_RETURN:
+            case R_PRINT:
+                printValue(RK(insn.a));
+                printf("\n");
+                break;
+
+            case R_JUMP:
+                frame->pc = function->registers->code + insn.b;
+                break;
+
+            case R_JUMP_IF_FALSE:
+                if (isFalsey(RK(insn.a)))
+                    frame->pc = function->registers->code + insn.b;
+                break;
+
+            case R_CALL:
+                // The callee and its arguments are in place, so just make
+                // them the top of the stack
+                vm.stackTop = r + insn.a + insn.b + 1;
+                if (!callValue(r[insn.a], insn.b))
+                    return INTERPRET_RUNTIME_ERROR;
+                LOAD_FRAME();
+                break;
+
+            case R_RETURN:
                 {
-                Value result = pop();
+                Value result = RK(insn.a);
                 closeUpvalues(frame->slots);
                 vm.frameCount--;
                 if (vm.frameCount == 0)
                     {
-                    pop();
+                    vm.stackTop = vm.stack;
                     return INTERPRET_OK;
                     }
 
                 vm.stackTop = frame->slots;
                 push(result);
-                frame = &vm.frames[vm.frameCount - 1];
+                LOAD_FRAME();
                 break;
                 }
-                
-            }   // switch
-        }   // for
-    
-    #undef READ_STRING
-    #undef READ_BYTE
-    #undef READ_CONSTANT
+
+            default:
+                runtimeError("Unknown register opcode.");
+                return INTERPRET_RUNTIME_ERROR;
+            }
+        }
+
+    #undef RK
+    #undef GLOBAL_NAME
+    #undef LOAD_FRAME
+    #undef ARITHMETIC
+    #undef INTEGER_OP
     #undef BINARY_OP
-    #undef READ_SHORT
     }
 
 /*****************************************************************************\
@@ -723,17 +1941,70 @@ static InterpretResult run(void)
 \*****************************************************************************/
 InterpretResult interpret(const char* source)
     {
-    ObjFunction* function = compile(source);
+    ObjFunction* function = compile(source, strlen(source));
     if (function == NULL)
         return INTERPRET_COMPILE_ERROR;
 
+    return interpretFunction(function);
+    }
+
+/*****************************************************************************\
+|* Helper function: Run until the frames called from the top level return.
+|* Each loop hands over between stack and register code, as the top frame
+|* changes from one to the other
+\*****************************************************************************/
+static InterpretResult execute(void)
+    {
+    InterpretResult result = INTERPRET_OK;
+    while ((result == INTERPRET_OK) && (vm.frameCount > 0))
+        result = (vm.frames[vm.frameCount - 1].pc != NULL) ? runRegisters()
+                                                           : run();
+    return result;
+    }
+
+/*****************************************************************************\
+|* Helper function: Run scheduled events in time order until there are none
+|* left. Each action is called with no arguments, from an empty stack
+\*****************************************************************************/
+static InterpretResult runEvents(void)
+    {
+    Value action;
+    while (nextEvent(&vm.scheduler, &action))
+        {
+        push(action);
+        if (!callValue(action, 0))
+            return INTERPRET_RUNTIME_ERROR;
+
+        InterpretResult result = execute();
+        if (result != INTERPRET_OK)
+            return result;
+
+        // Natives leave their result behind, functions don't
+        vm.stackTop = vm.stack;
+        }
+    return INTERPRET_OK;
+    }
+
+/*****************************************************************************\
+|* Run an already-compiled top-level function, public interface. Anything it
+|* schedules runs once it has finished
+\*****************************************************************************/
+InterpretResult interpretFunction(ObjFunction* function)
+    {
     push(OBJ_VAL(function));
     ObjClosure* closure = newClosure(function);
     pop();
     push(OBJ_VAL(closure));
     call(closure, 0);
 
-    return run();
+    InterpretResult result = execute();
+    if (result == INTERPRET_OK)
+        result = runEvents();
+
+    // A runtime error abandons the simulation along with the script
+    if (result != INTERPRET_OK)
+        clearEvents(&vm.scheduler);
+    return result;
     }
 
 